@@ -1,13 +1,257 @@
 // Copyright (c) Microsoft Corporation.
 // Licensed under the MIT License.
 
+use std::fs::File;
 use std::hint::black_box;
+use std::io::Write as _;
 use std::mem;
+use std::ops::Range;
+use std::time::{Duration, Instant};
 
-use criterion::{BenchmarkId, Criterion, Throughput, criterion_group, criterion_main};
+use criterion::{BatchSize, BenchmarkId, Criterion, Throughput, criterion_group, criterion_main};
+use edit::arena::scratch_arena;
+use edit::buffer::{GapBuffer, RcTextBuffer, Rope, SearchOptions, TextBuffer};
+use edit::document::ReadableDocument;
 use edit::helpers::*;
+use edit::input::Input;
 use edit::simd::MemsetSafe;
-use edit::{hash, oklab, simd, unicode};
+use edit::tui::{Context, ListSelection, Tui};
+use edit::{arena, framebuffer, fuzzy, hash, icu, input, oklab, simd, unicode, vt};
+
+/// A xorshift64 PRNG, so that every run benchmarks the same input.
+struct Rng(u64);
+
+impl Default for Rng {
+    fn default() -> Self {
+        Self(0x2545f4914f6cdd1d)
+    }
+}
+
+impl Rng {
+    /// Returns a random number in `0..n`.
+    fn below(&mut self, n: usize) -> usize {
+        self.0 ^= self.0 << 13;
+        self.0 ^= self.0 >> 7;
+        self.0 ^= self.0 << 17;
+        (self.0 % n as u64) as usize
+    }
+}
+
+/// Returns `count` distinct file names, each made up of one or more of the given `parts`.
+fn file_names(parts: &[&str], count: usize) -> Vec<String> {
+    (0..count)
+        .map(|i| {
+            let mut name = String::new();
+            let mut n = i;
+            loop {
+                name.push_str(parts[n % parts.len()]);
+                n /= parts.len();
+                if n == 0 {
+                    break name;
+                }
+            }
+        })
+        .collect()
+}
+
+fn bench_buffer(c: &mut Criterion) {
+    if arena::init(128 * MEBI).is_err() {
+        return;
+    }
+
+    // Creating a buffer, typing into it and closing it again, like editlines and documents do.
+    // Dropped buffers are recycled, so this mostly measures the buffer pool.
+    let text = "0123456789abcdef".repeat(4 * KIBI);
+    c.benchmark_group("buffer")
+        .throughput(Throughput::Bytes(text.len() as u64))
+        .bench_function("new_large", |b| {
+            b.iter(|| {
+                let mut tb = TextBuffer::new(false).unwrap();
+                tb.write(black_box(text.as_bytes()), true);
+                tb
+            })
+        })
+        .throughput(Throughput::Bytes(64))
+        .bench_function("new_small", |b| {
+            b.iter(|| {
+                let mut tb = TextBuffer::new(true).unwrap();
+                tb.write(black_box(&text.as_bytes()[..64]), true);
+                tb
+            })
+        });
+
+    // Pasting, with CR newlines like in a bracketed paste, compared to typing the same text.
+    let line = "    let total = items.iter().map(|i| i.price * 1.25).sum(); // Grüße\r";
+    let paste = line.repeat(4 * MEBI / line.len());
+    let typed: String = paste.chars().take(64 * KIBI).collect();
+    c.benchmark_group("buffer")
+        .throughput(Throughput::Bytes(paste.len() as u64))
+        .bench_function("paste", |b| {
+            b.iter(|| {
+                let mut tb = TextBuffer::new(false).unwrap();
+                tb.write(black_box(paste.as_bytes()), true);
+                tb
+            })
+        })
+        .throughput(Throughput::Bytes(typed.len() as u64))
+        .bench_function("type", |b| {
+            b.iter(|| {
+                let mut tb = TextBuffer::new(false).unwrap();
+                for ch in black_box(&typed).chars() {
+                    tb.write(ch.encode_utf8(&mut [0; 4]).as_bytes(), false);
+                }
+                tb
+            })
+        });
+}
+
+/// The text storage backends have no common trait, so the benchmarks bring their own.
+trait Storage: ReadableDocument {
+    fn new() -> Self;
+    fn replace(&mut self, range: Range<usize>, src: &[u8]);
+}
+
+impl Storage for GapBuffer {
+    fn new() -> Self {
+        GapBuffer::new(false).unwrap()
+    }
+
+    fn replace(&mut self, range: Range<usize>, src: &[u8]) {
+        self.replace(range, src)
+    }
+}
+
+impl Storage for Rope {
+    fn new() -> Self {
+        Rope::new()
+    }
+
+    fn replace(&mut self, range: Range<usize>, src: &[u8]) {
+        self.replace(range, src)
+    }
+}
+
+/// Runs the same edits against each backend, so that their groups can be compared.
+fn bench_storage<S: Storage>(c: &mut Criterion, name: &str) {
+    const DOC_LEN: usize = 16 * MEBI;
+    const EDITS: usize = 1000;
+    const TYPED: usize = 64 * KIBI;
+    const PASTED_LINES: usize = 64 * KIBI;
+
+    let line = [b'x'; 63].iter().chain(b"\n").copied().collect::<Vec<u8>>();
+    let doc = || {
+        let mut s = S::new();
+        s.replace(0..0, &line.repeat(DOC_LEN / line.len()));
+        s
+    };
+
+    let mut rng = Rng::default();
+    let mut next = |n: usize| rng.below(n);
+    let edits: Vec<_> = (0..EDITS).map(|_| (next(DOC_LEN - 64), next(16), next(16) + 1)).collect();
+
+    c.benchmark_group(name)
+        .sample_size(10)
+        .throughput(Throughput::Elements(EDITS as u64))
+        .bench_function("random_edits", |b| {
+            b.iter_batched_ref(
+                doc,
+                |s| {
+                    for &(off, delete, insert) in &edits {
+                        s.replace(off..off + delete, &line[..insert]);
+                    }
+                },
+                BatchSize::LargeInput,
+            )
+        })
+        .throughput(Throughput::Bytes(TYPED as u64))
+        .bench_function("typing", |b| {
+            b.iter_batched_ref(
+                doc,
+                |s| {
+                    let mut off = DOC_LEN / 2;
+                    for _ in 0..TYPED {
+                        s.replace(off..off, b"a");
+                        off += 1;
+                    }
+                },
+                BatchSize::LargeInput,
+            )
+        })
+        .throughput(Throughput::Bytes((PASTED_LINES * line.len()) as u64))
+        .bench_function("bulk_paste", |b| {
+            // Many adjacent line-sized inserts. TextBuffer::write turns a paste into a single
+            // edit instead, which `buffer/paste` measures.
+            b.iter_batched_ref(
+                doc,
+                |s| {
+                    let mut off = DOC_LEN / 2;
+                    for _ in 0..PASTED_LINES {
+                        s.replace(off..off, &line);
+                        off += line.len();
+                    }
+                },
+                BatchSize::LargeInput,
+            )
+        })
+        .throughput(Throughput::Bytes(DOC_LEN as u64))
+        .bench_function("read", |b| {
+            // Like searching or counting lines: Visit every chunk once.
+            let s = doc();
+            b.iter(|| {
+                let mut off = 0;
+                let mut lines = 0;
+                loop {
+                    let chunk = s.read_forward(off);
+                    if chunk.is_empty() {
+                        break lines;
+                    }
+                    lines = unicode::newlines_forward(chunk, 0, lines, CoordType::MAX).1;
+                    off += chunk.len();
+                }
+            })
+        });
+}
+
+fn bench_fuzzy(c: &mut Criterion) {
+    // Case folding allocates from the scratch arenas.
+    if arena::init(128 * MEBI).is_err() {
+        return;
+    }
+
+    // Something like a large node_modules or build directory.
+    let parts = ["src", "Index", "node_modules", "build", "TextBuffer", "draw", "_", "-", "."];
+    let names = file_names(&parts, 50_000);
+    let query = "srcbuildindex";
+
+    c.benchmark_group("fuzzy::FuzzyFilter")
+        .throughput(Throughput::Elements(names.len() as u64))
+        .bench_function("set_query", |b| {
+            let mut filter = fuzzy::FuzzyFilter::new(names.iter().map(|s| s.as_str()), true);
+            b.iter(|| {
+                filter.set_query("");
+                filter.set_query(black_box(query));
+            })
+        })
+        .bench_function("set_query_typing", |b| {
+            let mut filter = fuzzy::FuzzyFilter::new(names.iter().map(|s| s.as_str()), true);
+            b.iter(|| {
+                filter.set_query("");
+                for i in 1..=query.len() {
+                    filter.set_query(black_box(&query[..i]));
+                }
+            })
+        })
+        .bench_function("score_fuzzy_typing", |b| {
+            b.iter(|| {
+                let scratch = arena::scratch_arena(None);
+                for i in 1..=query.len() {
+                    for name in &names {
+                        black_box(fuzzy::score_fuzzy(&scratch, name, &query[..i], true));
+                    }
+                }
+            })
+        });
+}
 
 fn bench_hash(c: &mut Criterion) {
     c.benchmark_group("hash")
@@ -28,12 +272,215 @@ fn bench_hash(c: &mut Criterion) {
         });
 }
 
+fn bench_icu(c: &mut Criterion) {
+    // The converters allocate from the scratch arenas. Skip the benchmark if ICU isn't installed.
+    if arena::init(128 * MEBI).is_err() || icu::init().is_err() {
+        return;
+    }
+
+    let text = "Hello, world! こんにちは世界！ 你好，世界！\n".repeat(128 * 1024);
+    let encode = |encoding: &str| {
+        icu::convert_parallel(&[text.as_bytes()], "UTF-8", encoding).unwrap().concat()
+    };
+    let serial = |input: &[u8], source: &str, target: &str| {
+        let mut pivot = [mem::MaybeUninit::uninit(); 16 * KIBI];
+        let mut c = icu::Converter::new(&mut pivot, source, target).unwrap();
+        let mut output = Vec::with_capacity(input.len() * 2);
+        let mut input = input;
+        loop {
+            output.reserve(64 * KIBI);
+            let (read, written) = c.convert(input, output.spare_capacity_mut()).unwrap();
+            unsafe { output.set_len(output.len() + written) };
+            if input.is_empty() && written == 0 {
+                break output;
+            }
+            input = &input[read..];
+        }
+    };
+
+    let mut group = c.benchmark_group("icu");
+    for encoding in ["Shift_JIS", "GB18030", "UTF-16LE"] {
+        let encoded = encode(encoding);
+        let encoded = encoded.as_slice();
+        group
+            .throughput(Throughput::Bytes(encoded.len() as u64))
+            .bench_function(BenchmarkId::new("decode_serial", encoding), |b| {
+                b.iter(|| serial(black_box(encoded), encoding, "UTF-8"))
+            })
+            .bench_function(BenchmarkId::new("decode_parallel", encoding), |b| {
+                b.iter(|| icu::convert_parallel(&[black_box(encoded)], encoding, "UTF-8"))
+            })
+            .throughput(Throughput::Bytes(text.len() as u64))
+            .bench_function(BenchmarkId::new("encode_serial", encoding), |b| {
+                b.iter(|| serial(black_box(text.as_bytes()), "UTF-8", encoding))
+            })
+            .bench_function(BenchmarkId::new("encode_parallel", encoding), |b| {
+                b.iter(|| icu::convert_parallel(&[black_box(text.as_bytes())], "UTF-8", encoding))
+            });
+    }
+    group.finish();
+
+    // File names in a mix of scripts, as they'd appear in the file picker.
+    let parts = ["report", "Дата", "日本語", "résumé", "Ωmega", "naïve", "报告", "_v", "2", ".txt"];
+    let names = file_names(&parts, 100_000);
+
+    let mut group = c.benchmark_group("icu::sort");
+    for count in [10_000, 100_000] {
+        let names = &names[..count];
+        group
+            .throughput(Throughput::Elements(count as u64))
+            .bench_function(BenchmarkId::new("compare_strings", count), |b| {
+                b.iter(|| {
+                    let mut names: Vec<_> = names.iter().map(|n| n.as_bytes()).collect();
+                    names.sort_by(|a, b| icu::compare_strings(a, b));
+                    names
+                })
+            })
+            .bench_function(BenchmarkId::new("sort_key", count), |b| {
+                b.iter(|| {
+                    let scratch = arena::scratch_arena(None);
+                    let mut names: Vec<_> = names
+                        .iter()
+                        .map(|n| (icu::sort_key(&scratch, n.as_bytes()), n.as_bytes()))
+                        .collect();
+                    names.sort_unstable_by(|a, b| a.0.cmp(&b.0));
+                    names.len()
+                })
+            });
+    }
+    group.finish();
+}
+
+fn bench_search(c: &mut Criterion) {
+    // Regex searches allocate from the scratch arenas. Skip the benchmark if ICU isn't installed.
+    if arena::init(128 * MEBI).is_err() || icu::init().is_err() {
+        return;
+    }
+
+    // Counts the hits the same way the search bar does.
+    let count = |tb: &mut TextBuffer, pattern: &str, options: SearchOptions| {
+        tb.set_search_highlight(pattern, options);
+        while tb.is_counting_matches() {
+            tb.poll_statistics();
+        }
+        let total = tb.search_matches().map_or(0, |m| m.total);
+        tb.set_search_highlight("", options);
+        total
+    };
+
+    let text = "The quick brown fox jumps over the lazy dog. Grüße aus Köln!\n".repeat(64 * KIBI);
+    let mut tb = TextBuffer::new(false).unwrap();
+    tb.write(text.as_bytes(), true);
+
+    let mut group = c.benchmark_group("search");
+    group.throughput(Throughput::Bytes(text.len() as u64));
+    for (name, pattern, options) in [
+        ("literal", "lazy dog", SearchOptions { match_case: true, ..Default::default() }),
+        ("case_insensitive", "LAZY DOG", SearchOptions::default()),
+        ("case_insensitive_unicode", "KÖLN", SearchOptions::default()),
+        ("whole_word", "fox", SearchOptions { whole_word: true, ..Default::default() }),
+        ("regex", r"l[a-z]+ d[a-z]g", SearchOptions { use_regex: true, ..Default::default() }),
+    ] {
+        group.bench_function(name, |b| b.iter(|| count(&mut tb, black_box(pattern), options)));
+    }
+    drop(group);
+
+    // Switching between searches, like typing into and deleting from the search bar does.
+    // This mostly measures constructing the regex.
+    let mut tb = TextBuffer::new(false).unwrap();
+    tb.write(b"The quick brown fox jumps over the lazy dog.", true);
+    let options = SearchOptions { use_regex: true, ..Default::default() };
+    c.benchmark_group("search").throughput(Throughput::Elements(2)).bench_function(
+        "construct_regex",
+        |b| {
+            b.iter(|| {
+                count(&mut tb, black_box(r"\b(?:quick|lazy)\s+\w+"), options)
+                    + count(&mut tb, black_box(r"\b(?:quick|lazy)\s+\w"), options)
+            })
+        },
+    );
+}
+
+fn bench_input(c: &mut Criterion) {
+    // Terminals send the newlines in pastes as carriage returns.
+    let line = "    let total = items.iter().map(|i| i.price * 1.25).sum(); // Grüße\r";
+    let paste = format!("\x1b[200~{}\x1b[201~", line.repeat(10 * MEBI / line.len()));
+    // Typing with arrow keys and mouse clicks in between.
+    let keys = "hello\x1b[A\x1b[1;5Cworld\x1b[<0;12;5M\x1b[<0;12;5m\r".repeat(16 * KIBI);
+
+    let mut group = c.benchmark_group("input");
+    for (name, text) in [("paste", &paste), ("keys", &keys)] {
+        group.throughput(Throughput::Bytes(text.len() as u64)).bench_function(name, |b| {
+            let mut vt_parser = vt::Parser::new();
+            let mut input_parser = input::Parser::new();
+            b.iter(|| input_parser.parse(vt_parser.parse(black_box(text))).count())
+        });
+    }
+}
+
 fn bench_oklab(c: &mut Criterion) {
     c.benchmark_group("oklab")
         .bench_function("srgb_to_oklab", |b| b.iter(|| oklab::srgb_to_oklab(black_box(0xff212cbe))))
         .bench_function("oklab_blend", |b| {
             b.iter(|| oklab::oklab_blend(black_box(0x7f212cbe), black_box(0x7f3aae3f)))
         });
+
+    // Dimming rows of a framebuffer, up to a 4K terminal's worth of cells (480x135).
+    // The colors come from the default theme, in runs of 1 to 4 cells.
+    let mut rng = Rng::default();
+    let mut colors = Vec::with_capacity(480 * 135);
+    while colors.len() < 480 * 135 {
+        let color = framebuffer::DEFAULT_THEME[rng.below(16)];
+        colors.extend(std::iter::repeat_n(color, rng.below(4) + 1));
+    }
+    colors.truncate(480 * 135);
+
+    let mut group = c.benchmark_group("oklab");
+    for &cells in &[64usize, 480, 480 * 135] {
+        group.throughput(Throughput::Elements(cells as u64)).bench_with_input(
+            BenchmarkId::new("blend_row", cells),
+            &cells,
+            |b, &cells| {
+                b.iter_batched_ref(
+                    || colors[..cells].to_vec(),
+                    |row| oklab::Blender::new(black_box(0x7f000000)).blend_row(row),
+                    BatchSize::SmallInput,
+                )
+            },
+        );
+    }
+}
+
+fn bench_simd_lines_fwd(c: &mut Criterion) {
+    let mut group = c.benchmark_group("simd");
+    let buf = "lorem ipsum dolor sit amet, consectetur adipiscing elit\n"
+        .repeat((64 * MEBI).div_ceil(56));
+
+    for &bytes in &[KIBI, 32 * KIBI, MEBI, 64 * MEBI] {
+        let haystack = &buf.as_bytes()[..bytes];
+        group.throughput(Throughput::Bytes(bytes as u64)).bench_with_input(
+            BenchmarkId::new("lines_fwd", bytes),
+            haystack,
+            |b, haystack| b.iter(|| simd::lines_fwd(black_box(haystack), 0, 0, CoordType::MAX)),
+        );
+    }
+}
+
+fn bench_simd_lines_bwd(c: &mut Criterion) {
+    let mut group = c.benchmark_group("simd");
+    let buf = "lorem ipsum dolor sit amet, consectetur adipiscing elit\n"
+        .repeat((64 * MEBI).div_ceil(56));
+
+    for &bytes in &[KIBI, 32 * KIBI, MEBI, 64 * MEBI] {
+        let haystack = &buf.as_bytes()[..bytes];
+        group.throughput(Throughput::Bytes(bytes as u64)).bench_with_input(
+            BenchmarkId::new("lines_bwd", bytes),
+            haystack,
+            |b, haystack| {
+                b.iter(|| simd::lines_bwd(black_box(haystack), haystack.len(), CoordType::MAX, 0))
+            },
+        );
+    }
 }
 
 fn bench_simd_memchr2(c: &mut Criterion) {
@@ -53,6 +500,40 @@ fn bench_simd_memchr2(c: &mut Criterion) {
     }
 }
 
+fn bench_simd_skip_ascii(c: &mut Criterion) {
+    let mut group = c.benchmark_group("simd");
+    let mut buffer_u8 = [0u8; 2048];
+
+    for &bytes in &[8usize, 32 + 8, 64 + 8, KIBI + 8] {
+        group.throughput(Throughput::Bytes(bytes as u64 + 1)).bench_with_input(
+            BenchmarkId::new("skip_ascii", bytes),
+            &bytes,
+            |b, &size| {
+                buffer_u8.fill(b'a');
+                buffer_u8[size] = 0xC3;
+                b.iter(|| simd::skip_ascii(black_box(&buffer_u8), 0));
+            },
+        );
+    }
+}
+
+fn bench_simd_skip_run(c: &mut Criterion) {
+    let mut group = c.benchmark_group("simd");
+    let mut buffer_u32 = [0u32; 512];
+
+    for &cells in &[8usize, 32 + 8, 64 + 8, 480] {
+        group.throughput(Throughput::Bytes(cells as u64 * 4)).bench_with_input(
+            BenchmarkId::new("skip_run", cells),
+            &cells,
+            |b, &size| {
+                buffer_u32.fill(0xff212cbe);
+                buffer_u32[size] = 0xff3aae3f;
+                b.iter(|| simd::skip_run(black_box(&buffer_u32), 0));
+            },
+        );
+    }
+}
+
 fn bench_simd_memset<T: MemsetSafe + Copy + Default>(c: &mut Criterion) {
     let mut group = c.benchmark_group("simd");
     let name = format!("memset<{}>", std::any::type_name::<T>());
@@ -80,6 +561,8 @@ fn bench_unicode(c: &mut Criterion) {
     );
     let buffer = reference.repeat(10);
     let bytes = buffer.as_bytes();
+    let ascii_buffer = reference.lines().step_by(2).collect::<Vec<_>>().join("\n").repeat(20);
+    let ascii_bytes = ascii_buffer.as_bytes();
 
     c.benchmark_group("unicode::MeasurementConfig::goto_logical")
         .throughput(Throughput::Bytes(bytes.len() as u64))
@@ -92,6 +575,17 @@ fn bench_unicode(c: &mut Criterion) {
                     .with_word_wrap_column(50)
                     .goto_logical(Point::MAX)
             })
+        })
+        .throughput(Throughput::Bytes(ascii_bytes.len() as u64))
+        .bench_function("basic_ascii", |b| {
+            b.iter(|| unicode::MeasurementConfig::new(&ascii_bytes).goto_logical(Point::MAX))
+        })
+        .bench_function("word_wrap_ascii", |b| {
+            b.iter(|| {
+                unicode::MeasurementConfig::new(black_box(&ascii_bytes))
+                    .with_word_wrap_column(50)
+                    .goto_logical(Point::MAX)
+            })
         });
 
     c.benchmark_group("unicode::Utf8Chars")
@@ -100,13 +594,306 @@ fn bench_unicode(c: &mut Criterion) {
             b.iter(|| {
                 unicode::Utf8Chars::new(bytes, 0).fold(0u32, |acc, ch| acc.wrapping_add(ch as u32))
             })
+        })
+        .throughput(Throughput::Bytes(ascii_bytes.len() as u64))
+        .bench_function("next_ascii", |b| {
+            b.iter(|| {
+                unicode::Utf8Chars::new(ascii_bytes, 0)
+                    .fold(0u32, |acc, ch| acc.wrapping_add(ch as u32))
+            })
+        });
+
+    let arena = arena::Arena::new(64 * KIBI).unwrap();
+    c.benchmark_group("arena::ArenaString::from_utf8_lossy")
+        .throughput(Throughput::Bytes(bytes.len() as u64))
+        .bench_function("mixed", |b| {
+            b.iter(|| arena::ArenaString::from_utf8_lossy(&arena, black_box(bytes)).is_ok())
+        })
+        .throughput(Throughput::Bytes(ascii_bytes.len() as u64))
+        .bench_function("ascii", |b| {
+            b.iter(|| arena::ArenaString::from_utf8_lossy(&arena, black_box(ascii_bytes)).is_ok())
         });
 }
 
+/// Generates about `len` bytes of text that resembles source code, with lines that
+/// are `avg_line_len` bytes long on average. The text is the same on every run.
+fn corpus(len: usize, avg_line_len: usize) -> Vec<u8> {
+    let words: Vec<_> =
+        "let total = items.iter() .map(|i| i.price * 1.25) .sum(); // Grüße fn main() { } return"
+            .split(' ')
+            .collect();
+    let mut rng = Rng::default();
+
+    let mut text = Vec::with_capacity(len + 2 * avg_line_len);
+    while text.len() < len {
+        let indent = rng.below(4) * 4;
+        let line_end = text.len() + indent + rng.below(2 * avg_line_len);
+        text.resize(text.len() + indent, b' ');
+        while text.len() < line_end {
+            text.extend_from_slice(words[rng.below(words.len())].as_bytes());
+            text.push(b' ');
+        }
+        text.push(b'\n');
+    }
+    text
+}
+
+/// Loads a document of about `len` bytes from the [`corpus`], the way the editor opens files.
+fn corpus_document(len: usize, avg_line_len: usize) -> RcTextBuffer {
+    let path = std::env::temp_dir().join(format!("edit-bench-{}-{len}.txt", std::process::id()));
+    {
+        let block = corpus(len.min(4 * MEBI), avg_line_len);
+        let mut file = File::create(&path).unwrap();
+        for _ in 0..len.div_ceil(block.len()) {
+            file.write_all(&block).unwrap();
+        }
+    }
+
+    let tb = TextBuffer::new_rc(false).unwrap();
+    tb.borrow_mut().read_file(&mut File::open(&path).unwrap(), None).unwrap();
+    _ = std::fs::remove_file(&path);
+    tb
+}
+
+/// One frame's worth of recorded terminal input. See [`Headless`].
+struct Recorded {
+    text: String,
+    resize: Option<Size>,
+}
+
+impl Recorded {
+    fn text(text: &str) -> Self {
+        Self { text: text.to_string(), resize: None }
+    }
+
+    fn resize(size: Size) -> Self {
+        Self { text: String::new(), resize: Some(size) }
+    }
+}
+
+/// Drives a [`Tui`] without a terminal, the way the editor's main loop does:
+/// Each frame parses one chunk of input, runs a layout pass per input event
+/// until the layout settles, and renders the result into VT output.
+struct Headless {
+    tui: Tui,
+    vt_parser: vt::Parser,
+    input_parser: input::Parser,
+    /// Documents that get their background work polled before each frame.
+    documents: Vec<RcTextBuffer>,
+}
+
+/// The cost of a frame. See [`Headless::frame`].
+struct FrameStats {
+    layout: Duration,
+    render: Duration,
+    output_bytes: usize,
+}
+
+impl Headless {
+    fn new(size: Size, documents: &[&RcTextBuffer], draw: &mut dyn FnMut(&mut Context)) -> Self {
+        let mut headless = Self {
+            tui: Tui::new().unwrap(),
+            vt_parser: vt::Parser::new(),
+            input_parser: input::Parser::new(),
+            documents: documents.iter().map(|&tb| tb.clone()).collect(),
+        };
+        headless.frame(&Recorded::resize(size), draw);
+
+        // Let the background line count and reflow finish, so that they don't skew the results.
+        while headless.documents.iter().any(|tb| {
+            let tb = tb.borrow();
+            tb.is_counting_lines() || tb.is_reflowing()
+        }) {
+            headless.poll();
+            std::thread::sleep(Duration::from_millis(1));
+        }
+        headless.frame(&Recorded::text(""), draw);
+        headless
+    }
+
+    fn poll(&mut self) {
+        for tb in &self.documents {
+            tb.borrow_mut().poll_statistics();
+        }
+    }
+
+    fn frame(&mut self, input: &Recorded, draw: &mut dyn FnMut(&mut Context)) -> FrameStats {
+        let time_beg = Instant::now();
+        self.poll();
+
+        // The resize comes first, just like in the editor.
+        if let Some(size) = input.resize {
+            let mut ctx = self.tui.create_context(Some(Input::Resize(size)));
+            draw(&mut ctx);
+        }
+
+        let mut events = self.input_parser.parse(self.vt_parser.parse(&input.text));
+        while {
+            let event = events.next();
+            let more = event.is_some();
+            let mut ctx = self.tui.create_context(event);
+            draw(&mut ctx);
+            more
+        } {}
+
+        while self.tui.needs_settling() {
+            let mut ctx = self.tui.create_context(None);
+            draw(&mut ctx);
+        }
+
+        let time_mid = Instant::now();
+        let output_bytes = {
+            let scratch = scratch_arena(None);
+            black_box(self.tui.render(&scratch)).len()
+        };
+        let time_end = Instant::now();
+        arena::scratch_trim();
+
+        FrameStats { layout: time_mid - time_beg, render: time_end - time_mid, output_bytes }
+    }
+}
+
+/// Replays the frames of the `script` over and over. Reports the time spent in layout
+/// and in rendering per frame and, as the latter's throughput, the VT output per frame.
+fn bench_e2e_script(
+    c: &mut Criterion,
+    name: &str,
+    headless: &mut Headless,
+    script: &[Recorded],
+    draw: &mut dyn FnMut(&mut Context),
+) {
+    let output_bytes: usize = script.iter().map(|r| headless.frame(r, draw).output_bytes).sum();
+    let mut i = 0;
+    let mut replay = |iters: u64, cost: fn(&FrameStats) -> Duration| {
+        let mut total = Duration::ZERO;
+        for _ in 0..iters {
+            total += cost(&headless.frame(&script[i % script.len()], draw));
+            i += 1;
+        }
+        total
+    };
+
+    c.benchmark_group("e2e")
+        .bench_function(format!("{name}/layout"), |b| {
+            b.iter_custom(|iters| replay(iters, |s| s.layout))
+        })
+        .throughput(Throughput::Bytes((output_bytes / script.len()) as u64))
+        .bench_function(format!("{name}/render"), |b| {
+            b.iter_custom(|iters| replay(iters, |s| s.render))
+        });
+}
+
+fn bench_e2e(c: &mut Criterion) {
+    if arena::init(128 * MEBI).is_err() {
+        return;
+    }
+
+    let size = Size { width: 160, height: 48 };
+    let keys = |keys: &[&str]| keys.iter().map(|k| Recorded::text(k)).collect::<Vec<_>>();
+
+    // Typing in the middle of a 1 GiB file. Files this large are stored in a rope.
+    {
+        let tb = corpus_document(GIBI, 60);
+        let mid = tb.borrow().logical_line_count() / 2;
+        tb.borrow_mut().cursor_move_to_logical(Point { x: 0, y: mid });
+
+        let mut draw = |ctx: &mut Context| {
+            ctx.textarea("textarea", tb.clone());
+            ctx.inherit_focus();
+        };
+        let mut headless = Headless::new(size, &[&tb], &mut draw);
+        let script = keys(&["h", "e", "l", "l", "o", " ", "w", "o", "r", "l", "d", "\r"]);
+        bench_e2e_script(c, "type_1gib", &mut headless, &script, &mut draw);
+    }
+
+    // Paging and wheel-scrolling through a 16 MiB file with long lines and word wrap.
+    // Resizing it reflows the text around the cursor.
+    {
+        let tb = corpus_document(16 * MEBI, 300);
+        tb.borrow_mut().set_word_wrap(true);
+
+        let mut draw = |ctx: &mut Context| {
+            ctx.textarea("textarea", tb.clone());
+            ctx.inherit_focus();
+        };
+        let mut headless = Headless::new(size, &[&tb], &mut draw);
+        let mut script = keys(&["\x1b[6~"; 16]);
+        script.extend(keys(&["\x1b[<65;80;24M"; 16]));
+        script.extend(keys(&["\x1b[1;5H"]));
+        bench_e2e_script(c, "scroll_wrap", &mut headless, &script, &mut draw);
+
+        let script = [Recorded::resize(Size { width: 120, height: 40 }), Recorded::resize(size)];
+        bench_e2e_script(c, "resize_wrap", &mut headless, &script, &mut draw);
+    }
+
+    // Pasting 1 MiB and undoing it again.
+    {
+        let tb = corpus_document(64 * KIBI, 60);
+        let paste = String::from_utf8(corpus(MEBI, 60)).unwrap().replace('\n', "\r");
+        let paste = format!("\x1b[200~{paste}\x1b[201~");
+
+        let mut draw = |ctx: &mut Context| {
+            ctx.textarea("textarea", tb.clone());
+            ctx.inherit_focus();
+        };
+        let mut headless = Headless::new(size, &[&tb], &mut draw);
+        let script = keys(&[&paste, "\x1a"]);
+        bench_e2e_script(c, "paste_1mib", &mut headless, &script, &mut draw);
+    }
+
+    // Moving through a file picker with 50k entries.
+    {
+        let entries: Vec<_> = (0..50_000)
+            .map(|i| if i % 8 == 0 { format!("dir_{i:05}/") } else { format!("file_{i:05}.txt") })
+            .collect();
+        let mut name = String::new();
+
+        let mut draw = |ctx: &mut Context| {
+            let size = ctx.size();
+            ctx.modal_begin("file-picker", "Open File");
+            ctx.attr_intrinsic_size(Size { width: size.width - 20, height: size.height - 10 });
+            {
+                ctx.editline("name", &mut name);
+                ctx.inherit_focus();
+
+                ctx.scrollarea_begin("directory", Size { width: 0, height: size.height - 12 });
+                {
+                    ctx.list_begin("files");
+                    ctx.inherit_focus();
+                    for entry in &entries {
+                        if ctx.list_item(false, entry) != ListSelection::Unchanged {
+                            name.clone_from(entry);
+                        }
+                    }
+                    ctx.list_end();
+                }
+                ctx.scrollarea_end();
+            }
+            ctx.modal_end();
+        };
+        let mut headless = Headless::new(size, &[], &mut draw);
+        let mut script = keys(&["\x1b[B"; 32]);
+        script.extend(keys(&["\x1b[A"; 32]));
+        bench_e2e_script(c, "file_picker_50k", &mut headless, &script, &mut draw);
+    }
+}
+
 fn bench(c: &mut Criterion) {
+    bench_buffer(c);
+    bench_e2e(c);
+    bench_fuzzy(c);
+    bench_storage::<GapBuffer>(c, "gap_buffer");
+    bench_storage::<Rope>(c, "rope");
     bench_hash(c);
+    bench_icu(c);
+    bench_input(c);
+    bench_search(c);
     bench_oklab(c);
+    bench_simd_lines_fwd(c);
+    bench_simd_lines_bwd(c);
     bench_simd_memchr2(c);
+    bench_simd_skip_ascii(c);
+    bench_simd_skip_run(c);
     bench_simd_memset::<u32>(c);
     bench_simd_memset::<u8>(c);
     bench_unicode(c);
@@ -103,6 +103,18 @@ impl Arena {
         unsafe { self.delegate_target().reset(to) }
     }
 
+    pub fn committed(&self) -> usize {
+        self.delegate_target().committed()
+    }
+
+    pub fn peak(&self) -> usize {
+        self.delegate_target().peak()
+    }
+
+    pub fn trim(&self) {
+        self.delegate_target().trim()
+    }
+
     pub fn alloc_uninit<T>(&self) -> &mut MaybeUninit<T> {
         self.delegate_target().alloc_uninit()
     }
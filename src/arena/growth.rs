@@ -0,0 +1,39 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+//! Records which call stacks made arenas commit more memory.
+//! Enabled via the `debug-arena` feature.
+
+use std::backtrace::Backtrace;
+use std::collections::HashMap;
+use std::io;
+use std::sync::Mutex;
+
+static LOG: Mutex<Vec<(usize, Backtrace)>> = Mutex::new(Vec::new());
+
+/// Called by the arena whenever it commits `bytes` more memory.
+pub(super) fn record(bytes: usize) {
+    let backtrace = Backtrace::force_capture();
+    LOG.lock().unwrap_or_else(|e| e.into_inner()).push((bytes, backtrace));
+}
+
+/// Writes the call stacks that made arenas grow, the ones that committed the most memory first.
+pub fn write_growth_report(out: &mut dyn io::Write) -> io::Result<()> {
+    let log = LOG.lock().unwrap_or_else(|e| e.into_inner());
+    let mut sites: HashMap<String, (usize, usize)> = HashMap::new();
+
+    for (bytes, backtrace) in log.iter() {
+        let site = sites.entry(backtrace.to_string()).or_default();
+        site.0 += 1;
+        site.1 += bytes;
+    }
+
+    let mut sites: Vec<_> = sites.into_iter().collect();
+    sites.sort_unstable_by(|a, b| b.1.1.cmp(&a.1.1));
+
+    for (backtrace, (count, bytes)) in sites {
+        writeln!(out, "{bytes} bytes committed in {count} steps at:\n{backtrace}")?;
+    }
+
+    Ok(())
+}
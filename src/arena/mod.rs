@@ -5,13 +5,19 @@
 
 #[cfg(debug_assertions)]
 mod debug;
+#[cfg(feature = "debug-arena")]
+mod growth;
 mod release;
 mod scratch;
 mod string;
 
 #[cfg(all(not(doc), debug_assertions))]
 pub use self::debug::Arena;
+#[cfg(feature = "debug-arena")]
+pub use self::growth::write_growth_report;
 #[cfg(any(doc, not(debug_assertions)))]
 pub use self::release::Arena;
-pub use self::scratch::{ScratchArena, init, scratch_arena};
+pub use self::scratch::{
+    ScratchArena, init, scratch_arena, scratch_committed, scratch_peak, scratch_trim,
+};
 pub use self::string::ArenaString;
@@ -15,6 +15,13 @@ use crate::{apperr, sys};
 
 const ALLOC_CHUNK_SIZE: usize = 64 * KIBI;
 
+/// The number of calls to [`Arena::trim`] over which the peak usage is tracked.
+const HIGH_WATER_FRAMES: usize = 16;
+
+/// [`Arena::trim`] only decommits memory once at least this much of it is unused.
+/// This avoids a syscall each time the usage fluctuates a little.
+const TRIM_THRESHOLD: usize = MEBI;
+
 /// An arena allocator.
 ///
 /// If you have never used an arena allocator before, think of it as
@@ -43,6 +50,11 @@ pub struct Arena {
     capacity: usize,
     commit: Cell<usize>,
     offset: Cell<usize>,
+    /// The highest `offset` since the last call to [`Arena::trim`].
+    peak: Cell<usize>,
+    /// The peaks of the last [`HIGH_WATER_FRAMES`] calls to [`Arena::trim`]. A ring buffer.
+    recent_peaks: [Cell<usize>; HIGH_WATER_FRAMES],
+    recent_index: Cell<usize>,
 
     /// See [`super::debug`], which uses this for borrow tracking.
     #[cfg(debug_assertions)]
@@ -56,6 +68,9 @@ impl Arena {
             capacity: 0,
             commit: Cell::new(0),
             offset: Cell::new(0),
+            peak: Cell::new(0),
+            recent_peaks: [const { Cell::new(0) }; HIGH_WATER_FRAMES],
+            recent_index: Cell::new(0),
 
             #[cfg(debug_assertions)]
             borrows: Cell::new(0),
@@ -71,6 +86,9 @@ impl Arena {
             capacity,
             commit: Cell::new(0),
             offset: Cell::new(0),
+            peak: Cell::new(0),
+            recent_peaks: [const { Cell::new(0) }; HIGH_WATER_FRAMES],
+            recent_index: Cell::new(0),
 
             #[cfg(debug_assertions)]
             borrows: Cell::new(0),
@@ -81,6 +99,38 @@ impl Arena {
         self.offset.get()
     }
 
+    /// Returns the number of bytes that are committed.
+    pub fn committed(&self) -> usize {
+        self.commit.get()
+    }
+
+    /// Returns the highest offset since the last call to [`Arena::trim`].
+    pub fn peak(&self) -> usize {
+        self.peak.get().max(self.offset.get())
+    }
+
+    /// Decommits memory above the highest offset reached during the last
+    /// `HIGH_WATER_FRAMES` frames, returning it to the OS. Call this once per frame.
+    ///
+    /// Without this, a single large allocation (say, a huge paste)
+    /// would keep the arena's memory committed forever.
+    pub fn trim(&self) {
+        let index = self.recent_index.get();
+        self.recent_peaks[index].set(self.peak());
+        self.recent_index.set((index + 1) % HIGH_WATER_FRAMES);
+        self.peak.set(self.offset.get());
+
+        let high_water = self.recent_peaks.iter().map(Cell::get).max().unwrap_or(0);
+        let keep = (high_water + ALLOC_CHUNK_SIZE - 1) & !(ALLOC_CHUNK_SIZE - 1);
+        let commit = self.commit.get();
+
+        if commit >= keep + TRIM_THRESHOLD
+            && unsafe { sys::virtual_decommit(self.base.add(keep), commit - keep).is_ok() }
+        {
+            self.commit.set(keep);
+        }
+    }
+
     /// "Deallocates" the memory in the arena down to the given offset.
     ///
     /// # Safety
@@ -95,6 +145,7 @@ impl Arena {
             unsafe { slice::from_raw_parts_mut(self.base.add(to).as_ptr(), len).fill(0xDD) };
         }
 
+        self.peak.set(self.peak());
         self.offset.replace(to);
     }
 
@@ -139,6 +190,9 @@ impl Arena {
             return Err(AllocError);
         }
 
+        #[cfg(feature = "debug-arena")]
+        super::growth::record(commit_new - commit_old);
+
         if cfg!(debug_assertions) {
             let ptr = unsafe { self.base.add(offset) };
             let len = (end + 128).min(self.commit.get()) - offset;
@@ -276,3 +330,35 @@ unsafe impl Allocator for Arena {
         Ok(NonNull::slice_from_raw_parts(ptr, len))
     }
 }
+
+#[cfg(test)]
+mod test {
+    use super::*;
+
+    #[test]
+    fn test_trim() {
+        let arena = Arena::new(64 * MEBI).unwrap();
+
+        arena.alloc_uninit_slice::<u8>(8 * MEBI);
+        unsafe { arena.reset(0) };
+        assert_eq!(arena.peak(), 8 * MEBI);
+
+        // The peak of the last few frames is retained...
+        arena.trim();
+        assert_eq!(arena.committed(), 8 * MEBI);
+        assert_eq!(arena.peak(), 0);
+
+        // ...until it falls out of the window.
+        for _ in 1..HIGH_WATER_FRAMES {
+            arena.trim();
+        }
+        assert_eq!(arena.committed(), 8 * MEBI);
+        arena.trim();
+        assert_eq!(arena.committed(), 0);
+
+        // The decommitted memory can be committed again.
+        let s = arena.alloc_uninit_slice::<u8>(2 * MEBI);
+        s.fill(MaybeUninit::new(1));
+        assert_eq!(arena.committed(), 2 * MEBI);
+    }
+}
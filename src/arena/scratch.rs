@@ -23,6 +23,24 @@ pub fn init(capacity: usize) -> apperr::Result<()> {
     Ok(())
 }
 
+/// Returns the total committed size of the scratch arenas.
+pub fn scratch_committed() -> usize {
+    unsafe { S_SCRATCH[0].committed() + S_SCRATCH[1].committed() }
+}
+
+/// Returns the total peak usage of the scratch arenas since the last [`scratch_trim`].
+pub fn scratch_peak() -> usize {
+    unsafe { S_SCRATCH[0].peak() + S_SCRATCH[1].peak() }
+}
+
+/// Calls [`Arena::trim`] on the scratch arenas. Call this once per frame.
+pub fn scratch_trim() {
+    unsafe {
+        S_SCRATCH[0].trim();
+        S_SCRATCH[1].trim();
+    }
+}
+
 /// Need an arena for temporary allocations? [`scratch_arena`] got you covered.
 /// Call [`scratch_arena`] and it'll return an [`Arena`] that resets when it goes out of scope.
 ///
@@ -6,6 +6,7 @@ use std::ops::{Bound, Deref, DerefMut, RangeBounds};
 
 use super::Arena;
 use crate::helpers::*;
+use crate::simd;
 
 /// A custom string type, because `std` lacks allocator support for [`String`].
 ///
@@ -51,14 +52,16 @@ impl<'a> ArenaString<'a> {
     /// If the entire string is valid, it returns `Ok(text)`.
     /// Otherwise, it returns `Err(ArenaString)` with all invalid sequences replaced with U+FFFD.
     pub fn from_utf8_lossy<'s>(arena: &'a Arena, text: &'s [u8]) -> Result<&'s str, Self> {
-        let mut iter = text.utf8_chunks();
+        // Most of our input is ASCII, which is valid UTF-8 and can be skipped in bulk.
+        let ascii = simd::skip_ascii(text, 0);
+        let mut iter = text[ascii..].utf8_chunks();
         let Some(mut chunk) = iter.next() else {
-            return Ok("");
+            return Ok(unsafe { str::from_utf8_unchecked(text) });
         };
 
         let valid = chunk.valid();
         if chunk.invalid().is_empty() {
-            debug_assert_eq!(valid.len(), text.len());
+            debug_assert_eq!(ascii + valid.len(), text.len());
             return Ok(unsafe { str::from_utf8_unchecked(text) });
         }
 
@@ -66,6 +69,7 @@ impl<'a> ArenaString<'a> {
 
         let mut res = Self::new_in(arena);
         res.reserve(text.len());
+        res.push_str(unsafe { str::from_utf8_unchecked(&text[..ascii]) });
 
         loop {
             res.push_str(chunk.valid());
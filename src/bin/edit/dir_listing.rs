@@ -0,0 +1,249 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+//! Lists the directory shown in the file picker on a background thread.
+//!
+//! Reading a directory can take seconds on network drives or for huge
+//! directories, which would freeze the UI if done during layout. Instead, a worker
+//! thread sends the entries over in batches, which [`DirListing::poll`] merges
+//! into the sorted list by their collation sort keys. Completed listings are kept in
+//! a [`DirListingCache`] and reused for as long as the modification time of their
+//! directory stays the same.
+
+use std::collections::VecDeque;
+use std::ffi::OsString;
+use std::path::{Path, PathBuf};
+use std::sync::Arc;
+use std::sync::atomic::{AtomicBool, Ordering};
+use std::sync::mpsc::{self, Receiver, TryRecvError};
+use std::time::{Duration, Instant, SystemTime};
+use std::{fs, mem, thread};
+
+use edit::arena::scratch_arena;
+use edit::icu;
+
+use crate::state::DisplayablePathBuf;
+
+/// The worker sends a batch once it has this many entries...
+const BATCH_LEN: usize = 4096;
+/// ...or once this much time has passed since the last one, whichever comes first.
+const BATCH_INTERVAL: Duration = Duration::from_millis(16);
+
+/// The number of completed listings kept around.
+const CACHE_LEN: usize = 8;
+
+struct Job {
+    receiver: Receiver<Vec<OsString>>,
+    cancel: Arc<AtomicBool>,
+}
+
+impl Drop for Job {
+    fn drop(&mut self) {
+        // The thread is left detached, but it'll exit after its current entry.
+        self.cancel.store(true, Ordering::Relaxed);
+    }
+}
+
+pub struct DirListing {
+    dir: PathBuf,
+    /// The modification time of `dir` before it was read.
+    /// `None` if the listing must not be cached.
+    mtime: Option<SystemTime>,
+    entries: Vec<DisplayablePathBuf>,
+    /// Entries before this index (i.e. "..") are not sorted.
+    sorted_from: usize,
+    /// The sort keys of `entries[sorted_from..]`. See [`sort_key`].
+    keys: Vec<Box<[u8]>>,
+    job: Option<Job>,
+}
+
+impl DirListing {
+    /// Starts listing `dir`, unless `cache` has an up-to-date listing of it.
+    pub fn new(dir: &Path, cache: &mut DirListingCache) -> Self {
+        #[cfg(windows)]
+        if dir.as_os_str().is_empty() {
+            // If the path is empty, we are at the drive picker.
+            // Add all drives as entries.
+            let entries = edit::sys::drives()
+                .map(|drive| DisplayablePathBuf::from_string(format!("{drive}:\\")))
+                .collect();
+            return Self {
+                dir: PathBuf::new(),
+                mtime: None,
+                entries,
+                sorted_from: 0,
+                keys: Vec::new(),
+                job: None,
+            };
+        }
+
+        let mtime = fs::metadata(dir).and_then(|m| m.modified()).ok();
+        if let Some(mtime) = mtime
+            && let Some(listing) = cache.take(dir, mtime)
+        {
+            return listing;
+        }
+
+        let mut entries = Vec::new();
+        if cfg!(windows) || dir.parent().is_some() {
+            entries.push(DisplayablePathBuf::from(".."));
+        }
+        let sorted_from = entries.len();
+
+        let (sender, receiver) = mpsc::channel();
+        let cancel = Arc::new(AtomicBool::new(false));
+        let job = {
+            let dir = dir.to_path_buf();
+            let cancelled = cancel.clone();
+            thread::Builder::new()
+                .name("dir-listing".into())
+                .spawn(move || {
+                    let mut batch = Vec::new();
+                    let mut last_send = Instant::now();
+
+                    let Ok(iter) = fs::read_dir(&dir) else {
+                        return;
+                    };
+                    for entry in iter.flatten() {
+                        if cancelled.load(Ordering::Relaxed) {
+                            return;
+                        }
+
+                        // The file type usually comes straight from the directory entry.
+                        // Only symlinks need to be resolved to tell whether they point to a directory.
+                        let Ok(file_type) = entry.file_type() else {
+                            continue;
+                        };
+                        let mut name = entry.file_name();
+                        if file_type.is_dir()
+                            || (file_type.is_symlink()
+                                && fs::metadata(entry.path()).is_ok_and(|m| m.is_dir()))
+                        {
+                            name.push("/");
+                        }
+                        batch.push(name);
+
+                        if batch.len() >= BATCH_LEN || last_send.elapsed() >= BATCH_INTERVAL {
+                            if sender.send(mem::take(&mut batch)).is_err() {
+                                return;
+                            }
+                            last_send = Instant::now();
+                        }
+                    }
+
+                    if !batch.is_empty() {
+                        _ = sender.send(batch);
+                    }
+                })
+                .ok()
+                .map(|_| Job { receiver, cancel })
+        };
+
+        // Without a worker the listing stays empty, which is not worth remembering.
+        let mtime = mtime.filter(|_| job.is_some());
+        Self { dir: dir.to_path_buf(), mtime, entries, sorted_from, keys: Vec::new(), job }
+    }
+
+    pub fn entries(&self) -> &[DisplayablePathBuf] {
+        &self.entries
+    }
+
+    /// Returns true once all entries were listed.
+    pub fn is_complete(&self) -> bool {
+        self.job.is_none()
+    }
+
+    /// Adds the entries listed since the last call.
+    /// Returns the indices they were sorted into, in ascending order.
+    pub fn poll(&mut self) -> Vec<usize> {
+        let Some(job) = &self.job else {
+            return Vec::new();
+        };
+
+        let mut added = Vec::new();
+        loop {
+            match job.receiver.try_recv() {
+                Ok(batch) => added.extend(batch.into_iter().map(|name| {
+                    let entry = DisplayablePathBuf::from(name);
+                    (sort_key(&entry), entry)
+                })),
+                Err(TryRecvError::Empty) => break,
+                Err(TryRecvError::Disconnected) => {
+                    self.job = None;
+                    break;
+                }
+            }
+        }
+
+        if added.is_empty() {
+            return Vec::new();
+        }
+
+        added.sort_unstable_by(|a, b| a.0.cmp(&b.0));
+
+        // Merge the new entries into the already sorted ones.
+        let old_keys = mem::take(&mut self.keys);
+        let old_entries = self.entries.split_off(self.sorted_from);
+        let mut old = old_keys.into_iter().zip(old_entries).peekable();
+        let mut new = added.into_iter().peekable();
+        let mut indices = Vec::with_capacity(new.len());
+        self.keys.reserve_exact(old.len() + new.len());
+        self.entries.reserve_exact(old.len() + new.len());
+
+        loop {
+            let next = match (old.peek(), new.peek()) {
+                (Some(a), Some(b)) if a.0 <= b.0 => old.next(),
+                (_, Some(_)) => {
+                    indices.push(self.entries.len());
+                    new.next()
+                }
+                _ => old.next(),
+            };
+            let Some((key, entry)) = next else {
+                break;
+            };
+            self.keys.push(key);
+            self.entries.push(entry);
+        }
+
+        indices
+    }
+}
+
+/// Sorts directories first, then by name.
+fn sort_key(entry: &DisplayablePathBuf) -> Box<[u8]> {
+    let name = entry.as_bytes();
+    let is_dir = name.last() == Some(&b'/');
+
+    let scratch = scratch_arena(None);
+    let name_key = icu::sort_key(&scratch, name);
+    let mut key = Vec::with_capacity(1 + name_key.len());
+    key.push(if is_dir { 0 } else { 1 });
+    key.extend_from_slice(&name_key);
+    key.into_boxed_slice()
+}
+
+/// The most recently used, completed directory listings.
+#[derive(Default)]
+pub struct DirListingCache {
+    listings: VecDeque<DirListing>,
+}
+
+impl DirListingCache {
+    /// Keeps `listing` for later, if it's complete.
+    pub fn insert(&mut self, listing: DirListing) {
+        if listing.is_complete() && listing.mtime.is_some() {
+            self.listings.retain(|l| l.dir != listing.dir);
+            self.listings.truncate(CACHE_LEN - 1);
+            self.listings.push_front(listing);
+        }
+    }
+
+    /// Removes the listing of `dir` from the cache and returns it,
+    /// if it was made when the directory had the given modification time.
+    fn take(&mut self, dir: &Path, mtime: SystemTime) -> Option<DirListing> {
+        let index = self.listings.iter().position(|l| l.dir == dir)?;
+        let listing = self.listings.remove(index)?;
+        if listing.mtime == Some(mtime) { Some(listing) } else { None }
+    }
+}
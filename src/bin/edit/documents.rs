@@ -2,17 +2,23 @@
 // Licensed under the MIT License.
 
 use std::collections::LinkedList;
-use std::ffi::OsStr;
-use std::fs::File;
+use std::ffi::{OsStr, OsString};
+use std::fs::{self, File, OpenOptions};
+use std::io;
 use std::path::{Path, PathBuf};
+use std::thread::{self, JoinHandle};
 
-use edit::buffer::{RcTextBuffer, TextBuffer};
-use edit::helpers::{CoordType, Point};
+use edit::buffer::{RcTextBuffer, StorageKind, TextBuffer};
+use edit::helpers::{CoordType, MEBI, Point};
 use edit::simd::memrchr2;
 use edit::{apperr, path, sys};
 
 use crate::state::DisplayablePathBuf;
 
+/// Documents at least this large are saved on a background thread,
+/// from a snapshot of their contents, so that editing can continue meanwhile.
+const BACKGROUND_SAVE_THRESHOLD: usize = 16 * MEBI;
+
 pub struct Document {
     pub buffer: RcTextBuffer,
     pub path: Option<PathBuf>,
@@ -20,22 +26,54 @@ pub struct Document {
     pub filename: String,
     pub file_id: Option<sys::FileId>,
     pub new_file_counter: usize,
+    save_job: Option<SaveJob>,
 }
 
 impl Document {
     pub fn save(&mut self, new_path: Option<PathBuf>) -> apperr::Result<()> {
+        // The previous save is about to be superseded, so its result doesn't matter.
+        _ = self.finish_save();
+
         let path = new_path.as_deref().unwrap_or_else(|| self.path.as_ref().unwrap().as_path());
-        let mut file = DocumentManager::open_for_writing(path)?;
+        let mut tb = self.buffer.borrow_mut();
 
-        {
-            let mut tb = self.buffer.borrow_mut();
-            tb.write_file(&mut file)?;
-        }
+        let mut file = match SaveFile::create_replacement(path)? {
+            Some(file) => {
+                // On Windows a file can't be replaced while it's mapped into memory.
+                // Elsewhere the mapping keeps referring to the old file, which is fine.
+                if cfg!(windows) {
+                    tb.detach_file()?;
+                }
+                file
+            }
+            None => {
+                // The buffer may still be backed by the file we're about to truncate.
+                tb.detach_file()?;
+                SaveFile::open_in_place(path)?
+            }
+        };
 
-        if let Ok(id) = sys::file_id(None, path) {
-            self.file_id = Some(id);
+        if tb.text_length() >= BACKGROUND_SAVE_THRESHOLD {
+            let snapshot = tb.snapshot_for_writing()?;
+            let generation = snapshot.generation();
+            let thread = thread::Builder::new().name("save".into()).spawn(move || {
+                snapshot.write_to(&mut file.file)?;
+                file.commit()
+            })?;
+            self.save_job = Some(SaveJob { thread: Some(thread), generation });
+        } else {
+            tb.write_file(&mut file.file)?;
+            if let Err(err) = file.commit() {
+                tb.mark_as_dirty();
+                return Err(err);
+            }
+            if let Ok(id) = sys::file_id(None, path) {
+                self.file_id = Some(id);
+            }
         }
 
+        drop(tb);
+
         if let Some(path) = new_path {
             self.set_path(path);
         }
@@ -43,7 +81,41 @@ impl Document {
         Ok(())
     }
 
+    /// Returns true while the document is being saved in the background.
+    /// It remains dirty until that's done.
+    pub fn is_saving(&self) -> bool {
+        self.save_job.is_some()
+    }
+
+    /// Completes the background save if it's done and returns its result.
+    fn poll_save(&mut self) -> Option<apperr::Result<()>> {
+        if self.save_job.as_ref().is_some_and(|job| job.is_finished()) {
+            Some(self.finish_save())
+        } else {
+            None
+        }
+    }
+
+    /// Waits for the background save, if any, and applies its result.
+    fn finish_save(&mut self) -> apperr::Result<()> {
+        let Some(mut job) = self.save_job.take() else {
+            return Ok(());
+        };
+
+        job.join()?;
+        self.buffer.borrow_mut().mark_as_saved(job.generation);
+        if let Some(path) = &self.path
+            && let Ok(id) = sys::file_id(None, path)
+        {
+            self.file_id = Some(id);
+        }
+        Ok(())
+    }
+
     pub fn reread(&mut self, encoding: Option<&'static str>) -> apperr::Result<()> {
+        // Don't read the file while it's still being written.
+        self.finish_save()?;
+
         let path = self.path.as_ref().unwrap().as_path();
         let mut file = DocumentManager::open_for_reading(path)?;
 
@@ -74,9 +146,129 @@ impl Document {
     }
 }
 
+/// A save running on a background thread. See [`BACKGROUND_SAVE_THRESHOLD`].
+struct SaveJob {
+    thread: Option<JoinHandle<apperr::Result<()>>>,
+    /// The buffer generation that's being saved.
+    generation: u32,
+}
+
+impl SaveJob {
+    fn is_finished(&self) -> bool {
+        self.thread.as_ref().is_none_or(|t| t.is_finished())
+    }
+
+    fn join(&mut self) -> apperr::Result<()> {
+        match self.thread.take() {
+            Some(thread) => thread.join().unwrap_or_else(|_| Err(io::Error::other("save").into())),
+            None => Ok(()),
+        }
+    }
+}
+
+impl Drop for SaveJob {
+    fn drop(&mut self) {
+        // Never leave a save half-done, even if the document is closed meanwhile.
+        _ = self.join();
+    }
+}
+
+/// A file that's being saved.
+///
+/// If possible, the contents are written to a temporary file next to the target,
+/// which only replaces it once it was written completely. That way, neither errors
+/// (like a full disk) nor crashes can leave a half-written file behind.
+/// Otherwise, the target is truncated and written in place.
+struct SaveFile {
+    file: File,
+    /// The target path, canonicalized if the temporary file is used.
+    path: PathBuf,
+    /// The temporary file, if any. It's deleted if the save doesn't complete.
+    temp_path: Option<PathBuf>,
+}
+
+impl SaveFile {
+    /// Creates a temporary file to replace `path` with.
+    /// Returns `None` if `path` can't or shouldn't be replaced. See [`sys::file_is_replaceable`].
+    fn create_replacement(path: &Path) -> apperr::Result<Option<Self>> {
+        // Replace the file a symlink points to, not the symlink.
+        let (path, original) = match fs::canonicalize(path) {
+            Ok(path) => {
+                // Check the permissions the same way an in-place save would,
+                // and don't already truncate the file while doing so.
+                let original = OpenOptions::new().write(true).open(&path)?;
+                if !sys::file_is_replaceable(&original) {
+                    return Ok(None);
+                }
+                (path, Some(original))
+            }
+            Err(err) if err.kind() == io::ErrorKind::NotFound => (path.to_path_buf(), None),
+            Err(err) => return Err(err.into()),
+        };
+
+        let (Some(dir), Some(name)) = (path.parent(), path.file_name()) else {
+            return Ok(None);
+        };
+
+        for i in 0..100 {
+            let mut temp_name = OsString::from(".");
+            temp_name.push(name);
+            temp_name.push(format!(".{i}.tmp"));
+            let temp_path = dir.join(temp_name);
+
+            match OpenOptions::new().write(true).create_new(true).open(&temp_path) {
+                Ok(file) => {
+                    let file = Self { file, path, temp_path: Some(temp_path) };
+                    if let Some(original) = original {
+                        let Ok(permissions) = original.metadata().map(|m| m.permissions()) else {
+                            return Ok(None);
+                        };
+                        if file.file.set_permissions(permissions).is_err() {
+                            return Ok(None);
+                        }
+                    }
+                    return Ok(Some(file));
+                }
+                Err(err) if err.kind() == io::ErrorKind::AlreadyExists => continue,
+                // For instance, if the directory isn't writable, but the file is.
+                Err(_) => return Ok(None),
+            }
+        }
+
+        Ok(None)
+    }
+
+    /// Truncates `path` to be written in place.
+    fn open_in_place(path: &Path) -> apperr::Result<Self> {
+        let file = DocumentManager::open_for_writing(path)?;
+        Ok(Self { file, path: path.to_path_buf(), temp_path: None })
+    }
+
+    /// Moves the temporary file, if any, into place.
+    fn commit(mut self) -> apperr::Result<()> {
+        if let Some(temp_path) = &self.temp_path {
+            // Otherwise, a crash shortly after the rename may leave an empty file behind.
+            self.file.sync_all()?;
+            fs::rename(temp_path, &self.path)?;
+            self.temp_path = None;
+        }
+        Ok(())
+    }
+}
+
+impl Drop for SaveFile {
+    fn drop(&mut self) {
+        if let Some(temp_path) = &self.temp_path {
+            _ = fs::remove_file(temp_path);
+        }
+    }
+}
+
 #[derive(Default)]
 pub struct DocumentManager {
     list: LinkedList<Document>,
+    map_large_files: bool,
+    storage_kind: StorageKind,
 }
 
 impl DocumentManager {
@@ -109,12 +301,51 @@ impl DocumentManager {
         false
     }
 
+    /// See [`TextBuffer::set_map_large_files`]. Applies to documents opened afterwards.
+    pub fn set_map_large_files(&mut self, enabled: bool) {
+        self.map_large_files = enabled;
+    }
+
+    /// See [`TextBuffer::set_storage_kind`]. Applies to documents opened afterwards.
+    pub fn set_storage_kind(&mut self, kind: StorageKind) {
+        self.storage_kind = kind;
+    }
+
+    /// Folds the progress of background line counts, reflows and search
+    /// hit counts into the documents' statistics.
+    /// Returns true while any of them are still running, or just finished
+    /// and their final state has yet to be drawn.
+    pub fn poll_statistics(&mut self) -> bool {
+        let mut pending = false;
+        for doc in &self.list {
+            let mut tb = doc.buffer.borrow_mut();
+            let busy = |tb: &TextBuffer| {
+                tb.is_counting_lines() || tb.is_reflowing() || tb.is_counting_matches()
+            };
+            pending |= busy(&tb);
+            tb.poll_statistics();
+            pending |= busy(&tb);
+        }
+        pending
+    }
+
+    /// Completes one of the background saves that are done and returns its result.
+    /// Returns `None` if there are none.
+    pub fn poll_saves(&mut self) -> Option<apperr::Result<()>> {
+        self.list.iter_mut().find_map(|doc| doc.poll_save())
+    }
+
+    /// Returns true while any document is being saved in the background.
+    pub fn is_saving(&self) -> bool {
+        self.list.iter().any(|doc| doc.is_saving())
+    }
+
     pub fn remove_active(&mut self) {
         self.list.pop_front();
     }
 
     pub fn add_untitled(&mut self) -> apperr::Result<&mut Document> {
-        let buffer = Self::create_buffer()?;
+        let buffer = self.create_buffer()?;
         let mut doc = Document {
             buffer,
             path: None,
@@ -122,6 +353,7 @@ impl DocumentManager {
             filename: Default::default(),
             file_id: None,
             new_file_counter: 0,
+            save_job: None,
         };
         self.gen_untitled_name(&mut doc);
 
@@ -161,7 +393,7 @@ impl DocumentManager {
             return Ok(doc);
         }
 
-        let buffer = Self::create_buffer()?;
+        let buffer = self.create_buffer()?;
         {
             if let Some(file) = &mut file {
                 let mut tb = buffer.borrow_mut();
@@ -182,6 +414,7 @@ impl DocumentManager {
             filename: Default::default(),
             file_id,
             new_file_counter: 0,
+            save_job: None,
         };
         doc.set_path(path);
 
@@ -207,10 +440,12 @@ impl DocumentManager {
         File::create(path).map_err(apperr::Error::from)
     }
 
-    fn create_buffer() -> apperr::Result<RcTextBuffer> {
+    fn create_buffer(&self) -> apperr::Result<RcTextBuffer> {
         let buffer = TextBuffer::new_rc(false)?;
         {
             let mut tb = buffer.borrow_mut();
+            tb.set_map_large_files(self.map_large_files);
+            tb.set_storage_kind(self.storage_kind);
             tb.set_insert_final_newline(!cfg!(windows)); // As mandated by POSIX.
             tb.set_margin_enabled(true);
             tb.set_line_highlight_enabled(true);
@@ -302,4 +537,28 @@ mod tests {
         assert_eq!(parse("file.txt:10"), ("file.txt", Some(Point { x: 0, y: 9 })));
         assert_eq!(parse("file.txt:10:5"), ("file.txt", Some(Point { x: 4, y: 9 })));
     }
+
+    #[test]
+    fn test_save_file_replaces() {
+        let dir = std::env::temp_dir().join(format!("edit-test-save-{}", std::process::id()));
+        fs::create_dir_all(&dir).unwrap();
+        let path = dir.join("file.txt");
+        fs::write(&path, "old").unwrap();
+
+        // An abandoned save leaves the original untouched and cleans up after itself.
+        {
+            let mut file = SaveFile::create_replacement(&path).unwrap().unwrap();
+            io::Write::write_all(&mut file.file, b"new").unwrap();
+        }
+        assert_eq!(fs::read_to_string(&path).unwrap(), "old");
+        assert_eq!(fs::read_dir(&dir).unwrap().count(), 1);
+
+        let mut file = SaveFile::create_replacement(&path).unwrap().unwrap();
+        io::Write::write_all(&mut file.file, b"new").unwrap();
+        file.commit().unwrap();
+        assert_eq!(fs::read_to_string(&path).unwrap(), "new");
+        assert_eq!(fs::read_dir(&dir).unwrap().count(), 1);
+
+        fs::remove_dir_all(&dir).unwrap();
+    }
 }
@@ -5,9 +5,9 @@ use std::num::ParseIntError;
 
 use edit::framebuffer::IndexedColor;
 use edit::helpers::*;
-use edit::icu;
 use edit::input::{kbmod, vk};
 use edit::tui::*;
+use edit::{arena_format, icu};
 
 use crate::localization::*;
 use crate::state::*;
@@ -15,6 +15,9 @@ use crate::state::*;
 pub fn draw_editor(ctx: &mut Context, state: &mut State) {
     if !matches!(state.wants_search.kind, StateSearchKind::Hidden | StateSearchKind::Disabled) {
         draw_search(ctx, state);
+    } else if let Some(doc) = state.documents.active() {
+        // Remove the highlights of a closed search.
+        doc.buffer.borrow_mut().set_search_highlight("", Default::default());
     }
 
     let size = ctx.size();
@@ -57,6 +60,11 @@ fn draw_search(ctx: &mut Context, state: &mut State) {
 
     let mut action = SearchAction::None;
     let mut focus = StateSearchKind::Hidden;
+    let matches = {
+        let mut tb = doc.buffer.borrow_mut();
+        tb.set_search_highlight(&state.search_needle, state.search_options);
+        tb.search_matches()
+    };
 
     if state.wants_search.focus {
         state.wants_search.focus = false;
@@ -145,6 +153,14 @@ fn draw_search(ctx: &mut Context, state: &mut State) {
                 loc(LocId::SearchUseRegex),
                 &mut state.search_options.use_regex,
             );
+            if let Some(m) = matches {
+                let more = if m.complete { "" } else { "…" };
+                let text = match m.current {
+                    Some(current) => arena_format!(ctx.arena(), "{}/{}{}", current, m.total, more),
+                    None => arena_format!(ctx.arena(), "{}{}", m.total, more),
+                };
+                ctx.label("matches", &text);
+            }
             if state.wants_search.kind == StateSearchKind::Replace
                 && ctx.button("replace-all", loc(LocId::SearchReplaceAll), ButtonStyle::default())
             {
@@ -203,12 +219,29 @@ pub fn draw_handle_save(ctx: &mut Context, state: &mut State) {
     state.wants_save = false;
 }
 
+/// Completes the saves that finished in the background and reports their errors.
+pub fn draw_handle_background_saves(ctx: &mut Context, state: &mut State) {
+    while let Some(result) = state.documents.poll_saves() {
+        if let Err(err) = result {
+            error_log_add(ctx, state, err);
+        }
+        // The document is no longer dirty.
+        ctx.needs_rerender();
+    }
+}
+
 pub fn draw_handle_wants_close(ctx: &mut Context, state: &mut State) {
     let Some(doc) = state.documents.active() else {
         state.wants_close = false;
         return;
     };
 
+    if doc.is_saving() {
+        // Once the save is complete, the document is either clean and can be closed,
+        // or the save failed and we ask below what to do.
+        return;
+    }
+
     if !doc.buffer.borrow().is_dirty() {
         state.documents.remove_active();
         state.wants_close = false;
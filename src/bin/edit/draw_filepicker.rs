@@ -1,16 +1,16 @@
 // Copyright (c) Microsoft Corporation.
 // Licensed under the MIT License.
 
-use std::cmp::Ordering;
-use std::fs;
 use std::path::{Path, PathBuf};
 
 use edit::framebuffer::IndexedColor;
+use edit::fuzzy::FuzzyFilter;
 use edit::helpers::*;
 use edit::input::vk;
+use edit::path;
 use edit::tui::*;
-use edit::{icu, path};
 
+use crate::dir_listing::DirListing;
 use crate::localization::*;
 use crate::state::*;
 
@@ -41,6 +41,7 @@ pub fn draw_file_picker(ctx: &mut Context, state: &mut State) {
     ctx.attr_intrinsic_size(Size { width, height });
     {
         let mut activated = false;
+        let name_changed;
 
         ctx.table_begin("path");
         ctx.table_set_columns(&[0, COORD_TYPE_SAFE_MAX]);
@@ -58,7 +59,7 @@ pub fn draw_file_picker(ctx: &mut Context, state: &mut State) {
             ctx.inherit_focus();
 
             ctx.label("name-label", loc(LocId::SaveAsDialogNameLabel));
-            ctx.editline("name", &mut state.file_picker_pending_name);
+            name_changed = ctx.editline("name", &mut state.file_picker_pending_name);
             ctx.inherit_focus();
             if ctx.is_focused() && ctx.consume_shortcut(vk::RETURN) {
                 activated = true;
@@ -70,7 +71,22 @@ pub fn draw_file_picker(ctx: &mut Context, state: &mut State) {
             draw_dialog_saveas_refresh_files(state);
         }
 
-        let files = state.file_picker_entries.as_ref().unwrap();
+        // New entries are sorted in between the existing ones. The filter should apply to them too.
+        let listing = state.file_picker_entries.as_mut().unwrap();
+        let added = listing.poll();
+        if !added.is_empty()
+            && let Some(filter) = &mut state.file_picker_filter
+        {
+            let entries = listing.entries();
+            filter.insert(added.iter().map(|&i| (i, entries[i].as_str())));
+        }
+        if name_changed {
+            draw_file_picker_update_filter(state);
+        }
+
+        let files = state.file_picker_entries.as_ref().unwrap().entries();
+        let filter = state.file_picker_filter.as_ref();
+        let count = filter.map_or(files.len(), |f| f.matches().len());
 
         ctx.scrollarea_begin(
             "directory",
@@ -87,7 +103,8 @@ pub fn draw_file_picker(ctx: &mut Context, state: &mut State) {
         {
             ctx.list_begin("files");
             ctx.inherit_focus();
-            for entry in files {
+            for i in 0..count {
+                let entry = &files[filter.map_or(i, |f| f.matches()[i])];
                 match ctx.list_item(false, entry.as_str()) {
                     ListSelection::Unchanged => {}
                     ListSelection::Selected => {
@@ -189,7 +206,7 @@ pub fn draw_file_picker(ctx: &mut Context, state: &mut State) {
     if done {
         state.wants_file_picker = StateFilePicker::None;
         state.file_picker_pending_name = Default::default();
-        state.file_picker_entries = Default::default();
+        draw_file_picker_discard_entries(state);
         state.file_picker_overwrite_warning = Default::default();
     }
 }
@@ -221,63 +238,36 @@ fn draw_file_picker_update_path(state: &mut State) -> Option<PathBuf> {
     };
     if dir != state.file_picker_pending_dir.as_path() {
         state.file_picker_pending_dir = DisplayablePathBuf::from_path(dir.to_path_buf());
-        state.file_picker_entries = None;
+        draw_file_picker_discard_entries(state);
     }
 
     state.file_picker_pending_name = name;
     if state.file_picker_pending_name.as_os_str().is_empty() { None } else { Some(path) }
 }
 
-fn draw_dialog_saveas_refresh_files(state: &mut State) {
-    let dir = state.file_picker_pending_dir.as_path();
-    let mut files = Vec::new();
-    let mut off = 0;
-
-    #[cfg(windows)]
-    if dir.as_os_str().is_empty() {
-        // If the path is empty, we are at the drive picker.
-        // Add all drives as entries.
-        for drive in edit::sys::drives() {
-            files.push(DisplayablePathBuf::from_string(format!("{drive}:\\")));
-        }
-
-        state.file_picker_entries = Some(files);
+// Narrows down the entries to the ones that fuzzy-match the name typed so far.
+// The filter is only created once the user starts typing, so that
+// the pre-filled name in the save dialog doesn't hide anything.
+fn draw_file_picker_update_filter(state: &mut State) {
+    let Some(listing) = &state.file_picker_entries else {
         return;
-    }
+    };
+    let filter = state.file_picker_filter.get_or_insert_with(|| {
+        FuzzyFilter::new(listing.entries().iter().map(|f| f.as_str()), true)
+    });
+    filter.set_query(&state.file_picker_pending_name.to_string_lossy());
+}
 
-    if cfg!(windows) || dir.parent().is_some() {
-        files.push(DisplayablePathBuf::from(".."));
-        off = 1;
-    }
+fn draw_dialog_saveas_refresh_files(state: &mut State) {
+    let dir = state.file_picker_pending_dir.as_path();
+    state.file_picker_entries = Some(DirListing::new(dir, &mut state.file_picker_listing_cache));
+    state.file_picker_filter = None;
+}
 
-    if let Ok(iter) = fs::read_dir(dir) {
-        for entry in iter.flatten() {
-            if let Ok(metadata) = entry.metadata() {
-                let mut name = entry.file_name();
-                if metadata.is_dir()
-                    || (metadata.is_symlink()
-                        && fs::metadata(entry.path()).is_ok_and(|m| m.is_dir()))
-                {
-                    name.push("/");
-                }
-                files.push(DisplayablePathBuf::from(name));
-            }
-        }
+// Keeps the listing around in case the user comes back to the same directory.
+fn draw_file_picker_discard_entries(state: &mut State) {
+    if let Some(listing) = state.file_picker_entries.take() {
+        state.file_picker_listing_cache.insert(listing);
     }
-
-    // Sort directories first, then by name, case-insensitive.
-    files[off..].sort_by(|a, b| {
-        let a = a.as_bytes();
-        let b = b.as_bytes();
-
-        let a_is_dir = a.last() == Some(&b'/');
-        let b_is_dir = b.last() == Some(&b'/');
-
-        match b_is_dir.cmp(&a_is_dir) {
-            Ordering::Equal => icu::compare_strings(a, b),
-            other => other,
-        }
-    });
-
-    state.file_picker_entries = Some(files);
+    state.file_picker_filter = None;
 }
@@ -1,11 +1,13 @@
 // Copyright (c) Microsoft Corporation.
 // Licensed under the MIT License.
 
+use std::time::Duration;
+
 use edit::framebuffer::{Attributes, IndexedColor};
 use edit::helpers::*;
 use edit::input::vk;
 use edit::tui::*;
-use edit::{arena_format, icu};
+use edit::{arena, arena_format, icu, trace};
 
 use crate::localization::*;
 use crate::state::*;
@@ -155,12 +157,43 @@ pub fn draw_statusbar(ctx: &mut Context, state: &mut State) {
             ),
         );
 
+        if tb.is_counting_lines() {
+            ctx.label(
+                "line-count",
+                &arena_format!(
+                    ctx.arena(),
+                    "{} {}…",
+                    loc(LocId::StatusLineCount),
+                    tb.logical_line_count()
+                ),
+            );
+        }
+
         #[cfg(any(feature = "debug-layout", feature = "debug-latency"))]
         ctx.label(
             "stats",
             &arena_format!(ctx.arena(), "{}/{}", tb.logical_line_count(), tb.visual_line_count(),),
         );
 
+        if trace::is_enabled() {
+            let ms = |d: Duration| d.as_secs_f64() * 1000.0;
+            ctx.label(
+                "trace",
+                &arena_format!(
+                    ctx.arena(),
+                    "layout {:.2} tb {:.2} fb {:.2} write {:.2}ms  p50 {:.1} p99 {:.1}ms  {} {}",
+                    ms(trace::frame_time("layout")),
+                    ms(trace::frame_time("TextBuffer::render")),
+                    ms(trace::frame_time("Framebuffer::render")),
+                    ms(trace::frame_time("write")),
+                    ms(trace::latency_percentile(50)),
+                    ms(trace::latency_percentile(99)),
+                    MetricFormatter(trace::frame_bytes()),
+                    MetricFormatter(arena::scratch_committed()),
+                ),
+            );
+        }
+
         if tb.is_overtype() && ctx.button("overtype", "OVR", ButtonStyle::default()) {
             tb.set_overtype(false);
             ctx.needs_rerender();
@@ -85,6 +85,8 @@ pub enum LocId {
     IndentationTabs,
     IndentationSpaces,
 
+    StatusLineCount,
+
     SaveAsDialogPathLabel,
     SaveAsDialogNameLabel,
 
@@ -902,6 +904,21 @@ const S_LANG_LUT: [[&str; LangId::Count as usize]; LocId::Count as usize] = [
         /* zh_hant */ "空格",
     ],
 
+    // StatusLineCount
+    [
+        /* en      */ "Lines:",
+        /* de      */ "Zeilen:",
+        /* es      */ "Líneas:",
+        /* fr      */ "Lignes :",
+        /* it      */ "Righe:",
+        /* ja      */ "行数:",
+        /* ko      */ "줄 수:",
+        /* pt_br   */ "Linhas:",
+        /* ru      */ "Строк:",
+        /* zh_hans */ "行数:",
+        /* zh_hant */ "行數:",
+    ],
+
     // SaveAsDialogPathLabel
     [
         /* en      */ "Folder:",
@@ -9,33 +9,40 @@
     string_from_utf8_lossy_owned
 )]
 
+mod dir_listing;
 mod documents;
 mod draw_editor;
 mod draw_filepicker;
 mod draw_menubar;
 mod draw_statusbar;
 mod localization;
+mod pacing;
 mod state;
 
 use std::borrow::Cow;
 #[cfg(feature = "debug-latency")]
 use std::fmt::Write;
+use std::fs::File;
 use std::path::{Path, PathBuf};
-use std::{env, process};
+use std::{env, process, time};
 
 use draw_editor::*;
 use draw_filepicker::*;
 use draw_menubar::*;
 use draw_statusbar::*;
 use edit::arena::{self, Arena, ArenaString, scratch_arena};
+use edit::buffer::StorageKind;
 use edit::framebuffer::{self, IndexedColor};
 use edit::helpers::{KIBI, MEBI, MetricFormatter, Rect, Size};
 use edit::input::{self, kbmod, vk};
 use edit::oklab::oklab_blend;
 use edit::tui::*;
 use edit::vt::{self, Token};
-use edit::{apperr, arena_format, base64, path, sys};
+use edit::{apperr, arena_format, base64, path, sys, trace};
 use localization::*;
+use pacing::FramePacer;
+#[cfg(feature = "debug-latency")]
+use pacing::FrameTimings;
 use state::*;
 
 #[cfg(target_pointer_width = "32")]
@@ -53,7 +60,15 @@ fn main() -> process::ExitCode {
         }));
     }
 
-    match run() {
+    let res = run();
+
+    // Now that the terminal is restored, report where the arenas grew.
+    #[cfg(feature = "debug-arena")]
+    {
+        _ = arena::write_growth_report(&mut std::io::stderr());
+    }
+
+    match res {
         Ok(()) => process::ExitCode::SUCCESS,
         Err(err) => {
             sys::write_stdout(&format!("{}\r\n", FormatApperr::from(err)));
@@ -107,53 +122,80 @@ fn run() -> apperr::Result<()> {
     tui.set_modal_default_bg(floater_bg);
     tui.set_modal_default_fg(floater_fg);
 
-    sys::inject_window_size_into_stdin();
+    sys::inject_window_size();
+
+    let mut pacer = FramePacer::new();
 
     #[cfg(feature = "debug-latency")]
     let mut last_latency_width = 0;
+    #[cfg(feature = "debug-latency")]
+    let mut last_write = time::Duration::ZERO;
 
-    loop {
+    'main: loop {
         #[cfg(feature = "debug-latency")]
-        let time_beg;
+        let mut timings = FrameTimings::default();
         #[cfg(feature = "debug-latency")]
-        let mut passes;
+        let mut passes = 0usize;
+        // When the first input of this frame was read, for measuring the input latency.
+        let mut input_time = None;
 
         // Process a batch of input.
         {
             let scratch = scratch_arena(None);
-            let read_timeout = vt_parser.read_timeout().min(tui.read_timeout());
-            let Some(input) = sys::read_stdin(&scratch, read_timeout) else {
+            let mut read_timeout = vt_parser.read_timeout().min(tui.read_timeout());
+            // Wake up regularly to show the progress of background line counts,
+            // reflows, directory listings and saves.
+            if state.documents.poll_statistics()
+                || state.documents.is_saving()
+                || state.file_picker_entries.as_ref().is_some_and(|l| !l.is_complete())
+            {
+                read_timeout = read_timeout.min(time::Duration::from_millis(50));
+            }
+            let Some(mut input) = trace_read_stdin(&scratch, read_timeout) else {
                 break;
             };
 
-            #[cfg(feature = "debug-latency")]
-            {
-                time_beg = std::time::Instant::now();
-                passes = 0usize;
+            pacer.begin_frame();
+            if !input.text.is_empty() || input.resize.is_some() {
+                input_time = Some(time::Instant::now());
             }
 
-            let vt_iter = vt_parser.parse(&input);
-            let mut input_iter = input_parser.parse(vt_iter);
-
-            while {
-                let input = input_iter.next();
-                let more = input.is_some();
-                let mut ctx = tui.create_context(input);
+            loop {
+                #[cfg(feature = "debug-latency")]
+                let time_beg = time::Instant::now();
 
-                draw(&mut ctx, &mut state);
+                let _passes =
+                    process_input(&mut tui, &mut state, &mut vt_parser, &mut input_parser, &input);
 
                 #[cfg(feature = "debug-latency")]
                 {
-                    passes += 1;
+                    timings.layout += time_beg.elapsed();
+                    passes += _passes;
                 }
 
-                more
-            } {}
+                // Process any input that's already pending or arrives before the next
+                // frame is due as part of this frame, instead of rendering in between.
+                let Some(timeout) = pacer.coalesce_timeout() else {
+                    break;
+                };
+                match trace_read_stdin(&scratch, timeout) {
+                    Some(i) if !i.text.is_empty() || i.resize.is_some() => {
+                        input_time.get_or_insert_with(time::Instant::now);
+                        input = i;
+                    }
+                    Some(_) => break,
+                    None => break 'main,
+                }
+            }
         }
 
+        #[cfg(feature = "debug-latency")]
+        let time_beg = time::Instant::now();
+
         // Continue rendering until the layout has settled.
         // This can take >1 frame, if the input focus is tossed between different controls.
         while tui.needs_settling() {
+            let _span = trace::span("layout");
             let mut ctx = tui.create_context(None);
 
             draw(&mut ctx, &mut state);
@@ -176,6 +218,13 @@ fn run() -> apperr::Result<()> {
 
         // Render the UI and write it to the terminal.
         {
+            #[cfg(feature = "debug-latency")]
+            let time_beg = {
+                let now = time::Instant::now();
+                timings.layout += now - time_beg;
+                now
+            };
+
             let scratch = scratch_arena(None);
             let mut output = tui.render(&scratch);
 
@@ -193,17 +242,23 @@ fn run() -> apperr::Result<()> {
 
             #[cfg(feature = "debug-latency")]
             {
-                // Print the number of passes and latency in the top right corner.
-                let time_end = std::time::Instant::now();
-                let status = time_end - time_beg;
+                timings.render = time_beg.elapsed();
+                timings.write = last_write;
 
+                // Print the number of passes, the output size and the latency in the top right
+                // corner, followed by the time spent in layout, rendering and (for the previous
+                // frame, since this one hasn't been written yet) writing, in that order.
+                let us = |d: time::Duration| d.as_nanos() as f64 / 1000.0;
                 let scratch_alt = scratch_arena(Some(&scratch));
                 let status = arena_format!(
                     &scratch_alt,
-                    "{}P {}B {:.3}μs",
+                    "{}P {}B {:.3}μs ({:.0}/{:.0}/{:.0})",
                     passes,
                     output.len(),
-                    status.as_nanos() as f64 / 1000.0
+                    us(timings.layout + timings.render),
+                    us(timings.layout),
+                    us(timings.render),
+                    us(timings.write),
                 );
 
                 // "μs" is 3 bytes and 2 columns.
@@ -230,13 +285,75 @@ fn run() -> apperr::Result<()> {
                 last_latency_width = cols;
             }
 
-            sys::write_stdout(&output);
+            #[cfg(feature = "debug-latency")]
+            let time_beg = time::Instant::now();
+
+            {
+                let _span = trace::span("write");
+                sys::write_stdout(&output);
+            }
+
+            #[cfg(feature = "debug-latency")]
+            {
+                last_write = time_beg.elapsed();
+            }
+
+            pacer.end_frame();
+            trace::frame_end(output.len(), input_time.map(|t| t.elapsed()));
         }
+
+        arena::scratch_trim();
+    }
+
+    if let Some(path) = &state.trace_path {
+        let mut file = File::create(path)?;
+        trace::write_chrome_trace(&mut file)?;
     }
 
     Ok(())
 }
 
+fn trace_read_stdin(arena: &Arena, timeout: time::Duration) -> Option<sys::StdinInput<'_>> {
+    let _span = trace::span("read");
+    sys::read_stdin(arena, timeout)
+}
+
+/// Parses `input` and runs a layout pass for each of the resulting events,
+/// plus a final one without input. Returns the number of passes.
+fn process_input(
+    tui: &mut Tui,
+    state: &mut State,
+    vt_parser: &mut vt::Parser,
+    input_parser: &mut input::Parser,
+    input: &sys::StdinInput,
+) -> usize {
+    let _span = trace::span("layout");
+    let mut passes = 0;
+
+    // The resize comes first, so that on startup the TUI system gets initialized with a size.
+    if let Some(size) = input.resize {
+        let mut ctx = tui.create_context(Some(input::Input::Resize(size)));
+        draw(&mut ctx, state);
+        passes += 1;
+    }
+
+    let vt_iter = vt_parser.parse(&input.text);
+    let mut input_iter = input_parser.parse(vt_iter);
+
+    while {
+        let input = input_iter.next();
+        let more = input.is_some();
+        let mut ctx = tui.create_context(input);
+
+        draw(&mut ctx, state);
+        passes += 1;
+
+        more
+    } {}
+
+    passes
+}
+
 // Returns true if the application should exit early.
 fn handle_args(state: &mut State) -> apperr::Result<bool> {
     let scratch = scratch_arena(None);
@@ -251,6 +368,16 @@ fn handle_args(state: &mut State) -> apperr::Result<bool> {
         } else if arg == "-v" || arg == "--version" {
             print_version();
             return Ok(true);
+        } else if arg == "--mmap" {
+            state.documents.set_map_large_files(true);
+            continue;
+        } else if arg == "--rope" {
+            state.documents.set_storage_kind(StorageKind::Rope);
+            continue;
+        } else if let Some(p) = arg.to_str().and_then(|a| a.strip_prefix("--trace=")) {
+            state.trace_path = Some(cwd.join(p));
+            trace::set_enabled(true);
+            continue;
         } else if arg == "-" {
             paths.clear();
             break;
@@ -290,6 +417,10 @@ fn print_help() {
         "Options:\r\n",
         "    -h, --help       Print this help message\r\n",
         "    -v, --version    Print the version number\r\n",
+        "    --mmap           Map large files into memory instead of reading them\r\n",
+        "    --rope           Store files in a rope, even if they're small\r\n",
+        "    --trace=FILE     Record timings and write them to FILE as a Chrome trace on exit\r\n",
+        "                     (press F12 to toggle recording and the timings overlay)\r\n",
         "\r\n",
         "Arguments:\r\n",
         "    FILE[:LINE[:COLUMN]]    The file to open, optionally with line and column (e.g., foo.txt:123:45)\r\n",
@@ -301,6 +432,7 @@ fn print_version() {
 }
 
 fn draw(ctx: &mut Context, state: &mut State) {
+    draw_handle_background_saves(ctx, state);
     draw_menubar(ctx, state);
     draw_editor(ctx, state);
     draw_statusbar(ctx, state);
@@ -363,6 +495,8 @@ fn draw(ctx: &mut Context, state: &mut State) {
         {
             state.wants_search.kind = StateSearchKind::Replace;
             state.wants_search.focus = true;
+        } else if key == vk::F12 {
+            trace::set_enabled(!trace::is_enabled());
         } else {
             return;
         }
@@ -547,7 +681,7 @@ fn setup_terminal(tui: &mut Tui, vt_parser: &mut vt::Parser) -> RestoreModes {
             break;
         };
 
-        let mut vt_stream = vt_parser.parse(&input);
+        let mut vt_stream = vt_parser.parse(&input.text);
         while let Some(token) = vt_stream.next() {
             match token {
                 Token::Csi(state) if state.final_byte == 'c' => done = true,
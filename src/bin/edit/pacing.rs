@@ -0,0 +1,71 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+//! Decides how long the main loop may keep reading input before it renders.
+//!
+//! Every batch of input read from stdin goes through at least one layout pass.
+//! If each also resulted in a frame, fast typing, key repeat or a stream of
+//! mouse events would render many frames that the terminal never gets to show,
+//! while the next input is already waiting. Instead, input that's pending or
+//! that arrives shortly after the first input of a frame gets processed as
+//! part of the same frame, and frames are spaced out to the refresh rate of
+//! typical terminals. Input after a period of idleness still renders right away.
+
+use std::time::{Duration, Instant};
+
+/// Input that arrives within this time after the first input
+/// of a frame is processed as part of the same frame.
+const INPUT_COALESCE_BUDGET: Duration = Duration::from_millis(8);
+
+/// The minimum time between two frames. Most terminals don't refresh
+/// faster than 60 Hz, so anything beyond that would just be dropped.
+const MIN_FRAME_INTERVAL: Duration = Duration::from_micros(16_667);
+
+pub struct FramePacer {
+    /// When the first input of the current frame was read.
+    frame_beg: Instant,
+    /// When the last frame was written to the terminal.
+    last_frame: Instant,
+}
+
+impl FramePacer {
+    pub fn new() -> Self {
+        let now = Instant::now();
+        Self { frame_beg: now, last_frame: now - MIN_FRAME_INTERVAL }
+    }
+
+    /// Call this after the first input of a frame was read.
+    pub fn begin_frame(&mut self) {
+        self.frame_beg = Instant::now();
+    }
+
+    /// Call this after the frame was written to the terminal.
+    pub fn end_frame(&mut self) {
+        self.last_frame = Instant::now();
+    }
+
+    /// Returns how long to wait for more input before rendering the current frame.
+    /// [`Duration::ZERO`] means that only already pending input should be read.
+    /// Returns `None` once the budget for the current frame is exhausted.
+    pub fn coalesce_timeout(&self) -> Option<Duration> {
+        let now = Instant::now();
+        let budget_end = self.frame_beg + INPUT_COALESCE_BUDGET;
+        if now >= budget_end {
+            return None;
+        }
+        let frame_due = self.last_frame + MIN_FRAME_INTERVAL;
+        Some(frame_due.min(budget_end).saturating_duration_since(now))
+    }
+}
+
+/// Where the time of a frame went. Time spent waiting for input is not included.
+#[cfg(feature = "debug-latency")]
+#[derive(Default, Clone, Copy)]
+pub struct FrameTimings {
+    /// Processing input and laying out the UI, until it settled.
+    pub layout: Duration,
+    /// Turning the UI into VT output.
+    pub render: Duration,
+    /// Writing the output to the terminal.
+    pub write: Duration,
+}
@@ -7,10 +7,12 @@ use std::mem;
 use std::path::{Path, PathBuf};
 
 use edit::framebuffer::IndexedColor;
+use edit::fuzzy::FuzzyFilter;
 use edit::helpers::*;
 use edit::tui::*;
 use edit::{apperr, buffer, icu, sys};
 
+use crate::dir_listing::{DirListing, DirListingCache};
 use crate::documents::DocumentManager;
 use crate::localization::*;
 
@@ -133,7 +135,9 @@ pub struct State {
     pub file_picker_pending_dir: DisplayablePathBuf,
     pub file_picker_pending_dir_revision: u64, // Bumped every time `file_picker_pending_dir` changes.
     pub file_picker_pending_name: PathBuf,
-    pub file_picker_entries: Option<Vec<DisplayablePathBuf>>,
+    pub file_picker_entries: Option<DirListing>,
+    pub file_picker_listing_cache: DirListingCache,
+    pub file_picker_filter: Option<FuzzyFilter>, // Filters the entries by the name typed so far.
     pub file_picker_overwrite_warning: Option<PathBuf>, // The path the warning is about.
 
     pub wants_search: StateSearch,
@@ -159,6 +163,7 @@ pub struct State {
     pub osc_clipboard_seen_generation: u32,
     pub osc_clipboard_send_generation: u32,
     pub osc_clipboard_always_send: bool,
+    pub trace_path: Option<PathBuf>,
     pub exit: bool,
 }
 
@@ -179,6 +184,8 @@ impl State {
             file_picker_pending_dir_revision: 0,
             file_picker_pending_name: Default::default(),
             file_picker_entries: None,
+            file_picker_listing_cache: Default::default(),
+            file_picker_filter: None,
             file_picker_overwrite_warning: None,
 
             wants_search: StateSearch { kind: StateSearchKind::Hidden, focus: false },
@@ -204,6 +211,7 @@ impl State {
             osc_clipboard_seen_generation: 0,
             osc_clipboard_send_generation: 0,
             osc_clipboard_always_send: false,
+            trace_path: None,
             exit: false,
         })
     }
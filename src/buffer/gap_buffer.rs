@@ -1,11 +1,14 @@
 // Copyright (c) Microsoft Corporation.
 // Licensed under the MIT License.
 
+use std::fs::File;
 use std::ops::Range;
 use std::ptr::{self, NonNull};
-use std::slice;
+use std::{mem, slice};
 
-use crate::document::{ReadableDocument, WriteableDocument};
+use super::pool;
+use crate::arena::scratch_arena;
+use crate::document::ReadableDocument;
 use crate::helpers::*;
 use crate::{apperr, sys};
 
@@ -15,28 +18,22 @@ const LARGE_CAPACITY: usize = 128 * MEBI;
 const LARGE_CAPACITY: usize = 4 * GIBI;
 const LARGE_ALLOC_CHUNK: usize = 64 * KIBI;
 const LARGE_GAP_CHUNK: usize = 4 * KIBI;
+/// The gap never grows by more than this much beyond what was asked for. See `enlarge_gap`.
+const LARGE_GAP_MAX: usize = 16 * MEBI;
+/// A gap larger than this (e.g. after deleting lots of text) is shrunk and its memory decommitted.
+const LARGE_SHRINK_THRESHOLD: usize = 2 * LARGE_GAP_MAX;
 
 const SMALL_CAPACITY: usize = 128 * KIBI;
 const SMALL_ALLOC_CHUNK: usize = 256;
 const SMALL_GAP_CHUNK: usize = 16;
+const SMALL_GAP_MAX: usize = 4 * KIBI;
 
-// TODO: Instead of having a specialization for small buffers here,
-// tui.rs could also just keep a MRU set of large buffers around.
+/// The memory is released by [`GapBuffer`]'s `Drop` impl, which returns it to the [`pool`].
 enum BackingBuffer {
     VirtualMemory(NonNull<u8>, usize),
     Vec(Vec<u8>),
 }
 
-impl Drop for BackingBuffer {
-    fn drop(&mut self) {
-        unsafe {
-            if let Self::VirtualMemory(ptr, reserve) = *self {
-                sys::virtual_release(ptr, reserve);
-            }
-        }
-    }
-}
-
 /// Most people know how Vec<T> works: It has some spare capacity at the end,
 /// so that pushing into it doesn't reallocate every single time. A gap buffer
 /// is the same thing, but the spare capacity can be anywhere in the buffer.
@@ -54,37 +51,55 @@ pub struct GapBuffer {
     gap_off: usize,
     /// Gap length.
     gap_len: usize,
+    /// The spare room to add the next time the gap is enlarged. Doubles every time.
+    gap_grow: usize,
     /// Increments every time the buffer is modified.
     generation: u32,
+    /// Like `generation`, but it's never rolled back by `set_generation`.
+    revision: u64,
+    /// Length of the leading part of the buffer that is mapped copy-on-write from a file.
+    /// Those pages have to be copied into memory before the file can be overwritten.
+    mapped_len: usize,
     /// If `Vec(..)`, the buffer is optimized for small amounts of text
     /// and uses the standard heap. Otherwise, it uses virtual memory.
     buffer: BackingBuffer,
 }
 
 impl GapBuffer {
+    /// Reuses the memory of a previously dropped buffer, if possible. See the `pool` module.
     pub fn new(small: bool) -> apperr::Result<Self> {
         let reserve;
         let buffer;
         let text;
+        let commit;
 
         if small {
             reserve = SMALL_CAPACITY;
-            text = NonNull::dangling();
-            buffer = BackingBuffer::Vec(Vec::new());
+            let mut v = pool::take_vec().unwrap_or_default();
+            text = unsafe { NonNull::new_unchecked(v.as_mut_ptr()) };
+            commit = v.len();
+            buffer = BackingBuffer::Vec(v);
         } else {
             reserve = LARGE_CAPACITY;
-            text = unsafe { sys::virtual_reserve(reserve)? };
+            (text, commit) = match pool::take_region(reserve) {
+                Some(region) => region,
+                None => (unsafe { sys::virtual_reserve(reserve)? }, 0),
+            };
             buffer = BackingBuffer::VirtualMemory(text, reserve);
         }
 
         Ok(Self {
             text,
             reserve,
-            commit: 0,
+            commit,
             text_length: 0,
             gap_off: 0,
-            gap_len: 0,
+            // Any memory that's already committed is up for grabs.
+            gap_len: commit,
+            gap_grow: 0,
             generation: 0,
+            revision: 0,
+            mapped_len: 0,
             buffer,
         })
     }
@@ -102,20 +117,31 @@ impl GapBuffer {
         self.generation = generation;
     }
 
+    /// Unlike [`GapBuffer::generation`], which undo restores to its earlier value,
+    /// this changes on every modification and never repeats a previous value.
+    pub fn revision(&self) -> u64 {
+        self.revision
+    }
+
+    pub(super) fn set_revision(&mut self, revision: u64) {
+        self.revision = revision;
+    }
+
     /// WARNING: The returned slice must not necessarily be the same length as `len` (due to OOM).
     pub fn allocate_gap(&mut self, off: usize, len: usize, delete: usize) -> &mut [u8] {
         // Sanitize parameters
         let off = off.min(self.text_length);
         let delete = delete.min(self.text_length - off);
 
-        // Move the existing gap if it exists
-        if off != self.gap_off {
+        if delete > 0 {
+            // Also moves the gap to `off`.
+            self.delete_text(off, delete);
+        } else if off != self.gap_off {
             self.move_gap(off);
         }
 
-        // Delete the text
-        if delete > 0 {
-            self.delete_text(delete);
+        if self.gap_len > len + LARGE_SHRINK_THRESHOLD {
+            self.shrink_gap(len);
         }
 
         // Enlarge the gap if needed
@@ -124,6 +150,7 @@ impl GapBuffer {
         }
 
         self.generation = self.generation.wrapping_add(1);
+        self.revision += 1;
         unsafe { slice::from_raw_parts_mut(self.text.add(self.gap_off).as_ptr(), self.gap_len) }
     }
 
@@ -158,12 +185,31 @@ impl GapBuffer {
         self.gap_off = off;
     }
 
-    fn delete_text(&mut self, delete: usize) {
+    /// Deletes the `delete` bytes at `off` and leaves the gap in their place.
+    fn delete_text(&mut self, off: usize, delete: usize) {
+        // Only move the gap up to the nearest end of the deleted range. Then the gap can swallow
+        // the range from there. That way, the text that's about to be deleted isn't moved first.
+        //
+        //              v gap_off
+        // |ABCDEFGHIJ   KLMNOPQRSTUVWXYZ|
+        //     ^^^^^^^^^^^^^^ delete
+        // |ABC                 RSTUVWXYZ|
+        //
+        let end = off + delete;
+        if self.gap_off < off {
+            self.move_gap(off);
+        } else if self.gap_off > end {
+            self.move_gap(end);
+        }
+
         if cfg!(debug_assertions) {
             // Fill the deleted bytes with 0xCD to make debugging easier.
-            unsafe { self.text.add(self.gap_off + self.gap_len).write_bytes(0xCD, delete) };
+            unsafe { self.text.add(off).write_bytes(0xCD, self.gap_off - off) };
+            let after = self.gap_off + self.gap_len;
+            unsafe { self.text.add(after).write_bytes(0xCD, end - self.gap_off) };
         }
 
+        self.gap_off = off;
         self.gap_len += delete;
         self.text_length -= delete;
     }
@@ -171,26 +217,39 @@ impl GapBuffer {
     fn enlarge_gap(&mut self, len: usize) {
         let gap_chunk;
         let alloc_chunk;
+        let gap_max;
 
         if matches!(self.buffer, BackingBuffer::VirtualMemory(..)) {
             gap_chunk = LARGE_GAP_CHUNK;
             alloc_chunk = LARGE_ALLOC_CHUNK;
+            gap_max = LARGE_GAP_MAX;
         } else {
             gap_chunk = SMALL_GAP_CHUNK;
             alloc_chunk = SMALL_ALLOC_CHUNK;
+            gap_max = SMALL_GAP_MAX;
         }
 
+        // Every time the gap fills up, the text after it has to be moved. To do that only
+        // O(log n) times while text keeps getting inserted (e.g. pasting, which writes line by line),
+        // the spare room grows geometrically, up to a limit and relative to the text length.
+        let spare = self.gap_grow.min(gap_max).min(self.text_length / 2).max(gap_chunk);
+        self.gap_grow = spare * 2;
+
         let gap_len_old = self.gap_len;
-        let gap_len_new = (len + gap_chunk + gap_chunk - 1) & !(gap_chunk - 1);
+        let mut gap_len_new = (len + spare + gap_chunk - 1) & !(gap_chunk - 1);
 
         let bytes_old = self.commit;
         let bytes_new = self.text_length + gap_len_new;
 
         if bytes_new > bytes_old {
-            let bytes_new = (bytes_new + alloc_chunk - 1) & !(alloc_chunk - 1);
+            let mut bytes_new = (bytes_new + alloc_chunk - 1) & !(alloc_chunk - 1);
 
             if bytes_new > self.reserve {
-                return;
+                // Without the spare room it may still fit.
+                bytes_new = self.reserve;
+                if bytes_new - self.text_length < len {
+                    return;
+                }
             }
 
             match &mut self.buffer {
@@ -208,6 +267,9 @@ impl GapBuffer {
             self.commit = bytes_new;
         }
 
+        // Put all of the committed memory to use. It costs nothing extra now, but saves a move later.
+        gap_len_new = self.commit - self.text_length;
+
         let gap_beg = unsafe { self.text.add(self.gap_off) };
         unsafe {
             ptr::copy(
@@ -225,6 +287,41 @@ impl GapBuffer {
         self.gap_len = gap_len_new;
     }
 
+    /// Shrinks the gap down to `len` bytes plus some spare room, and returns the
+    /// memory after the text to the OS. Called after large deletions.
+    fn shrink_gap(&mut self, len: usize) {
+        let BackingBuffer::VirtualMemory(ptr, _) = self.buffer else {
+            return;
+        };
+
+        let gap_len_new = (len + LARGE_GAP_CHUNK + LARGE_GAP_CHUNK - 1) & !(LARGE_GAP_CHUNK - 1);
+        let bytes_new = self.text_length + gap_len_new;
+        let bytes_new = (bytes_new + LARGE_ALLOC_CHUNK - 1) & !(LARGE_ALLOC_CHUNK - 1);
+        if bytes_new >= self.commit {
+            return;
+        }
+        let gap_len_new = bytes_new - self.text_length;
+
+        let gap_beg = unsafe { self.text.add(self.gap_off) };
+        unsafe {
+            ptr::copy(
+                gap_beg.add(self.gap_len).as_ptr(),
+                gap_beg.add(gap_len_new).as_ptr(),
+                self.text_length - self.gap_off,
+            )
+        };
+
+        // If this fails, the memory simply stays committed.
+        if unsafe { sys::virtual_decommit(ptr.add(bytes_new), self.commit - bytes_new) }.is_ok() {
+            self.commit = bytes_new;
+            // The decommitted pages aren't mapped from the file anymore either.
+            self.mapped_len = self.mapped_len.min(bytes_new);
+        }
+
+        self.gap_len = gap_len_new;
+        self.gap_grow = 0;
+    }
+
     pub fn commit_gap(&mut self, len: usize) {
         assert!(len <= self.gap_len);
         self.text_length += len;
@@ -242,97 +339,93 @@ impl GapBuffer {
         self.gap_off = 0;
         self.gap_len += self.text_length;
         self.generation = self.generation.wrapping_add(1);
+        self.revision += 1;
         self.text_length = 0;
-    }
-
-    pub fn extract_raw(
-        &self,
-        mut beg: usize,
-        mut end: usize,
-        out: &mut Vec<u8>,
-        mut out_off: usize,
-    ) {
-        debug_assert!(beg <= end && end <= self.text_length);
-
-        end = end.min(self.text_length);
-        beg = beg.min(end);
-        out_off = out_off.min(out.len());
 
-        if beg >= end {
-            return;
-        }
-
-        out.reserve(end - beg);
-
-        while beg < end {
-            let chunk = self.read_forward(beg);
-            let chunk = &chunk[..chunk.len().min(end - beg)];
-            out.replace_range(out_off..out_off, chunk);
-            beg += chunk.len();
-            out_off += chunk.len();
+        if self.gap_len > LARGE_SHRINK_THRESHOLD {
+            self.shrink_gap(0);
         }
     }
 
-    /// Replaces the entire buffer contents with the given `text`.
-    /// The method is optimized for the case where the given `text` already matches
-    /// the existing contents. Returns `true` if the buffer contents were changed.
-    pub fn copy_from(&mut self, src: &dyn ReadableDocument) -> bool {
-        let mut off = 0;
-
-        // Find the position at which the contents change.
-        loop {
-            let dst_chunk = self.read_forward(off);
-            let src_chunk = src.read_forward(off);
+    /// Replaces the contents with the first `len` bytes of `file`, mapped copy-on-write.
+    /// The contents are paged in lazily as they're accessed and changes remain private.
+    ///
+    /// Returns `false` and leaves the contents unchanged if the buffer isn't backed
+    /// by virtual memory, the file is too large, or the platform doesn't support it.
+    pub fn map_file(&mut self, file: &File, len: usize) -> bool {
+        let BackingBuffer::VirtualMemory(ptr, _) = self.buffer else {
+            return false;
+        };
 
-            let dst_len = dst_chunk.len();
-            let src_len = src_chunk.len();
-            let len = dst_len.min(src_len);
-            let mismatch = dst_chunk[..len] != src_chunk[..len];
+        let commit = (len + LARGE_ALLOC_CHUNK - 1) & !(LARGE_ALLOC_CHUNK - 1);
+        if commit > self.reserve {
+            return false;
+        }
 
-            if mismatch {
-                break; // The contents differ.
-            }
-            if len == 0 {
-                if dst_len == src_len {
-                    return false; // Both done simultaneously. -> Done.
+        // The file only covers the whole pages up to `len`. The remainder
+        // of the last chunk must be committed for the gap to grow into it.
+        unsafe {
+            if commit > self.commit {
+                if sys::virtual_commit(ptr.add(self.commit), commit - self.commit).is_err() {
+                    return false;
                 }
-                break; // One of the two is shorter.
+                self.commit = commit;
+            }
+            if sys::virtual_map_file(ptr, file, len).is_err() {
+                return false;
             }
-
-            off += len;
         }
 
-        // Update the buffer starting at `off`.
-        loop {
-            let chunk = src.read_forward(off);
-            self.replace(off..usize::MAX, chunk);
-            off += chunk.len();
+        self.text_length = len;
+        self.gap_off = len;
+        self.gap_len = self.commit - len;
+        self.generation = self.generation.wrapping_add(1);
+        self.revision += 1;
+        // Pages past `len` may still be mapped from a previous call, so don't shrink this.
+        self.mapped_len = self.mapped_len.max(len);
+        true
+    }
 
-            // No more data to copy -> Done. By checking this _after_ the replace()
-            // call, we ensure that the initial `off..usize::MAX` range is deleted.
-            // This fixes going from some buffer contents to being empty.
-            if chunk.is_empty() {
-                return true;
-            }
+    /// Moves all memory that is still backed by the file passed to [`GapBuffer::map_file`]
+    /// into regular memory, so that the file can be truncated or overwritten safely.
+    ///
+    /// Touching the pages to trigger the copy-on-write isn't sufficient for this,
+    /// because truncating a file also drops the private copies of its pages.
+    pub fn detach_file(&mut self) -> apperr::Result<()> {
+        if self.mapped_len == 0 {
+            return Ok(());
         }
-    }
 
-    /// Copies the contents of the buffer into a string.
-    pub fn copy_into(&self, dst: &mut dyn WriteableDocument) {
-        let mut beg = 0;
+        // `map_file` ensured that the commit covers the mapping rounded up to whole chunks.
+        let end = (self.mapped_len + LARGE_ALLOC_CHUNK - 1) & !(LARGE_ALLOC_CHUNK - 1);
+        let scratch = scratch_arena(None);
+        let buf = scratch.alloc_uninit_slice::<u8>(MEBI);
         let mut off = 0;
 
-        while {
-            let chunk = self.read_forward(off);
+        while off < end {
+            let len = (end - off).min(buf.len());
+            unsafe {
+                let ptr = self.text.add(off);
+                ptr::copy_nonoverlapping(ptr.as_ptr(), buf.as_mut_ptr() as *mut u8, len);
+                sys::virtual_unmap_file(ptr, len)?;
+                ptr::copy_nonoverlapping(buf.as_ptr() as *const u8, ptr.as_ptr(), len);
+            }
+            off += len;
+        }
 
-            // The first write will be 0..usize::MAX and effectively clear() the destination.
-            // Every subsequent write will be usize::MAX..usize::MAX and thus effectively append().
-            dst.replace(beg..usize::MAX, chunk);
-            beg = usize::MAX;
+        self.mapped_len = 0;
+        Ok(())
+    }
+}
 
-            off += chunk.len();
-            off < self.text_length
-        } {}
+impl Drop for GapBuffer {
+    fn drop(&mut self) {
+        match &mut self.buffer {
+            BackingBuffer::VirtualMemory(ptr, reserve) => unsafe {
+                pool::recycle_region(*ptr, *reserve, self.commit, self.mapped_len)
+            },
+            BackingBuffer::Vec(v) => pool::recycle_vec(mem::take(v)),
+        }
     }
 }
 
@@ -375,3 +468,57 @@ impl ReadableDocument for GapBuffer {
         unsafe { slice::from_raw_parts(self.text.add(beg).as_ptr(), len) }
     }
 }
+
+#[cfg(test)]
+mod test {
+    use super::*;
+
+    fn contents(gb: &GapBuffer) -> Vec<u8> {
+        let mut v = Vec::new();
+        loop {
+            let chunk = gb.read_forward(v.len());
+            if chunk.is_empty() {
+                break;
+            }
+            v.extend_from_slice(chunk);
+        }
+        v
+    }
+
+    #[test]
+    fn test_random_edits() {
+        let mut gb = GapBuffer::new(false).unwrap();
+        let mut reference = Vec::new();
+        let mut rng = TestRng::default();
+        let mut next = |n: usize| rng.below(n + 1);
+
+        for i in 0..2000 {
+            let off = next(reference.len());
+            let delete = next((reference.len() - off).min(64));
+            let text = vec![b'a' + (i % 26) as u8; next(256)];
+            gb.replace(off..off + delete, &text);
+            reference.splice(off..off + delete, text);
+        }
+
+        assert_eq!(contents(&gb), reference);
+    }
+
+    #[test]
+    fn test_large_delete_decommits() {
+        let mut gb = GapBuffer::new(false).unwrap();
+        let head = vec![b'h'; 1000];
+        let tail = vec![b't'; 1000];
+        gb.replace(0..0, &head);
+        gb.replace(1000..1000, &tail);
+        // Insert a large amount of text in the middle, in pieces.
+        let piece = vec![b'x'; MEBI];
+        for i in 0..40 {
+            gb.replace(1000 + i * MEBI..1000 + i * MEBI, &piece);
+        }
+        assert!(gb.commit >= 40 * MEBI);
+
+        gb.replace(1000..1000 + 40 * MEBI, b"");
+        assert!(gb.commit < MEBI);
+        assert_eq!(contents(&gb), [head, tail].concat());
+    }
+}
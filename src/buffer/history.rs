@@ -0,0 +1,312 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+//! A compact undo/redo log.
+//!
+//! Every entry consists of a small fixed-size record and the text it deleted and
+//! added. Instead of giving each entry its own pair of heap allocations, the texts
+//! of all entries are stored back to back in a single log, in chronological order:
+//!
+//! ```text
+//! records: [ e0 ][ e1 ][ e2 ][ e3 ]
+//!                      ^ undo_len
+//! log:     [del0|add0][del1|add1][del2|add2][del3|add3]
+//! ```
+//!
+//! Records before `undo_len` can be undone, the ones after it redone (the next one
+//! to redo being right at `undo_len`). Recording a new entry drops everything that
+//! could be redone, so the entry being recorded is always last, both in the list
+//! of records and in the log, and it can grow in place.
+//!
+//! Once the log exceeds its memory limit, the oldest entries are evicted.
+//! Their text is dropped from the front of the log lazily, once it makes up
+//! the majority of it, so that evictions are amortized O(1).
+
+use std::collections::VecDeque;
+
+use super::{TextBufferSelection, TextBufferStatistics};
+use crate::helpers::*;
+
+/// The maximum number of entries, independent of their size.
+const MAX_ENTRIES: usize = 1000;
+
+/// The default limit for the total size of the recorded text.
+const DEFAULT_MEMORY_LIMIT: usize = 64 * MEBI;
+
+/// An undo/redo entry.
+#[derive(Clone, Copy)]
+pub struct HistoryEntry {
+    /// `TextBuffer::cursor` position before the change was made.
+    pub cursor_before: Point,
+    /// `TextBuffer::selection` before the change was made.
+    pub selection_before: Option<TextBufferSelection>,
+    /// `TextBuffer::stats` before the change was made.
+    pub stats_before: TextBufferStatistics,
+    /// `GapBuffer::generation` before the change was made.
+    pub generation_before: u32,
+    /// Logical cursor position where the change took place.
+    /// The position is at the start of the changed range.
+    pub cursor: Point,
+    /// Offset of the deleted text in the log. The added text immediately follows it.
+    /// This is a virtual offset, which stays valid as the front of the log gets dropped.
+    off: usize,
+    /// Length of the text that was deleted from the buffer.
+    deleted_len: usize,
+    /// Length of the text that was added to the buffer.
+    added_len: usize,
+}
+
+impl HistoryEntry {
+    pub fn new(
+        cursor_before: Point,
+        selection_before: Option<TextBufferSelection>,
+        stats_before: TextBufferStatistics,
+        generation_before: u32,
+        cursor: Point,
+    ) -> Self {
+        Self {
+            cursor_before,
+            selection_before,
+            stats_before,
+            generation_before,
+            cursor,
+            off: 0,
+            deleted_len: 0,
+            added_len: 0,
+        }
+    }
+
+    #[cfg(debug_assertions)]
+    pub fn deleted_len(&self) -> usize {
+        self.deleted_len
+    }
+
+    #[cfg(debug_assertions)]
+    pub fn added_len(&self) -> usize {
+        self.added_len
+    }
+}
+
+pub struct History {
+    entries: VecDeque<HistoryEntry>,
+    /// The number of entries that can be undone.
+    undo_len: usize,
+    /// The deleted and added texts of all entries.
+    log: Vec<u8>,
+    /// The virtual offset of `log[0]`.
+    log_origin: usize,
+    /// The limit for the total size of the texts in the log.
+    memory_limit: usize,
+}
+
+impl History {
+    pub fn new() -> Self {
+        Self {
+            entries: VecDeque::new(),
+            undo_len: 0,
+            log: Vec::new(),
+            log_origin: 0,
+            memory_limit: DEFAULT_MEMORY_LIMIT,
+        }
+    }
+
+    pub fn clear(&mut self) {
+        self.entries.clear();
+        self.undo_len = 0;
+        self.log_origin += self.log.len();
+        self.log.clear();
+    }
+
+    /// Sets the limit for the total size of the recorded text.
+    /// It's enforced whenever a new entry is recorded.
+    pub fn set_memory_limit(&mut self, limit: usize) {
+        self.memory_limit = limit;
+    }
+
+    /// Returns all entries, including the ones that can be redone.
+    pub fn iter_mut(&mut self) -> impl Iterator<Item = &mut HistoryEntry> {
+        self.entries.iter_mut()
+    }
+
+    /// Starts recording a new entry. Drops all entries that could be redone.
+    pub fn push(&mut self, mut entry: HistoryEntry) {
+        if let Some(e) = self.entries.get(self.undo_len) {
+            self.log.truncate(e.off - self.log_origin);
+        }
+        self.entries.truncate(self.undo_len);
+
+        self.evict();
+
+        entry.off = self.log_origin + self.log.len();
+        entry.deleted_len = 0;
+        entry.added_len = 0;
+        self.entries.push_back(entry);
+        self.undo_len = self.entries.len();
+    }
+
+    fn log_end(&self) -> usize {
+        match self.entries.back() {
+            Some(e) => e.off + e.deleted_len + e.added_len,
+            None => self.log_origin + self.log.len(),
+        }
+    }
+
+    fn evict(&mut self) {
+        let mut front = self.entries.front().map_or(self.log_end(), |e| e.off);
+
+        while let Some(e) = self.entries.front()
+            && (self.entries.len() > MAX_ENTRIES || self.log_end() - front > self.memory_limit)
+        {
+            front = e.off + e.deleted_len + e.added_len;
+            self.entries.pop_front();
+            self.undo_len -= 1;
+        }
+
+        let dead = front - self.log_origin;
+        if dead > self.log.len() / 2 {
+            self.log.drain(..dead);
+            self.log_origin = front;
+        }
+    }
+
+    /// Returns the entry that's being recorded.
+    pub fn last_mut(&mut self) -> &mut HistoryEntry {
+        debug_assert!(self.undo_len == self.entries.len());
+        self.entries.back_mut().unwrap()
+    }
+
+    /// Appends `text` to the added text of the entry that's being recorded.
+    pub fn push_added(&mut self, text: &[u8]) {
+        let entry = self.last_mut();
+        entry.added_len += text.len();
+        self.log.extend_from_slice(text);
+    }
+
+    /// Like [`History::push_added`], but `write` appends the text to the given vector itself.
+    /// Returns the appended text.
+    pub fn push_added_with(&mut self, write: impl FnOnce(&mut Vec<u8>)) -> &[u8] {
+        let len_before = self.log.len();
+        write(&mut self.log);
+        self.last_mut().added_len += self.log.len() - len_before;
+        &self.log[len_before..]
+    }
+
+    /// Records deleted text in the entry that's being recorded, either before
+    /// or after the text it already deleted. `extract` must insert the text into
+    /// the given vector at the given offset, like [`Storage::extract_raw`] does.
+    ///
+    /// [`Storage::extract_raw`]: super::storage::Storage::extract_raw
+    pub fn push_deleted(&mut self, prepend: bool, extract: impl FnOnce(&mut Vec<u8>, usize)) {
+        let origin = self.log_origin;
+        let entry = self.entries.back_mut().unwrap();
+        let mut off = entry.off - origin;
+        if !prepend {
+            off += entry.deleted_len;
+        }
+
+        let len_before = self.log.len();
+        extract(&mut self.log, off);
+        entry.deleted_len += self.log.len() - len_before;
+    }
+
+    /// Moves the boundary between undo and redo entries by one and returns the index
+    /// of the entry that needs to be applied (`undo == true`) or reapplied, if any.
+    pub fn step(&mut self, undo: bool) -> Option<usize> {
+        if undo {
+            if self.undo_len == 0 {
+                return None;
+            }
+            self.undo_len -= 1;
+            Some(self.undo_len)
+        } else {
+            if self.undo_len >= self.entries.len() {
+                return None;
+            }
+            self.undo_len += 1;
+            Some(self.undo_len - 1)
+        }
+    }
+
+    pub fn entry_mut(&mut self, index: usize) -> &mut HistoryEntry {
+        &mut self.entries[index]
+    }
+
+    /// Returns the length of the text to remove from the buffer
+    /// and the text to insert in its place, to undo or redo an entry.
+    pub fn payload(&self, index: usize, undo: bool) -> (usize, &[u8]) {
+        let e = &self.entries[index];
+        let beg = e.off - self.log_origin;
+        let mid = beg + e.deleted_len;
+        let end = mid + e.added_len;
+        if undo { (e.added_len, &self.log[beg..mid]) } else { (e.deleted_len, &self.log[mid..end]) }
+    }
+}
+
+#[cfg(test)]
+mod test {
+    use super::*;
+
+    fn entry() -> HistoryEntry {
+        HistoryEntry::new(
+            Default::default(),
+            None,
+            TextBufferStatistics { logical_lines: 1, visual_lines: 1 },
+            0,
+            Default::default(),
+        )
+    }
+
+    fn record(history: &mut History, deleted: &[u8], added: &[u8]) {
+        history.push(entry());
+        history.push_deleted(false, |out, off| {
+            out.splice(off..off, deleted.iter().copied());
+        });
+        history.push_added(added);
+    }
+
+    #[test]
+    fn test_undo_redo() {
+        let mut h = History::new();
+        record(&mut h, b"", b"abc");
+        record(&mut h, b"b", b"xy");
+
+        // Prepending deleted text must not clobber the added text.
+        h.push_deleted(true, |out, off| {
+            out.splice(off..off, b"a".iter().copied());
+        });
+
+        assert_eq!(h.step(true), Some(1));
+        assert_eq!(h.payload(1, true), (2, &b"ab"[..]));
+        assert_eq!(h.step(true), Some(0));
+        assert_eq!(h.payload(0, true), (3, &b""[..]));
+        assert_eq!(h.step(true), None);
+
+        assert_eq!(h.step(false), Some(0));
+        assert_eq!(h.payload(0, false), (0, &b"abc"[..]));
+
+        // Recording a new entry drops the redo entries.
+        record(&mut h, b"c", b"z");
+        assert_eq!(h.step(false), None);
+        assert_eq!(h.step(true), Some(1));
+        assert_eq!(h.payload(1, true), (1, &b"c"[..]));
+    }
+
+    #[test]
+    fn test_eviction() {
+        let mut h = History::new();
+        h.set_memory_limit(10);
+
+        for i in 0..10u8 {
+            record(&mut h, b"", &[b'0' + i; 4]);
+        }
+
+        // Each entry has 4 bytes, so at most 3 of them fit (the last one is still
+        // in the process of being recorded and isn't subject to the limit).
+        let mut undone = Vec::new();
+        while let Some(i) = h.step(true) {
+            undone.push(h.payload(i, true).0);
+        }
+        assert_eq!(undone, [4, 4, 4]);
+        assert!(h.log.len() <= 24);
+    }
+}
@@ -0,0 +1,134 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+//! Counts the lines of a large file on a background thread.
+//!
+//! Everything but the line count can be determined from the start of a file,
+//! but counting the lines requires a pass over the entire file. For multi-GB
+//! files (in particular mapped ones, which haven't even been read yet) this
+//! would noticeably delay showing the document. Instead, the tail of the file
+//! gets counted on a separate thread and [`LineCountJob::poll`] hands out the
+//! progress, which the text buffer folds into its statistics as it goes.
+//!
+//! The worker reads the file itself instead of the text buffer contents,
+//! because the latter keep changing on the main thread while the user edits.
+
+use std::fs::File;
+use std::io::{self, Read as _, Seek as _, SeekFrom};
+use std::sync::Arc;
+use std::sync::atomic::{AtomicBool, AtomicU8, AtomicUsize, Ordering};
+use std::thread::{self, JoinHandle};
+
+use crate::helpers::*;
+use crate::unicode;
+
+/// Remaining file sizes below this are counted synchronously, which is faster.
+pub const LINE_COUNT_THRESHOLD: usize = 64 * MEBI;
+
+const STATE_RUNNING: u8 = 0;
+const STATE_DONE: u8 = 1;
+const STATE_FAILED: u8 = 2;
+
+pub enum LineCountStatus {
+    /// The given number of lines was counted so far.
+    Running(CoordType),
+    /// The count is complete.
+    Done(CoordType),
+    /// Reading the file failed. The caller needs to count the lines itself.
+    Failed,
+}
+
+struct Progress {
+    lines: AtomicUsize,
+    state: AtomicU8,
+    cancel: AtomicBool,
+}
+
+pub struct LineCountJob {
+    progress: Arc<Progress>,
+    thread: Option<JoinHandle<()>>,
+    /// The part of the count that was already returned by [`LineCountJob::poll`].
+    applied: CoordType,
+}
+
+impl LineCountJob {
+    /// Starts counting the newlines in the `len` bytes at `offset` in `file`.
+    pub fn spawn(file: &File, offset: usize, len: usize) -> Option<Self> {
+        let mut file = file.try_clone().ok()?;
+        let progress = Arc::new(Progress {
+            lines: AtomicUsize::new(0),
+            state: AtomicU8::new(STATE_RUNNING),
+            cancel: AtomicBool::new(false),
+        });
+
+        let p = progress.clone();
+        let thread = thread::Builder::new()
+            .name("line-count".into())
+            .spawn(move || {
+                let state = match Self::count(&mut file, offset, len, &p) {
+                    Ok(()) => STATE_DONE,
+                    Err(_) => STATE_FAILED,
+                };
+                p.state.store(state, Ordering::Release);
+            })
+            .ok()?;
+
+        Some(Self { progress, thread: Some(thread), applied: 0 })
+    }
+
+    fn count(file: &mut File, offset: usize, len: usize, p: &Progress) -> io::Result<()> {
+        let mut buf = vec![0; 128 * KIBI];
+        let mut remaining = len;
+        let mut lines = 0;
+
+        file.seek(SeekFrom::Start(offset as u64))?;
+
+        while remaining > 0 {
+            if p.cancel.load(Ordering::Relaxed) {
+                return Ok(());
+            }
+
+            let read = match file.read(&mut buf[..remaining.min(128 * KIBI)]) {
+                Ok(0) => return Err(io::ErrorKind::UnexpectedEof.into()),
+                Ok(read) => read,
+                Err(e) if e.kind() == io::ErrorKind::Interrupted => continue,
+                Err(e) => return Err(e),
+            };
+
+            (_, lines) = unicode::newlines_forward(&buf[..read], 0, lines, CoordType::MAX);
+            p.lines.store(lines as usize, Ordering::Relaxed);
+            remaining -= read;
+        }
+
+        Ok(())
+    }
+
+    /// Returns the number of lines counted since the last call.
+    pub fn poll(&mut self) -> LineCountStatus {
+        // Load the state first, so that a completed count is never missed.
+        let state = self.progress.state.load(Ordering::Acquire);
+        let lines = self.progress.lines.load(Ordering::Relaxed) as CoordType;
+        let delta = lines - self.applied;
+        self.applied = lines;
+
+        match state {
+            STATE_RUNNING => LineCountStatus::Running(delta),
+            STATE_DONE => LineCountStatus::Done(delta),
+            _ => LineCountStatus::Failed,
+        }
+    }
+
+    /// Blocks until the count is complete. Call [`LineCountJob::poll`] afterwards.
+    pub fn wait(&mut self) {
+        if let Some(thread) = self.thread.take() {
+            _ = thread.join();
+        }
+    }
+}
+
+impl Drop for LineCountJob {
+    fn drop(&mut self) {
+        // The thread is left detached, but it'll exit after its current read.
+        self.progress.cancel.store(true, Ordering::Relaxed);
+    }
+}
@@ -0,0 +1,224 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+//! A sparse table of line start checkpoints.
+//!
+//! Seeking in a gap buffer is linear in the distance to the target, because
+//! all the text in between has to be scanned for newlines (or even measured,
+//! if word wrap is enabled). For small documents that's perfectly fine, but in
+//! a multi-GB log file, jumping to the end and back gets slow quickly.
+//!
+//! [`LineIndex`] remembers a line start roughly every [`CHECKPOINT_INTERVAL`]
+//! bytes. Seeking first binary searches for the closest checkpoint and then
+//! walks from there, which bounds the walk to about one interval.
+//! The table is filled lazily as seeks reach further into the document and
+//! patched on edits, so that it never needs to be rebuilt from scratch.
+
+use crate::helpers::*;
+use crate::unicode::Cursor;
+
+/// The approximate distance in bytes between two checkpoints.
+pub const CHECKPOINT_INTERVAL: usize = 64 * KIBI;
+
+struct PendingEdit {
+    offset: usize,
+    deleted: usize,
+    len_before: usize,
+    logical_lines_before: CoordType,
+    visual_lines_before: CoordType,
+}
+
+pub struct LineIndex {
+    /// Cursors at logical line starts, sorted by offset.
+    /// Since offsets, logical and visual positions all grow monotonically,
+    /// they're also sorted by the latter two. The first entry is always
+    /// the start of the document, which makes lookups infallible.
+    checkpoints: Vec<Cursor>,
+    /// Set while an edit is in progress. Checkpoints past the edit
+    /// offset are stale until [`LineIndex::edit_end`] patches them.
+    pending: Option<PendingEdit>,
+    /// Set when there are no more checkpoints past the last one.
+    complete: bool,
+}
+
+impl LineIndex {
+    pub fn new() -> Self {
+        Self { checkpoints: vec![Default::default()], pending: None, complete: false }
+    }
+
+    /// Drops all checkpoints. Use this if the contents or layout
+    /// of the document changed in ways that can't be patched.
+    pub fn clear(&mut self) {
+        self.checkpoints.truncate(1);
+        self.pending = None;
+        self.complete = false;
+    }
+
+    /// Returns the last checkpoint if the table can be extended past it.
+    /// This isn't possible in the middle of an edit or once the end was reached.
+    pub fn extendable_tail(&self) -> Option<Cursor> {
+        if self.pending.is_some() || self.complete {
+            None
+        } else {
+            self.checkpoints.last().copied()
+        }
+    }
+
+    /// Appends a checkpoint, which must be after [`LineIndex::extendable_tail`].
+    pub fn push(&mut self, cursor: Cursor) {
+        debug_assert!(cursor.offset > self.checkpoints.last().unwrap().offset);
+        debug_assert!(cursor.logical_pos.x == 0 && cursor.visual_pos.x == 0);
+        self.checkpoints.push(cursor);
+    }
+
+    /// Marks the table as covering the entire document.
+    pub fn set_complete(&mut self) {
+        self.complete = true;
+    }
+
+    /// Returns the last checkpoint for which `before` returns true.
+    ///
+    /// `before` must be monotonic over the checkpoints: true up to some point, false after.
+    pub fn find(&self, before: impl Fn(&Cursor) -> bool) -> Cursor {
+        let valid = match &self.pending {
+            Some(p) => self.checkpoints.partition_point(|c| c.offset <= p.offset),
+            None => self.checkpoints.len(),
+        };
+        let checkpoints = &self.checkpoints[..valid];
+        let idx = checkpoints.partition_point(before);
+        checkpoints[idx.saturating_sub(1)]
+    }
+
+    /// Call this before modifying the document at `offset`. The other
+    /// parameters are the document length and line counts before the modification.
+    pub fn edit_begin(
+        &mut self,
+        offset: usize,
+        len: usize,
+        logical_lines: CoordType,
+        visual_lines: CoordType,
+    ) {
+        debug_assert!(self.pending.is_none());
+        self.pending = Some(PendingEdit {
+            offset,
+            deleted: 0,
+            len_before: len,
+            logical_lines_before: logical_lines,
+            visual_lines_before: visual_lines,
+        });
+    }
+
+    /// Records that `count` bytes of the original text past the edit offset were deleted.
+    pub fn edit_delete(&mut self, count: usize) {
+        if let Some(p) = &mut self.pending {
+            p.deleted += count;
+        }
+    }
+
+    /// Call this once the modification is complete. The parameters are the new document
+    /// length and the new line counts. If the visual line count isn't known accurately,
+    /// pass `None` and all checkpoints past the edit will be dropped instead of moved.
+    pub fn edit_end(
+        &mut self,
+        len: usize,
+        logical_lines: CoordType,
+        visual_lines: Option<CoordType>,
+    ) {
+        let Some(p) = self.pending.take() else {
+            return;
+        };
+
+        let beg = self.checkpoints.partition_point(|c| c.offset <= p.offset);
+
+        let Some(visual_lines) = visual_lines else {
+            self.checkpoints.truncate(beg);
+            self.complete = false;
+            return;
+        };
+
+        // If the table was complete, it can only stop being so if the edit dropped
+        // the last checkpoint or added new line starts. This avoids rescanning
+        // the tail of the document after every keystroke.
+        let old_end = p.offset + p.deleted;
+        let end = self.checkpoints.partition_point(|c| c.offset <= old_end);
+        if (beg < end && end == self.checkpoints.len()) || logical_lines > p.logical_lines_before {
+            self.complete = false;
+        }
+
+        // Checkpoints within the deleted range are gone, but everything past it
+        // is still at a line start, just at a different location. Since word wrap
+        // doesn't cross logical lines, the layout of those lines is unchanged as well.
+        self.checkpoints.drain(beg..end);
+
+        let delta_offset = len as isize - p.len_before as isize;
+        let delta_logical = logical_lines - p.logical_lines_before;
+        let delta_visual = visual_lines - p.visual_lines_before;
+
+        if delta_offset != 0 || delta_logical != 0 || delta_visual != 0 {
+            for c in &mut self.checkpoints[beg..] {
+                c.offset = c.offset.wrapping_add_signed(delta_offset);
+                c.logical_pos.y += delta_logical;
+                c.visual_pos.y += delta_visual;
+            }
+        }
+    }
+}
+
+#[cfg(test)]
+mod test {
+    use super::*;
+
+    fn checkpoint(offset: usize, y: CoordType) -> Cursor {
+        Cursor {
+            offset,
+            logical_pos: Point { x: 0, y },
+            visual_pos: Point { x: 0, y },
+            ..Default::default()
+        }
+    }
+
+    fn offsets(index: &LineIndex) -> Vec<(usize, CoordType)> {
+        index.checkpoints.iter().map(|c| (c.offset, c.logical_pos.y)).collect()
+    }
+
+    #[test]
+    fn test_find() {
+        let mut index = LineIndex::new();
+        index.push(checkpoint(100, 10));
+        index.push(checkpoint(200, 20));
+
+        assert_eq!(index.find(|c| c.logical_pos.y <= 5).offset, 0);
+        assert_eq!(index.find(|c| c.logical_pos.y <= 10).offset, 100);
+        assert_eq!(index.find(|c| c.logical_pos.y <= 1000).offset, 200);
+        assert_eq!(index.find(|c| c.offset <= 199).offset, 100);
+
+        // Checkpoints past a pending edit must not be used.
+        index.edit_begin(150, 300, 30, 30);
+        assert_eq!(index.find(|c| c.logical_pos.y <= 1000).offset, 100);
+        assert!(index.extendable_tail().is_none());
+    }
+
+    #[test]
+    fn test_patch() {
+        let mut index = LineIndex::new();
+        index.push(checkpoint(100, 10));
+        index.push(checkpoint(200, 20));
+        index.push(checkpoint(300, 30));
+
+        // Insert 5 bytes with 1 newline at a checkpoint: it stays put.
+        index.edit_begin(100, 400, 40, 40);
+        index.edit_end(405, 41, Some(41));
+        assert_eq!(offsets(&index), [(0, 0), (100, 10), (205, 21), (305, 31)]);
+
+        // Delete across the second checkpoint.
+        index.edit_begin(150, 405, 41, 41);
+        index.edit_delete(100);
+        index.edit_end(305, 36, Some(36));
+        assert_eq!(offsets(&index), [(0, 0), (100, 10), (205, 26)]);
+
+        // Unknown visual layout drops everything past the edit.
+        index.edit_begin(50, 305, 36, 36);
+        index.edit_end(306, 36, None);
+        assert_eq!(offsets(&index), [(0, 0)]);
+    }
+}
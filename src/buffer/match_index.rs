@@ -0,0 +1,450 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+//! All hits of the search pattern, for counting and highlighting them.
+//!
+//! Searching only ever needs the next hit, but showing "37/12480" and highlighting
+//! every visible hit needs all of them. [`MatchIndex`] collects them into a sorted
+//! array. Plain text searches run on a background thread over a [`TextSnapshot`]
+//! (see [`MatchIndex::resume`]), while ICU searches are tied to the live buffer and proceed in time-boxed steps on
+//! the main thread (see [`MatchIndex::step`]). Either way, [`MatchIndex::poll`] folds
+//! their progress in, and the array covers a growing prefix of the document until
+//! it's complete.
+//!
+//! Edits patch the array instead of starting over: Hits before the edit are kept,
+//! and for plain text searches the hits after it are shifted, once a rescan of the
+//! edited text resynchronizes with them. ICU searches rescan from the start of the
+//! edited line, since a regex can match anything.
+
+use std::ops::Range;
+use std::sync::atomic::{AtomicBool, Ordering};
+use std::sync::{Arc, Mutex};
+use std::time::{Duration, Instant};
+use std::{mem, thread};
+
+use super::snapshot::TextSnapshot;
+use super::{LiteralSearch, SearchEngine, SearchOptions};
+use crate::document::ReadableDocument;
+use crate::helpers::*;
+use crate::simd::memrchr2;
+
+/// The background search hands over its hits in batches of this many,
+/// so that the main thread doesn't contend with it for every single one.
+const BATCH_LEN: usize = 4096;
+
+/// The background search checks whether it was cancelled after reading at most this much.
+const CANCEL_GRANULARITY: usize = 64 * KIBI;
+
+/// After an edit interrupts the background search, this is how long typing has to pause
+/// before it starts over with a new snapshot, since that copies a gap buffer's entire contents.
+/// [`MatchIndex::step`] continues the search in the meantime.
+const RESPAWN_DELAY: Duration = Duration::from_millis(250);
+
+struct JobShared {
+    found: Mutex<Vec<Range<usize>>>,
+    done: AtomicBool,
+    cancel: AtomicBool,
+}
+
+struct MatchJob {
+    shared: Arc<JobShared>,
+}
+
+/// Hands out the snapshot in pieces of at most [`CANCEL_GRANULARITY`], and nothing at all
+/// once the job is cancelled. This way the search also stops if it doesn't find any hits.
+struct JobDocument<'a> {
+    snapshot: &'a TextSnapshot,
+    cancel: &'a AtomicBool,
+}
+
+impl ReadableDocument for JobDocument<'_> {
+    fn read_forward(&self, off: usize) -> &[u8] {
+        if self.cancel.load(Ordering::Relaxed) {
+            return &[];
+        }
+        let chunk = self.snapshot.read_forward(off);
+        &chunk[..chunk.len().min(CANCEL_GRANULARITY)]
+    }
+
+    fn read_backward(&self, off: usize) -> &[u8] {
+        if self.cancel.load(Ordering::Relaxed) {
+            return &[];
+        }
+        let chunk = self.snapshot.read_backward(off);
+        &chunk[chunk.len().saturating_sub(CANCEL_GRANULARITY)..]
+    }
+}
+
+impl MatchJob {
+    fn spawn(snapshot: TextSnapshot, literal: LiteralSearch, offset: usize) -> Option<Self> {
+        let shared = Arc::new(JobShared {
+            found: Mutex::new(Vec::new()),
+            done: AtomicBool::new(false),
+            cancel: AtomicBool::new(false),
+        });
+
+        let s = shared.clone();
+        thread::Builder::new()
+            .name("match-index".into())
+            .spawn(move || {
+                let doc = JobDocument { snapshot: &snapshot, cancel: &s.cancel };
+                let mut batch = Vec::new();
+                let mut offset = offset;
+
+                while let Some(hit) = literal.find(&doc, offset) {
+                    offset = hit.end;
+                    batch.push(hit);
+                    if batch.len() >= BATCH_LEN {
+                        s.found.lock().unwrap().append(&mut batch);
+                    }
+                }
+
+                // A cancelled search reads as if the document ended early.
+                if s.cancel.load(Ordering::Relaxed) {
+                    return;
+                }
+                s.found.lock().unwrap().append(&mut batch);
+                s.done.store(true, Ordering::Release);
+            })
+            .ok()?;
+
+        Some(Self { shared })
+    }
+}
+
+impl Drop for MatchJob {
+    fn drop(&mut self) {
+        // The thread is left detached, but it exits within the next `CANCEL_GRANULARITY` bytes.
+        self.shared.cancel.store(true, Ordering::Relaxed);
+    }
+}
+
+struct PendingEdit {
+    offset: usize,
+    deleted: usize,
+    len_before: usize,
+}
+
+/// See [`TextBuffer::search_matches`](super::TextBuffer::search_matches).
+#[derive(Clone, Copy, Default, Debug, PartialEq, Eq)]
+pub struct SearchMatches {
+    /// The 1-based number of the selected hit, if a hit is selected.
+    pub current: Option<usize>,
+    /// The number of hits found so far.
+    pub total: usize,
+    /// If false, the search is still running and `total` is a lower bound.
+    pub complete: bool,
+}
+
+pub struct MatchIndex {
+    pattern: String,
+    options: SearchOptions,
+    /// `None` if the pattern is invalid.
+    engine: Option<SearchEngine>,
+    /// The hits found so far, sorted and non-overlapping.
+    ranges: Vec<Range<usize>>,
+    /// The search continues at this offset. `ranges` holds all hits before it.
+    scanned: usize,
+    complete: bool,
+    /// A background search that hands over the hits from `scanned` onwards.
+    job: Option<MatchJob>,
+    /// False if a background search couldn't be started. The search then continues in [`MatchIndex::step`].
+    background: bool,
+    pending: Option<PendingEdit>,
+    /// An edit stopped the background search. It starts over once this time has passed.
+    resume_after: Option<Instant>,
+    /// Changes whenever `ranges` does. See [`MatchIndex::version`].
+    version: u64,
+    /// The buffer revision the ICU regex was last pointed at.
+    icu_revision: Option<u64>,
+}
+
+impl MatchIndex {
+    /// Prepares indexing the hits of `engine`, which was made for `pattern` and `options`.
+    /// `version` must be larger than that of the index this one replaces.
+    pub fn new(
+        pattern: &str,
+        options: SearchOptions,
+        engine: Option<SearchEngine>,
+        version: u64,
+    ) -> Self {
+        Self {
+            pattern: pattern.to_string(),
+            options,
+            ranges: Vec::new(),
+            scanned: 0,
+            complete: engine.is_none(),
+            engine,
+            job: None,
+            background: true,
+            pending: None,
+            resume_after: None,
+            version,
+            icu_revision: None,
+        }
+    }
+
+    /// Returns true if the index was made for the given search.
+    pub fn is_for(&self, pattern: &str, options: SearchOptions) -> bool {
+        self.pattern == pattern && self.options == options
+    }
+
+    /// The hits found so far, sorted by offset.
+    pub fn ranges(&self) -> &[Range<usize>] {
+        &self.ranges
+    }
+
+    pub fn is_complete(&self) -> bool {
+        self.complete
+    }
+
+    /// Changes every time the hits do, so that renders can be skipped otherwise.
+    pub fn version(&self) -> u64 {
+        self.version
+    }
+
+    /// Returns true if the search can continue on a background thread, given a
+    /// snapshot of the current contents. See [`MatchIndex::resume`].
+    pub fn wants_snapshot(&self) -> bool {
+        !self.complete
+            && self.job.is_none()
+            && self.background
+            && matches!(self.engine, Some(SearchEngine::Literal(_)))
+            && self.resume_after.is_none_or(|t| Instant::now() >= t)
+    }
+
+    /// Continues a plain text search on a background thread over `snapshot`,
+    /// which must reflect the current contents.
+    pub fn resume(&mut self, snapshot: TextSnapshot) {
+        if let Some(SearchEngine::Literal(literal)) = &self.engine {
+            self.job = MatchJob::spawn(snapshot, literal.clone(), self.scanned);
+            self.background = self.job.is_some();
+            self.resume_after = None;
+        }
+    }
+
+    /// Folds in the hits of the background search.
+    pub fn poll(&mut self) {
+        let Some(job) = &self.job else {
+            return;
+        };
+
+        // Load the state first, so that the final hits are never missed.
+        let done = job.shared.done.load(Ordering::Acquire);
+        let mut found = mem::take(&mut *job.shared.found.lock().unwrap());
+
+        if let Some(last) = found.last() {
+            self.scanned = last.end;
+            self.ranges.append(&mut found);
+            self.version += 1;
+        }
+        if done {
+            self.job = None;
+            self.complete = true;
+            self.version += 1;
+        }
+    }
+
+    /// Continues the search on the current thread until `deadline`, unless a background
+    /// search takes care of it. `revision` is that of the buffer the ICU regex reads from.
+    pub fn step(&mut self, doc: &dyn ReadableDocument, revision: u64, deadline: Instant) {
+        if self.complete || self.job.is_some() {
+            return;
+        }
+
+        match &mut self.engine {
+            Some(SearchEngine::Icu { text, regex }) => {
+                if self.icu_revision != Some(revision) {
+                    // The regex caches text, which has to be reloaded after edits.
+                    unsafe { regex.set_text(text, self.scanned) };
+                    self.icu_revision = Some(revision);
+                } else {
+                    regex.reset(self.scanned);
+                }
+            }
+            Some(SearchEngine::Literal(_)) => {}
+            None => return,
+        }
+
+        let mut changed = false;
+        loop {
+            let hit = match &mut self.engine {
+                Some(SearchEngine::Literal(literal)) => literal.find(doc, self.scanned),
+                Some(SearchEngine::Icu { regex, .. }) => regex.next(),
+                None => None,
+            };
+            let Some(hit) = hit else {
+                self.complete = true;
+                changed = true;
+                break;
+            };
+
+            self.scanned = hit.end;
+            // Regexes like `^` match the empty string. There's nothing to count or highlight.
+            if !hit.is_empty() {
+                self.ranges.push(hit);
+                changed = true;
+            }
+
+            if Instant::now() >= deadline {
+                break;
+            }
+        }
+
+        if changed {
+            self.version += 1;
+        }
+    }
+
+    /// Call this before modifying the document at `offset`. `len` is its length before.
+    pub fn edit_begin(&mut self, offset: usize, len: usize) {
+        self.pending = Some(PendingEdit { offset, deleted: 0, len_before: len });
+    }
+
+    /// Records that `count` bytes of the original text past the edit offset were deleted.
+    pub fn edit_delete(&mut self, count: usize) {
+        if let Some(p) = &mut self.pending {
+            p.deleted += count;
+        }
+    }
+
+    /// Call this once the modification is complete. `len` is the new document length.
+    pub fn edit_end(&mut self, doc: &dyn ReadableDocument, len: usize) {
+        let Some(p) = self.pending.take() else {
+            return;
+        };
+        if self.engine.is_none() {
+            return;
+        }
+
+        let inserted = len + p.deleted - p.len_before;
+        let edit_end = p.offset + inserted;
+        self.version += 1;
+
+        // Find the offset from which a fresh search would differ from the previous one.
+        // Plain text hits end within the needle length after it, but a regex may look at
+        // the entire line. If the last unaffected hit straddles that point it's included,
+        // because searching from within a hit gives different results than from its start.
+        let mut lo = match &self.engine {
+            Some(SearchEngine::Literal(literal)) => {
+                p.offset.saturating_sub(literal.needle.len() - 1)
+            }
+            _ => line_start(doc, p.offset),
+        };
+        let keep = self.ranges.partition_point(|r| r.end <= lo);
+        if let Some(r) = self.ranges.get(keep) {
+            lo = lo.min(r.start);
+        }
+
+        // A complete plain text index can be patched, because its hits don't depend on
+        // the text far away. Otherwise, the search simply continues from `lo`.
+        let literal = match &self.engine {
+            Some(SearchEngine::Literal(literal)) if self.complete => literal,
+            _ => {
+                if self.job.take().is_some() {
+                    self.resume_after = Some(Instant::now() + RESPAWN_DELAY);
+                }
+                self.complete = false;
+                self.ranges.truncate(keep);
+                self.scanned = self.scanned.min(lo);
+                return;
+            }
+        };
+
+        // Searching from `lo` must resynchronize with the previous hits after the edit eventually:
+        // Once it reaches unchanged text outside of any previous hit, everything after is the same.
+        let mut found = Vec::new();
+        let mut off = lo;
+        let resync = loop {
+            if off >= edit_end {
+                let old_off = off - inserted + p.deleted;
+                let j = self.ranges.partition_point(|r| r.end <= old_off);
+                if self.ranges.get(j).is_none_or(|r| r.start >= old_off) {
+                    break j;
+                }
+            }
+            match literal.find(doc, off) {
+                Some(hit) => {
+                    off = hit.end;
+                    found.push(hit);
+                }
+                None => break self.ranges.len(),
+            }
+        };
+
+        let shifted = keep + found.len();
+        self.ranges.splice(keep..resync, found);
+        for r in &mut self.ranges[shifted..] {
+            r.start = r.start - p.deleted + inserted;
+            r.end = r.end - p.deleted + inserted;
+        }
+        self.scanned = self.ranges.last().map_or(0, |r| r.end);
+    }
+}
+
+/// Returns the offset of the start of the line that contains `off`.
+fn line_start(doc: &dyn ReadableDocument, mut off: usize) -> usize {
+    loop {
+        let chunk = doc.read_backward(off);
+        if chunk.is_empty() {
+            return 0;
+        }
+        if let Some(i) = memrchr2(b'\n', b'\n', chunk, chunk.len()) {
+            return off - chunk.len() + i + 1;
+        }
+        off -= chunk.len();
+    }
+}
+
+#[cfg(test)]
+mod test {
+    use super::*;
+    use crate::helpers::TestRng;
+
+    fn literal(needle: &str) -> LiteralSearch {
+        LiteralSearch { needle: needle.as_bytes().to_vec(), fold: false }
+    }
+
+    fn all_hits(text: &[u8], literal: &LiteralSearch) -> Vec<Range<usize>> {
+        let mut hits = Vec::new();
+        let mut off = 0;
+        while let Some(hit) = literal.find(&text, off) {
+            off = hit.end;
+            hits.push(hit);
+        }
+        hits
+    }
+
+    #[test]
+    fn test_patch() {
+        let mut text = b"aaa ab aab baa aaaa".repeat(8);
+        let lit = literal("aa");
+        let snapshot = TextSnapshot::new(vec![Arc::new(text.clone())], 0, 0);
+        let engine = Some(SearchEngine::Literal(lit.clone()));
+        let mut index = MatchIndex::new("aa", SearchOptions::default(), engine, 1);
+
+        assert!(index.wants_snapshot());
+        index.resume(snapshot);
+        while !index.is_complete() {
+            index.poll();
+        }
+        assert_eq!(index.ranges(), all_hits(&text, &lit));
+
+        let mut rng = TestRng::default();
+        let mut next = |n: usize| rng.below(n + 1);
+
+        for _ in 0..500 {
+            let off = next(text.len());
+            let delete = next((text.len() - off).min(5));
+            let insert: Vec<u8> = (0..next(4)).map(|_| b"a b"[next(2)]).collect();
+
+            index.edit_begin(off, text.len());
+            index.edit_delete(delete);
+            text.splice(off..off + delete, insert);
+            index.edit_end(&&text[..], text.len());
+
+            assert!(index.is_complete());
+            assert_eq!(index.ranges(), all_hits(&text, &lit));
+        }
+    }
+}
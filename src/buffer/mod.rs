@@ -4,8 +4,11 @@
 //! A text buffer for a text editor.
 //!
 //! Implements a Unicode-aware, layout-aware text buffer for terminals.
-//! It's based on a gap buffer. It has no line cache and instead relies
-//! on the performance of the ucd module for fast text navigation.
+//! It's based on a gap buffer, or for very large files on a chunked rope
+//! (see `storage`). It has no line cache and instead relies
+//! on the performance of the ucd module for fast text navigation. To keep
+//! seeking fast in very large documents, it additionally maintains a sparse
+//! index of line start checkpoints (see `line_index`).
 //!
 //! ---
 //!
@@ -21,20 +24,40 @@
 //! There's no solution for the latter. However, there's a chance that the performance will still be sufficient.
 
 mod gap_buffer;
+mod history;
+mod line_count;
+mod line_index;
+mod match_index;
 mod navigation;
+mod pool;
+mod rope;
+mod snapshot;
+mod storage;
 
 use std::borrow::Cow;
 use std::cell::UnsafeCell;
-use std::collections::LinkedList;
 use std::fmt::Write as _;
 use std::fs::File;
-use std::io::{Read as _, Write as _};
+use std::io::{IoSlice, Read as _, Write as _};
 use std::mem::{self, MaybeUninit};
 use std::ops::Range;
 use std::rc::Rc;
 use std::str;
-
-use gap_buffer::GapBuffer;
+use std::sync::Arc;
+use std::time::{Duration, Instant};
+
+pub use gap_buffer::GapBuffer;
+use history::{History, HistoryEntry};
+use line_count::{LINE_COUNT_THRESHOLD, LineCountJob, LineCountStatus};
+use line_index::{CHECKPOINT_INTERVAL, LineIndex};
+use match_index::MatchIndex;
+pub use match_index::SearchMatches;
+pub use pool::{BufferPoolStats, PoolStats, pool_stats};
+pub use rope::Rope;
+use snapshot::SnapshotCache;
+pub use snapshot::TextSnapshot;
+use storage::Storage;
+pub use storage::StorageKind;
 
 use crate::arena::{ArenaString, scratch_arena};
 use crate::cell::SemiRefCell;
@@ -44,7 +67,7 @@ use crate::helpers::*;
 use crate::oklab::oklab_blend;
 use crate::simd::memchr2;
 use crate::unicode::{self, Cursor, MeasurementConfig};
-use crate::{apperr, icu};
+use crate::{apperr, hash, icu, sys, trace};
 
 /// The margin template is used for line numbers.
 /// The max. line number we should ever expect is probably 64-bit,
@@ -53,6 +76,23 @@ const MARGIN_TEMPLATE: &str = "                    │ ";
 /// Just a bunch of whitespace you can use for turning tabs into spaces.
 /// Happens to reuse MARGIN_TEMPLATE, because it has sufficient whitespace.
 const TAB_WHITESPACE: &str = MARGIN_TEMPLATE;
+/// Files at least this large are mapped into memory instead of being read,
+/// if [`TextBuffer::set_map_large_files`] is enabled.
+const FILE_MAPPING_THRESHOLD: usize = 16 * MEBI;
+/// With [`StorageKind::Auto`], files at least this large are loaded into a rope instead of a gap buffer.
+const ROPE_THRESHOLD: usize = 64 * MEBI;
+/// Files at least this large are converted from and to non-UTF-8 encodings on multiple threads.
+const PARALLEL_TRANSCODE_THRESHOLD: usize = 4 * MEBI;
+/// The size of the buffers used for converting files from and to non-UTF-8 encodings.
+const TRANSCODE_CHUNK_SIZE: usize = 64 * KIBI;
+/// If word wrap is enabled and more than this many bytes follow the cursor, a reflow only
+/// lays out the text up to the cursor right away and completes the rest in [`TextBuffer::poll_statistics`].
+const LAZY_REFLOW_THRESHOLD: usize = MEBI;
+/// How long a single call to [`TextBuffer::poll_statistics`] may spend on completing a reflow.
+const REFLOW_STEP_BUDGET: Duration = Duration::from_millis(16);
+/// How long a single call to [`TextBuffer::poll_statistics`] may spend on
+/// collecting the hits of a search that can't run in the background.
+const MATCH_STEP_BUDGET: Duration = Duration::from_millis(8);
 
 /// Stores statistics about the whole document.
 #[derive(Copy, Clone)]
@@ -81,39 +121,110 @@ enum HistoryType {
     Delete,
 }
 
-/// An undo/redo entry.
-struct HistoryEntry {
-    /// [`TextBuffer::cursor`] position before the change was made.
-    cursor_before: Point,
-    /// [`TextBuffer::selection`] before the change was made.
-    selection_before: Option<TextBufferSelection>,
-    /// [`TextBuffer::stats`] before the change was made.
-    stats_before: TextBufferStatistics,
-    /// [`GapBuffer::generation`] before the change was made.
-    generation_before: u32,
-    /// Logical cursor position where the change took place.
-    /// The position is at the start of the changed range.
-    cursor: Point,
-    /// Text that was deleted from the buffer.
-    deleted: Vec<u8>,
-    /// Text that was added to the buffer.
-    added: Vec<u8>,
+/// The backend of an [`ActiveSearch`].
+enum SearchEngine {
+    /// Plain text searches run directly on the UTF-8 contents.
+    Literal(LiteralSearch),
+    /// Everything else (regex, whole word, non-ASCII case folding) goes through ICU.
+    Icu {
+        /// The ICU `UText` object.
+        text: icu::Text,
+        /// The ICU `URegularExpression` object.
+        regex: icu::Regex,
+    },
+}
+
+/// A plain text search that doesn't need ICU.
+#[derive(Clone)]
+struct LiteralSearch {
+    /// The search pattern. Lowercase if `fold` is set.
+    needle: Vec<u8>,
+    /// If true, ASCII letters match case-insensitively.
+    /// Only used for ASCII patterns, because Unicode case folding requires ICU.
+    fold: bool,
 }
 
-/// Caches an ICU search operation.
+impl LiteralSearch {
+    /// Searches for the needle directly in the document contents, including across the gap.
+    /// Candidates are located by their first byte via [`memchr2`] and most of them are
+    /// rejected by their last byte, before comparing the entire needle.
+    fn find(&self, doc: &dyn ReadableDocument, mut offset: usize) -> Option<Range<usize>> {
+        let needle = &self.needle[..];
+        let (first, last) = (needle[0], needle[needle.len() - 1]);
+        let (first_alt, last_alt) = if self.fold {
+            (first.to_ascii_uppercase(), last.to_ascii_uppercase())
+        } else {
+            (first, last)
+        };
+
+        loop {
+            let chunk = doc.read_forward(offset);
+            if chunk.is_empty() {
+                return None;
+            }
+
+            let mut i = 0;
+            loop {
+                i = memchr2(first, first_alt, chunk, i);
+                if i >= chunk.len() {
+                    break;
+                }
+
+                // If the needle extends past this chunk, the last byte can't be checked cheaply.
+                let plausible = match chunk.get(i + needle.len() - 1) {
+                    Some(&ch) => ch == last || ch == last_alt,
+                    None => true,
+                };
+                if plausible && self.matches_at(doc, offset + i) {
+                    return Some(offset + i..offset + i + needle.len());
+                }
+
+                i += 1;
+            }
+
+            offset += chunk.len();
+        }
+    }
+
+    fn matches_at(&self, doc: &dyn ReadableDocument, mut offset: usize) -> bool {
+        let mut needle = &self.needle[..];
+
+        while !needle.is_empty() {
+            let chunk = doc.read_forward(offset);
+            if chunk.is_empty() {
+                return false;
+            }
+
+            let len = chunk.len().min(needle.len());
+            let eq = if self.fold {
+                chunk[..len].eq_ignore_ascii_case(&needle[..len])
+            } else {
+                chunk[..len] == needle[..len]
+            };
+            if !eq {
+                return false;
+            }
+
+            needle = &needle[len..];
+            offset += len;
+        }
+
+        true
+    }
+}
+
+/// Caches a search operation.
 struct ActiveSearch {
     /// The search pattern.
     pattern: String,
     /// The search options.
     options: SearchOptions,
-    /// The ICU `UText` object.
-    text: icu::Text,
-    /// The ICU `URegularExpression` object.
-    regex: icu::Regex,
-    /// [`GapBuffer::generation`] when the search was created.
+    /// The search backend.
+    engine: SearchEngine,
+    /// [`TextBuffer::revision`] when the search last ran.
     /// This is used to detect if we need to refresh the
-    /// [`ActiveSearch::regex`] object.
-    buffer_generation: u32,
+    /// ICU regex object.
+    buffer_revision: u64,
     /// [`TextBuffer::selection_generation`] when the search was
     /// created. When the user manually selects text, we need to
     /// refresh the [`ActiveSearch::pattern`] with it.
@@ -137,15 +248,18 @@ pub struct SearchOptions {
 
 /// Caches the start and length of the active edit line for a single edit.
 /// This helps us avoid having to remeasure the buffer after an edit.
+///
+/// Since word wrap doesn't cross logical lines, only the lines touched by the edit
+/// can change their height. If a deletion joins the edited line with the ones after it,
+/// their height is added to [`ActiveEditLineInfo::line_height_in_rows`] before they're gone.
 struct ActiveEditLineInfo {
     /// Points to the start of the currently being edited line.
     safe_start: Cursor,
-    /// Number of visual rows of the line that starts
-    /// at [`ActiveEditLineInfo::safe_start`].
+    /// Number of visual rows of the line that starts at [`ActiveEditLineInfo::safe_start`],
+    /// and of any lines after it that the edit joined with it, before the edit.
     line_height_in_rows: CoordType,
-    /// Byte distance from the start of the line at
-    /// [`ActiveEditLineInfo::safe_start`] to the next line.
-    distance_next_line_start: usize,
+    /// Offset of the first line start after the edited lines, in the current text.
+    next_line_start: usize,
 }
 
 /// Char- or word-wise navigation? Your choice.
@@ -160,6 +274,36 @@ pub struct RenderResult {
     pub visual_pos_x_max: CoordType,
 }
 
+/// The contents of a [`TextBuffer`] in its file encoding.
+/// See [`TextBuffer::snapshot_for_writing()`].
+pub struct FileSnapshot {
+    pieces: Vec<Arc<Vec<u8>>>,
+    generation: u32,
+}
+
+impl FileSnapshot {
+    /// The generation of the buffer at the time the snapshot was taken.
+    pub fn generation(&self) -> u32 {
+        self.generation
+    }
+
+    /// The size of the contents in bytes.
+    pub fn len(&self) -> usize {
+        self.pieces.iter().map(|p| p.len()).sum()
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.len() == 0
+    }
+
+    /// Writes the contents to `file`. Unlike [`TextBuffer::write_file()`],
+    /// this doesn't touch the buffer and can be done on any thread.
+    pub fn write_to(&self, file: &mut File) -> apperr::Result<()> {
+        let pieces: Vec<&[u8]> = self.pieces.iter().map(|p| p.as_slice()).collect();
+        write_pieces(file, &pieces)
+    }
+}
+
 /// A [`TextBuffer`] with inner mutability.
 pub type TextBufferCell = SemiRefCell<TextBuffer>;
 
@@ -171,10 +315,9 @@ pub type RcTextBuffer = Rc<TextBufferCell>;
 
 /// A text buffer for a text editor.
 pub struct TextBuffer {
-    buffer: GapBuffer,
+    buffer: Storage,
 
-    undo_stack: LinkedList<SemiRefCell<HistoryEntry>>,
-    redo_stack: LinkedList<SemiRefCell<HistoryEntry>>,
+    history: History,
     last_history_type: HistoryType,
     last_save_generation: u32,
 
@@ -189,9 +332,21 @@ pub struct TextBuffer {
     // To avoid this, we cache the cursor position for rendering.
     // Must be cleared on every edit or reflow.
     cursor_for_rendering: Option<Cursor>,
+    // Line start checkpoints for seeking in large documents. Filled lazily during
+    // seeks (hence the cell) and patched on every edit.
+    line_index: SemiRefCell<LineIndex>,
+    // See `snapshot()`.
+    snapshot_cache: SemiRefCell<SnapshotCache>,
+    // Set while the line count of a freshly loaded file is still being completed.
+    line_count: Option<LineCountJob>,
+    // Set while the visual line count after a reflow is still being completed.
+    // Until then `stats.visual_lines` is a lower bound. See `poll_reflow()`.
+    reflow_pending: bool,
     selection: Option<TextBufferSelection>,
     selection_generation: u32,
     search: Option<UnsafeCell<ActiveSearch>>,
+    // All hits of the search, for highlighting them. See `set_search_highlight()`.
+    matches: Option<MatchIndex>,
 
     width: CoordType,
     margin_width: CoordType,
@@ -206,6 +361,8 @@ pub struct TextBuffer {
     newlines_are_crlf: bool,
     insert_final_newline: bool,
     overtype: bool,
+    map_large_files: bool,
+    storage_kind: StorageKind,
 
     wants_cursor_visibility: bool,
 }
@@ -222,10 +379,9 @@ impl TextBuffer {
     /// if the buffer is optimized for <1MiB contents.
     pub fn new(small: bool) -> apperr::Result<Self> {
         Ok(Self {
-            buffer: GapBuffer::new(small)?,
+            buffer: Storage::new(small)?,
 
-            undo_stack: LinkedList::new(),
-            redo_stack: LinkedList::new(),
+            history: History::new(),
             last_history_type: HistoryType::Other,
             last_save_generation: 0,
 
@@ -236,9 +392,14 @@ impl TextBuffer {
             stats: TextBufferStatistics { logical_lines: 1, visual_lines: 1 },
             cursor: Default::default(),
             cursor_for_rendering: None,
+            line_index: SemiRefCell::new(LineIndex::new()),
+            snapshot_cache: SemiRefCell::new(SnapshotCache::default()),
+            line_count: None,
+            reflow_pending: false,
             selection: None,
             selection_generation: 0,
             search: None,
+            matches: None,
 
             width: 0,
             margin_width: 0,
@@ -253,6 +414,8 @@ impl TextBuffer {
             newlines_are_crlf: cfg!(windows), // Windows users want CRLF
             insert_final_newline: false,
             overtype: false,
+            map_large_files: false,
+            storage_kind: StorageKind::Auto,
 
             wants_cursor_visibility: false,
         })
@@ -287,6 +450,29 @@ impl TextBuffer {
         self.buffer.generation()
     }
 
+    /// Like [`TextBuffer::generation`], but undo and redo don't restore earlier values.
+    /// Use this to tell if anything derived from the contents is stale.
+    pub fn revision(&self) -> u64 {
+        self.buffer.revision()
+    }
+
+    /// Returns an immutable copy of the contents, which other threads can read
+    /// while the buffer keeps changing. For ropes this only copies the list of their
+    /// chunks, which are then copied on write. Gap buffers copy their contents.
+    /// Either way, snapshots of the same contents are shared for as long as one is alive.
+    pub fn snapshot(&self) -> TextSnapshot {
+        let revision = self.buffer.revision();
+        let mut cache = self.snapshot_cache.borrow_mut();
+        if let Some(snapshot) = cache.get(revision) {
+            return snapshot;
+        }
+
+        let snapshot =
+            TextSnapshot::new(self.buffer.shared_pieces(), self.buffer.generation(), revision);
+        cache.set(&snapshot);
+        snapshot
+    }
+
     /// Force the buffer to be dirty.
     pub fn mark_as_dirty(&mut self) {
         self.last_save_generation = self.buffer.generation().wrapping_sub(1);
@@ -379,6 +565,8 @@ impl TextBuffer {
         if let Some(cursor) = &mut self.cursor_for_rendering {
             cursor.offset = cursor_for_rendering_offset;
         }
+        self.line_index.borrow_mut().clear();
+        self.matches = None;
 
         self.newlines_are_crlf = crlf;
     }
@@ -389,6 +577,167 @@ impl TextBuffer {
         self.insert_final_newline = enabled;
     }
 
+    /// If enabled, large UTF-8 files are mapped copy-on-write into the buffer
+    /// instead of being read, which makes loading them almost instant and avoids
+    /// holding the same contents in the page cache and in the buffer.
+    ///
+    /// The file must not be truncated by others while it's open, and
+    /// [`TextBuffer::detach_file`] must be called before overwriting it.
+    pub fn set_map_large_files(&mut self, enabled: bool) {
+        self.map_large_files = enabled;
+    }
+
+    /// Sets how the contents of files are stored once they're loaded with [`TextBuffer::read_file`].
+    /// [`StorageKind::Auto`] picks a rope for files larger than `ROPE_THRESHOLD`, unless they
+    /// get mapped into memory (see [`TextBuffer::set_map_large_files`]), and a gap buffer otherwise.
+    pub fn set_storage_kind(&mut self, kind: StorageKind) {
+        self.storage_kind = kind;
+    }
+
+    /// The kind of storage currently in use. Never [`StorageKind::Auto`].
+    pub fn storage_kind(&self) -> StorageKind {
+        self.buffer.kind()
+    }
+
+    /// Copies any parts of the buffer that are still mapped from the file it was
+    /// loaded from into memory, so that the file can be overwritten safely.
+    /// This also waits for the background line count, since it reads the file as well.
+    pub fn detach_file(&mut self) -> apperr::Result<()> {
+        if let Some(job) = &mut self.line_count {
+            job.wait();
+            self.poll_statistics();
+        }
+        self.buffer.detach_file()
+    }
+
+    /// Returns true while the line count of the loaded file is still incomplete.
+    /// [`TextBuffer::logical_line_count`] is a lower bound until then.
+    pub fn is_counting_lines(&self) -> bool {
+        self.line_count.is_some()
+    }
+
+    /// Returns true while the visual line count after a reflow is still incomplete.
+    /// [`TextBuffer::visual_line_count`] is a lower bound until then.
+    pub fn is_reflowing(&self) -> bool {
+        self.reflow_pending
+    }
+
+    /// Returns true while the hits for [`TextBuffer::set_search_highlight`] are still being collected.
+    /// [`TextBuffer::search_matches`] is a lower bound until then.
+    pub fn is_counting_matches(&self) -> bool {
+        self.matches.as_ref().is_some_and(|m| !m.is_complete())
+    }
+
+    /// Folds in the hits found by a background search, or searches for more of them for a limited time.
+    fn poll_matches(&mut self) {
+        if self.matches.as_ref().is_some_and(|m| m.wants_snapshot()) {
+            let snapshot = self.snapshot();
+            if let Some(m) = &mut self.matches {
+                m.resume(snapshot);
+            }
+        }
+        if let Some(m) = &mut self.matches {
+            m.poll();
+            m.step(&self.buffer, self.buffer.revision(), Instant::now() + MATCH_STEP_BUDGET);
+        }
+    }
+
+    /// Continues laying out the document after a deferred reflow, for a limited time.
+    /// This fills the line index along the way. Returns true if the visual line count changed.
+    fn poll_reflow(&mut self) -> bool {
+        if !self.reflow_pending {
+            return false;
+        }
+
+        let deadline = Instant::now() + REFLOW_STEP_BUDGET;
+        let visual_lines_before = self.stats.visual_lines;
+
+        loop {
+            let tail = self.line_index.borrow().extendable_tail();
+            let Some(tail) = tail else {
+                // The index covers the entire document. Only the last stretch is left to measure.
+                let last = self.line_index.borrow().find(|_| true);
+                let end = self.measurement_config().with_cursor(last).goto_logical(Point::MAX);
+                self.stats.visual_lines = end.visual_pos.y + 1;
+                self.reflow_pending = false;
+                break;
+            };
+
+            let next = self.line_index_next_checkpoint(tail);
+            let mut index = self.line_index.borrow_mut();
+            match next {
+                Some(c) => {
+                    index.push(c);
+                    // Each of the remaining logical lines is at least 1 row tall.
+                    let lower_bound = c.visual_pos.y + self.stats.logical_lines - c.logical_pos.y;
+                    self.stats.visual_lines = self.stats.visual_lines.max(lower_bound);
+                }
+                None => index.set_complete(),
+            }
+
+            if Instant::now() >= deadline {
+                break;
+            }
+        }
+
+        self.stats.visual_lines != visual_lines_before
+    }
+
+    /// Folds the progress of the background line count into the statistics.
+    /// Call this periodically while [`TextBuffer::is_counting_lines`] returns true.
+    /// This also continues a deferred reflow and collects search hits for highlighting.
+    /// Returns true if the line count changed.
+    pub fn poll_statistics(&mut self) -> bool {
+        self.poll_matches();
+        let reflowed = self.poll_reflow();
+
+        let Some(job) = &mut self.line_count else {
+            return reflowed;
+        };
+
+        let delta = match job.poll() {
+            LineCountStatus::Running(delta) => delta,
+            LineCountStatus::Done(delta) => {
+                self.line_count = None;
+                delta
+            }
+            LineCountStatus::Failed => {
+                // The buffer contents are authoritative, so just count them instead.
+                self.line_count = None;
+                let end = self.cursor_move_to_logical_internal(Default::default(), Point::MAX);
+                end.logical_pos.y + 1 - self.stats.logical_lines
+            }
+        };
+
+        if delta == 0 {
+            return reflowed;
+        }
+
+        // The lines were missing from the count all along, including in the statistics
+        // recorded in the history, which get restored wholesale on undo/redo.
+        let wrap = self.word_wrap_column > 0;
+        let adjust = |s: &mut TextBufferStatistics| {
+            s.logical_lines += delta;
+            if !wrap {
+                s.visual_lines += delta;
+            }
+        };
+        for entry in self.history.iter_mut() {
+            adjust(&mut entry.stats_before);
+        }
+        adjust(&mut self.stats);
+
+        // The margin may have gotten wider.
+        self.reflow(false);
+        true
+    }
+
+    /// Sets the limit for the total size of the text recorded in the undo history.
+    /// Once exceeded, the oldest entries are dropped.
+    pub fn set_history_memory_limit(&mut self, limit: usize) {
+        self.history.set_memory_limit(limit);
+    }
+
     /// Whether to insert or overtype text when writing.
     pub fn is_overtype(&self) -> bool {
         self.overtype
@@ -536,18 +885,28 @@ impl TextBuffer {
 
         if force || self.word_wrap_column > word_wrap_column {
             self.word_wrap_column = word_wrap_column;
+            // The visual positions of all checkpoints are now potentially wrong.
+            self.line_index.borrow_mut().clear();
 
             if self.cursor.offset != 0 {
                 self.cursor = self
                     .cursor_move_to_logical_internal(Default::default(), self.cursor.logical_pos);
             }
 
-            // Recalculate the line statistics.
-            if self.word_wrap_enabled {
+            // Recalculate the line statistics. The text up to the cursor (and thus usually
+            // the viewport) was just laid out above. If a lot of text follows it, we only
+            // compute a lower bound for now and let `poll_reflow()` lay out the rest.
+            self.reflow_pending = false;
+            if !self.word_wrap_enabled {
+                self.stats.visual_lines = self.stats.logical_lines;
+            } else if self.text_length() - self.cursor.offset < LAZY_REFLOW_THRESHOLD {
                 let end = self.cursor_move_to_logical_internal(self.cursor, Point::MAX);
                 self.stats.visual_lines = end.visual_pos.y + 1;
             } else {
-                self.stats.visual_lines = self.stats.logical_lines;
+                // Each of the logical lines after the cursor is at least 1 row tall.
+                self.stats.visual_lines =
+                    self.cursor.visual_pos.y + self.stats.logical_lines - self.cursor.logical_pos.y;
+                self.reflow_pending = true;
             }
         }
 
@@ -564,19 +923,21 @@ impl TextBuffer {
             let delete = self.buffer.len() - self.cursor.offset;
             if delete != 0 {
                 self.buffer.allocate_gap(self.cursor.offset, 0, delete);
+                self.line_index.borrow_mut().clear();
             }
         }
     }
 
     fn recalc_after_content_swap(&mut self) {
         // If the buffer was changed, nothing we previously saved can be relied upon.
-        self.undo_stack.clear();
-        self.redo_stack.clear();
+        self.history.clear();
         self.last_history_type = HistoryType::Other;
         self.cursor = Default::default();
         self.cursor_for_rendering = None;
         self.set_selection(None);
         self.search = None;
+        self.matches = None;
+        self.line_count = None;
         self.mark_as_clean();
         self.reflow(true);
     }
@@ -616,7 +977,12 @@ impl TextBuffer {
 
         // TODO: Since reading the file can fail, we should ensure that we also reset the cursor here.
         // I don't do it, so that `recalc_after_content_swap()` works.
-        self.buffer.clear();
+        let kind = self.storage_kind_for(file);
+        if kind != self.buffer.kind() {
+            self.buffer.reset_to(kind)?;
+        } else {
+            self.buffer.clear();
+        }
 
         let done = read == 0;
         if self.encoding == "UTF-8" {
@@ -630,6 +996,7 @@ impl TextBuffer {
         // * the newline type (LF or CRLF)
         // * the indentation type (tabs or spaces)
         // * whether there's a final newline
+        let mut line_count = None;
         {
             let chunk = self.read_forward(0);
             let mut offset = 0;
@@ -716,11 +1083,25 @@ impl TextBuffer {
             };
 
             // If the file has more than 1000 lines, figure out how many are remaining.
-            if offset < chunk.len() {
-                (_, lines) = unicode::newlines_forward(chunk, offset, lines, CoordType::MAX);
+            // Ropes keep count of them. For large files in a gap buffer that's done
+            // in the background. See `poll_statistics()`.
+            if let Some(newlines) = self.buffer.newlines() {
+                lines = newlines as CoordType;
+            } else if offset < chunk.len() {
+                let remaining = chunk.len() - offset;
+                let bom_len = if self.encoding == "UTF-8 BOM" { 3 } else { 0 };
+                if remaining >= LINE_COUNT_THRESHOLD
+                    && self.encoding.starts_with("UTF-8")
+                    && chunk.len() == self.text_length()
+                    && let Some(job) = LineCountJob::spawn(file, bom_len + offset, remaining)
+                {
+                    line_count = Some(job);
+                } else {
+                    (_, lines) = unicode::newlines_forward(chunk, offset, lines, CoordType::MAX);
+                }
             }
 
-            let final_newline = chunk.ends_with(b"\n");
+            let final_newline = self.read_backward(self.text_length()).ends_with(b"\n");
 
             // Add 1, because the last line doesn't end in a newline (it ends in the literal end).
             self.stats.logical_lines = lines + 1;
@@ -732,9 +1113,29 @@ impl TextBuffer {
         }
 
         self.recalc_after_content_swap();
+        self.line_count = line_count;
         Ok(())
     }
 
+    /// Resolves [`StorageKind::Auto`] for the file that's about to be read.
+    fn storage_kind_for(&self, file: &File) -> StorageKind {
+        match self.storage_kind {
+            StorageKind::Auto => {
+                // Mapping is cheaper than any way of reading the file.
+                if !self.map_large_files
+                    && let Ok(m) = file.metadata()
+                    && m.is_file()
+                    && m.len() as usize >= ROPE_THRESHOLD
+                {
+                    StorageKind::Rope
+                } else {
+                    StorageKind::GapBuffer
+                }
+            }
+            kind => kind,
+        }
+    }
+
     fn read_file_as_utf8(
         &mut self,
         file: &mut File,
@@ -749,6 +1150,17 @@ impl TextBuffer {
                 self.encoding = "UTF-8 BOM";
             }
 
+            // Large files without BOM can be used as-is, without reading them.
+            if self.map_large_files
+                && self.encoding == "UTF-8"
+                && let Ok(m) = file.metadata()
+                && m.is_file()
+                && m.len() as usize >= FILE_MAPPING_THRESHOLD
+                && self.buffer.map_file(file, m.len() as usize)
+            {
+                return Ok(());
+            }
+
             self.buffer.replace(0..0, first_chunk);
         }
 
@@ -783,7 +1195,8 @@ impl TextBuffer {
             }
 
             self.buffer.commit_gap(read);
-            chunk_size = extra_chunk_size;
+            // The gap may have been smaller than requested, in which case the rest follows.
+            chunk_size = chunk_size.saturating_sub(read).max(extra_chunk_size);
         }
 
         Ok(())
@@ -796,14 +1209,43 @@ impl TextBuffer {
         first_chunk_len: usize,
         mut done: bool,
     ) -> apperr::Result<()> {
+        let first_chunk = unsafe { buf[..first_chunk_len].assume_init_ref() };
+
+        // Large files are converted on multiple threads, which requires reading them entirely.
+        if !done
+            && let Ok(m) = file.metadata()
+            && m.len() as usize >= PARALLEL_TRANSCODE_THRESHOLD
+            && icu::can_convert_parallel(self.encoding, "UTF-8")
+        {
+            let mut input = Vec::with_capacity(m.len() as usize);
+            input.extend_from_slice(first_chunk);
+            file.read_to_end(&mut input)?;
+
+            let pieces = icu::convert_parallel(&[&input], self.encoding, "UTF-8")?;
+            drop(input);
+
+            // Remove the BOM, just like below.
+            let mut skip = if pieces[0].starts_with(b"\xEF\xBB\xBF") { 3 } else { 0 };
+            let mut off = 0;
+
+            for piece in &pieces {
+                let piece = &piece[skip..];
+                self.buffer.replace(off..off, piece);
+                off += piece.len();
+                skip = 0;
+            }
+
+            return Ok(());
+        }
+
         let scratch = scratch_arena(None);
-        let pivot_buffer = scratch.alloc_uninit_slice(4 * KIBI);
+        let pivot_buffer = scratch.alloc_uninit_slice(TRANSCODE_CHUNK_SIZE);
         let mut c = icu::Converter::new(pivot_buffer, self.encoding, "UTF-8")?;
-        let mut first_chunk = unsafe { buf[..first_chunk_len].assume_init_ref() };
+        let mut first_chunk = first_chunk;
 
         while !first_chunk.is_empty() {
             let off = self.text_length();
-            let gap = self.buffer.allocate_gap(off, 8 * KIBI, 0);
+            let gap = self.buffer.allocate_gap(off, 2 * TRANSCODE_CHUNK_SIZE, 0);
             let (input_advance, mut output_advance) =
                 c.convert(first_chunk, slice_as_uninit_mut(gap))?;
 
@@ -822,6 +1264,7 @@ impl TextBuffer {
             first_chunk = &first_chunk[input_advance..];
         }
 
+        let buf = scratch.alloc_uninit_slice(TRANSCODE_CHUNK_SIZE);
         let mut buf_len = 0;
 
         loop {
@@ -831,7 +1274,7 @@ impl TextBuffer {
                 done = read == 0;
             }
 
-            let gap = self.buffer.allocate_gap(self.text_length(), 8 * KIBI, 0);
+            let gap = self.buffer.allocate_gap(self.text_length(), 2 * TRANSCODE_CHUNK_SIZE, 0);
             if gap.is_empty() {
                 break;
             }
@@ -843,9 +1286,10 @@ impl TextBuffer {
 
             let flush = done && buf_len == 0;
             buf_len -= input_advance;
-            buf.copy_within(input_advance.., 0);
+            buf.copy_within(input_advance..input_advance + buf_len, 0);
 
-            if flush {
+            // Flushing may need multiple steps if the pivot buffer holds more than fits into the gap.
+            if flush && output_advance == 0 {
                 break;
             }
         }
@@ -855,20 +1299,11 @@ impl TextBuffer {
 
     /// Writes the text buffer contents to a file, handling BOM and encoding.
     pub fn write_file(&mut self, file: &mut File) -> apperr::Result<()> {
-        let mut offset = 0;
-
         if self.encoding.starts_with("UTF-8") {
-            if self.encoding == "UTF-8 BOM" {
-                file.write_all(b"\xEF\xBB\xBF")?;
-            }
-            loop {
-                let chunk = self.read_forward(offset);
-                if chunk.is_empty() {
-                    break;
-                }
-                file.write_all(chunk)?;
-                offset += chunk.len();
-            }
+            let bom: &[u8] = if self.encoding == "UTF-8 BOM" { b"\xEF\xBB\xBF" } else { b"" };
+            let mut pieces = self.buffer.pieces();
+            pieces.insert(0, bom);
+            write_pieces(file, &pieces)?;
         } else {
             self.write_file_with_icu(file)?;
         }
@@ -878,20 +1313,89 @@ impl TextBuffer {
     }
 
     fn write_file_with_icu(&mut self, file: &mut File) -> apperr::Result<()> {
-        let scratch = scratch_arena(None);
-        let pivot_buffer = scratch.alloc_uninit_slice(4 * KIBI);
-        let buf = scratch.alloc_uninit_slice(4 * KIBI);
-        let mut c = icu::Converter::new(pivot_buffer, "UTF-8", self.encoding)?;
-        let mut offset = 0;
+        let bom = self.icu_bom();
+
+        if self.text_length() >= PARALLEL_TRANSCODE_THRESHOLD
+            && icu::can_convert_parallel("UTF-8", self.encoding)
+        {
+            let mut input = self.buffer.pieces();
+            input.insert(0, bom);
+            let pieces = icu::convert_parallel(&input, "UTF-8", self.encoding)?;
+            let pieces: Vec<&[u8]> = pieces.iter().map(|p| p.as_slice()).collect();
+            return write_pieces(file, &pieces);
+        }
+
+        self.transcode_with_icu(bom, |chunk| Ok(file.write_all(chunk)?))
+    }
+
+    /// Captures the contents in the file encoding, so that they can be written
+    /// out on another thread while the buffer keeps changing.
+    /// Once they were, pass [`FileSnapshot::generation`] to [`TextBuffer::mark_as_saved`].
+    pub fn snapshot_for_writing(&self) -> apperr::Result<FileSnapshot> {
+        let generation = self.buffer.generation();
 
-        // Write the BOM for the encodings we know need it.
+        let pieces = if self.encoding.starts_with("UTF-8") {
+            // The text is already in the right encoding and can be shared with the buffer.
+            let mut pieces = self.snapshot().pieces().to_vec();
+            if self.encoding == "UTF-8 BOM" {
+                pieces.insert(0, Arc::new(b"\xEF\xBB\xBF".to_vec()));
+            }
+            pieces
+        } else if self.text_length() >= PARALLEL_TRANSCODE_THRESHOLD
+            && icu::can_convert_parallel("UTF-8", self.encoding)
+        {
+            let mut input = self.buffer.pieces();
+            input.insert(0, self.icu_bom());
+            icu::convert_parallel(&input, "UTF-8", self.encoding)?
+                .into_iter()
+                .map(Arc::new)
+                .collect()
+        } else {
+            let mut text = Vec::with_capacity(self.text_length());
+            self.transcode_with_icu(self.icu_bom(), |chunk| {
+                text.extend_from_slice(chunk);
+                Ok(())
+            })?;
+            vec![Arc::new(text)]
+        };
+
+        Ok(FileSnapshot { pieces, generation })
+    }
+
+    /// Marks the buffer as clean, if it hasn't changed since the given generation.
+    /// See [`TextBuffer::snapshot_for_writing`].
+    pub fn mark_as_saved(&mut self, generation: u32) {
+        self.last_save_generation = generation;
+    }
+
+    /// The BOM to prepend when converting to the current encoding, for the encodings we know need it.
+    fn icu_bom(&self) -> &'static [u8] {
         if self.encoding.starts_with("UTF-16")
             || self.encoding.starts_with("UTF-32")
             || self.encoding == "GB18030"
         {
-            let (_, output_advance) = c.convert(b"\xEF\xBB\xBF", buf)?;
+            b"\xEF\xBB\xBF"
+        } else {
+            b""
+        }
+    }
+
+    /// Converts `bom` and the contents to the current encoding chunk by chunk, passing each to `write`.
+    fn transcode_with_icu(
+        &self,
+        bom: &[u8],
+        mut write: impl FnMut(&[u8]) -> apperr::Result<()>,
+    ) -> apperr::Result<()> {
+        let scratch = scratch_arena(None);
+        let pivot_buffer = scratch.alloc_uninit_slice(TRANSCODE_CHUNK_SIZE);
+        let buf = scratch.alloc_uninit_slice(2 * TRANSCODE_CHUNK_SIZE);
+        let mut c = icu::Converter::new(pivot_buffer, "UTF-8", self.encoding)?;
+        let mut offset = 0;
+
+        if !bom.is_empty() {
+            let (_, output_advance) = c.convert(bom, buf)?;
             let chunk = unsafe { buf[..output_advance].assume_init_ref() };
-            file.write_all(chunk)?;
+            write(chunk)?;
         }
 
         loop {
@@ -902,7 +1406,7 @@ impl TextBuffer {
 
             let (input_advance, output_advance) = c.convert(chunk, buf)?;
             let chunk = unsafe { buf[..output_advance].assume_init_ref() };
-            file.write_all(chunk)?;
+            write(chunk)?;
             offset += input_advance;
         }
 
@@ -1049,6 +1553,43 @@ impl TextBuffer {
         Ok(())
     }
 
+    /// Highlights all occurrences of the given `pattern` during [`TextBuffer::render`]
+    /// and counts them for [`TextBuffer::search_matches`]. An empty pattern removes them.
+    /// Call this whenever the search input may have changed. It only starts over if it did.
+    ///
+    /// The hits are collected over time by [`TextBuffer::poll_statistics`].
+    pub fn set_search_highlight(&mut self, pattern: &str, options: SearchOptions) {
+        if pattern.is_empty() {
+            self.matches = None;
+            return;
+        }
+        if self.matches.as_ref().is_some_and(|m| m.is_for(pattern, options)) {
+            return;
+        }
+
+        // An invalid regex simply has no hits.
+        let engine = self.find_construct_search(pattern, options).ok().map(|s| s.engine);
+        let version = self.matches.as_ref().map_or(0, |m| m.version()) + 1;
+        self.matches = Some(MatchIndex::new(pattern, options, engine, version));
+        self.poll_matches();
+    }
+
+    /// Returns the number of hits of the [`TextBuffer::set_search_highlight`] pattern,
+    /// and which of them is selected, if any.
+    pub fn search_matches(&self) -> Option<SearchMatches> {
+        let m = self.matches.as_ref()?;
+        let ranges = m.ranges();
+
+        let current = self.selection.and_then(|TextBufferSelection { beg, end }| {
+            let start = self.cursor_move_to_logical_internal(self.cursor, beg.min(end)).offset;
+            let end = self.cursor_move_to_logical_internal(self.cursor, beg.max(end)).offset;
+            let i = ranges.partition_point(|r| r.start < start);
+            ranges.get(i).is_some_and(|r| *r == (start..end)).then_some(i + 1)
+        });
+
+        Some(SearchMatches { current, total: ranges.len(), complete: m.is_complete() })
+    }
+
     /// Find the next occurrence of the given `pattern` and replace it with `replacement`.
     pub fn find_and_replace(
         &mut self,
@@ -1074,19 +1615,55 @@ impl TextBuffer {
         options: SearchOptions,
         replacement: &str,
     ) -> apperr::Result<()> {
-        let replacement = replacement.as_bytes();
         let mut search = self.find_construct_search(pattern, options)?;
-        let mut offset = 0;
 
-        loop {
-            self.find_select_next(&mut search, offset, false);
-            if !self.has_selection() {
+        // Collect all hits up front. Since the buffer doesn't change in the meantime,
+        // the search can simply continue where it left off after each hit.
+        let mut hits = Vec::new();
+        let mut offset = 0;
+        while let Some(range) = self.find_next_hit(&mut search, offset) {
+            if range.is_empty() {
                 break;
             }
-            self.write(replacement, true);
-            offset = self.cursor.offset;
+            offset = range.end;
+            search.next_search_offset = offset;
+            hits.push(range);
         }
 
+        let (Some(first), Some(last)) = (hits.first(), hits.last()) else {
+            self.set_selection(None);
+            return Ok(());
+        };
+
+        // Translate the newlines in the replacement just like `write()` does.
+        let newline: &[u8] = if self.newlines_are_crlf { b"\r\n" } else { b"\n" };
+        let mut translated = Vec::new();
+        push_normalized_newlines(&mut translated, replacement.as_bytes(), newline);
+
+        // Build the new contents of the range spanning all hits in a single pass...
+        let mut contents =
+            Vec::with_capacity(last.end - first.start + hits.len() * translated.len());
+        let mut prev_end = first.start;
+        for hit in &hits {
+            self.buffer.extract_raw(prev_end, hit.start, &mut contents, usize::MAX);
+            contents.extend_from_slice(&translated);
+            prev_end = hit.end;
+        }
+
+        // ...and swap it in as a single edit. This results in a single undo entry
+        // and the line statistics and layout only get updated once.
+        let beg = self.cursor_move_to_offset_internal(self.cursor, first.start);
+        let end = self.cursor_move_to_offset_internal(beg, last.end);
+        self.edit_begin(HistoryType::Other, beg);
+        self.edit_delete(end);
+        if !contents.is_empty() {
+            self.edit_write(&contents);
+            self.edit_write_final_newline();
+        }
+        self.edit_end();
+
+        self.set_selection(None);
+        self.make_cursor_visible();
         Ok(())
     }
 
@@ -1099,6 +1676,26 @@ impl TextBuffer {
             return Err(apperr::Error::Icu(1)); // U_ILLEGAL_ARGUMENT_ERROR
         }
 
+        let literal = !options.use_regex && !options.whole_word;
+        if literal && (options.match_case || pattern.is_ascii()) {
+            let fold = !options.match_case;
+            let needle = if fold {
+                pattern.as_bytes().to_ascii_lowercase()
+            } else {
+                pattern.as_bytes().to_vec()
+            };
+
+            return Ok(ActiveSearch {
+                pattern: pattern.to_string(),
+                options,
+                engine: SearchEngine::Literal(LiteralSearch { needle, fold }),
+                buffer_revision: self.buffer.revision(),
+                selection_generation: 0,
+                next_search_offset: 0,
+                no_matches: false,
+            });
+        }
+
         let sanitized_pattern = if options.whole_word && options.use_regex {
             Cow::Owned(format!(r"\b(?:{pattern})\b"))
         } else if options.whole_word {
@@ -1141,9 +1738,8 @@ impl TextBuffer {
         Ok(ActiveSearch {
             pattern: pattern.to_string(),
             options,
-            text,
-            regex,
-            buffer_generation: self.buffer.generation(),
+            engine: SearchEngine::Icu { text, regex },
+            buffer_revision: self.buffer.revision(),
             selection_generation: 0,
             next_search_offset: 0,
             no_matches: false,
@@ -1151,23 +1747,12 @@ impl TextBuffer {
     }
 
     fn find_select_next(&mut self, search: &mut ActiveSearch, offset: usize, wrap: bool) {
-        if search.buffer_generation != self.buffer.generation() {
-            unsafe { search.regex.set_text(&mut search.text, offset) };
-            search.buffer_generation = self.buffer.generation();
-            search.next_search_offset = offset;
-        } else if search.next_search_offset != offset {
-            search.next_search_offset = offset;
-            search.regex.reset(offset);
-        }
-
-        let mut hit = search.regex.next();
+        let mut hit = self.find_next_hit(search, offset);
 
         // If we hit the end of the buffer, and we know that there's something to find,
         // start the search again from the beginning (= wrap around).
         if wrap && hit.is_none() && search.next_search_offset != 0 {
-            search.next_search_offset = 0;
-            search.regex.reset(0);
-            hit = search.regex.next();
+            hit = self.find_next_hit(search, 0);
         }
 
         search.selection_generation = if let Some(range) = hit {
@@ -1191,13 +1776,114 @@ impl TextBuffer {
         };
     }
 
+    /// Returns the range of the next hit at or after `offset`.
+    fn find_next_hit(&self, search: &mut ActiveSearch, offset: usize) -> Option<Range<usize>> {
+        match &mut search.engine {
+            SearchEngine::Literal(literal) => {
+                search.next_search_offset = offset;
+                literal.find(&self.buffer, offset)
+            }
+            SearchEngine::Icu { text, regex } => {
+                if search.buffer_revision != self.buffer.revision() {
+                    unsafe { regex.set_text(text, offset) };
+                    search.buffer_revision = self.buffer.revision();
+                    search.next_search_offset = offset;
+                } else if search.next_search_offset != offset {
+                    search.next_search_offset = offset;
+                    regex.reset(offset);
+                }
+                regex.next()
+            }
+        }
+    }
+
     fn measurement_config(&self) -> MeasurementConfig {
         MeasurementConfig::new(&self.buffer)
             .with_word_wrap_column(self.word_wrap_column)
             .with_tab_size(self.tab_size)
     }
 
+    /// Returns the last line index checkpoint for which `before` returns true.
+    /// The index is extended as needed, so that the checkpoint is close to the target.
+    fn line_index_find(&self, before: impl Fn(&Cursor) -> bool) -> Cursor {
+        let mut index = self.line_index.borrow_mut();
+        while let Some(tail) = index.extendable_tail()
+            && before(&tail)
+        {
+            match self.line_index_next_checkpoint(tail) {
+                Some(checkpoint) => index.push(checkpoint),
+                None => index.set_complete(),
+            }
+        }
+        index.find(before)
+    }
+
+    /// Finds the line start at or before `tail.offset + CHECKPOINT_INTERVAL`,
+    /// or if that line started before `tail`, the next line start after it.
+    fn line_index_next_checkpoint(&self, tail: Cursor) -> Option<Cursor> {
+        let target = tail.offset + CHECKPOINT_INTERVAL;
+        if target >= self.text_length() {
+            return None;
+        }
+
+        let mut offset = tail.offset;
+        let mut line = tail.logical_pos.y;
+
+        // Count the newlines up to the target.
+        while offset < target {
+            let chunk = self.read_forward(offset);
+            let chunk = &chunk[..chunk.len().min(target - offset)];
+            (_, line) = unicode::newlines_forward(chunk, 0, line, CoordType::MAX);
+            offset += chunk.len();
+        }
+
+        if line > tail.logical_pos.y {
+            // Seek back to the start of the line that contains the target.
+            loop {
+                let chunk = self.read_backward(offset);
+                let (delta, _) = unicode::newlines_backward(chunk, chunk.len(), line, line);
+                offset -= chunk.len() - delta;
+                if delta > 0 {
+                    break;
+                }
+            }
+        } else {
+            // The line is longer than the interval. Seek forward to the next line start.
+            loop {
+                let chunk = self.read_forward(offset);
+                if chunk.is_empty() {
+                    return None;
+                }
+                let (delta, next) = unicode::newlines_forward(chunk, 0, line, line + 1);
+                offset += delta;
+                if next > line {
+                    line = next;
+                    break;
+                }
+            }
+        }
+
+        let pos = Point { x: 0, y: line };
+        if self.word_wrap_column > 0 {
+            let checkpoint = self.measurement_config().with_cursor(tail).goto_logical(pos);
+            debug_assert_eq!(checkpoint.offset, offset);
+            Some(checkpoint)
+        } else {
+            Some(Cursor { offset, logical_pos: pos, visual_pos: pos, column: 0, wrap_opp: false })
+        }
+    }
+
     fn goto_line_start(&self, cursor: Cursor, y: CoordType) -> Cursor {
+        // For long distances it's faster to walk from the closest checkpoint.
+        let cursor = {
+            let checkpoint = self.line_index_find(|c| c.logical_pos.y <= y);
+            if y - checkpoint.logical_pos.y < (y - cursor.logical_pos.y).abs() {
+                checkpoint
+            } else {
+                cursor
+            }
+        };
+
         let mut result = cursor;
         let mut seek_to_line_start = true;
 
@@ -1286,6 +1972,11 @@ impl TextBuffer {
             return cursor;
         }
 
+        let checkpoint = self.line_index_find(|c| c.offset <= offset);
+        if offset - checkpoint.offset < offset.abs_diff(cursor.offset) {
+            cursor = checkpoint;
+        }
+
         // goto_line_start() is fast for seeking across lines _if_ line wrapping is disabled.
         // For backward seeking we have to use it either way, so we're covered there.
         // This implements the forward seeking portion, if it's approx. worth doing so.
@@ -1341,6 +2032,11 @@ impl TextBuffer {
                 cursor = self.goto_line_start(cursor, pos.y);
             }
         } else {
+            let checkpoint = self.line_index_find(|c| c.visual_pos.y <= pos.y);
+            if pos.y - checkpoint.visual_pos.y < (pos.y - cursor.visual_pos.y).abs() {
+                cursor = checkpoint;
+            }
+
             // `goto_visual()` can only seek forward, so we need to seek backward here if needed.
             // NOTE that this intentionally doesn't use the `Eq` trait of `Point`, because if
             // `pos.y == cursor.visual_pos.y` we don't need to go to `cursor.logical_pos.y - 1`.
@@ -1476,11 +2172,13 @@ impl TextBuffer {
             cursor.offset <= self.text_length()
                 && cursor.logical_pos.x >= 0
                 && cursor.logical_pos.y >= 0
-                && cursor.logical_pos.y <= self.stats.logical_lines
+                && (self.line_count.is_some() || cursor.logical_pos.y <= self.stats.logical_lines)
                 && cursor.visual_pos.x >= 0
                 && (self.word_wrap_column <= 0 || cursor.visual_pos.x <= self.word_wrap_column)
                 && cursor.visual_pos.y >= 0
-                && cursor.visual_pos.y <= self.stats.visual_lines
+                && (self.line_count.is_some()
+                    || self.reflow_pending
+                    || cursor.visual_pos.y <= self.stats.visual_lines)
         );
         self.cursor = cursor;
     }
@@ -1499,6 +2197,7 @@ impl TextBuffer {
             return None;
         }
 
+        let _span = trace::span("TextBuffer::render");
         let scratch = scratch_arena(None);
         let width = destination.width();
         let height = destination.height();
@@ -1665,6 +2364,43 @@ impl TextBuffer {
 
             fb.replace_text(destination.top + y, destination.left, destination.right, &line);
 
+            // Highlight the search hits on this line, if any.
+            if let Some(m) = &self.matches
+                && cursor_beg.visual_pos.y == visual_line
+                && cursor_beg.offset != cursor_end.offset
+            {
+                let ranges = m.ranges();
+                let left = destination.left + self.margin_width - origin.x;
+                let top = destination.top + y;
+                let bg = fb.indexed_alpha(IndexedColor::BrightYellow, 1, 3);
+                let mut i = ranges.partition_point(|r| r.end <= cursor_beg.offset);
+                let mut cursor = cursor_beg;
+
+                while let Some(r) = ranges.get(i)
+                    && r.start < cursor_end.offset
+                {
+                    cursor =
+                        self.cursor_move_to_offset_internal(cursor, r.start.max(cursor.offset));
+                    let beg = cursor.visual_pos.x.max(origin.x);
+                    // Hits that continue on the next line are highlighted up to the edge.
+                    let end = if r.end > cursor_end.offset {
+                        COORD_TYPE_SAFE_MAX
+                    } else {
+                        cursor = self.cursor_move_to_offset_internal(cursor, r.end);
+                        cursor.visual_pos.x
+                    };
+                    let end = end.min(origin.x + text_width);
+
+                    if beg < end {
+                        fb.blend_bg(
+                            Rect { left: left + beg, top, right: left + end, bottom: top + 1 },
+                            bg,
+                        );
+                    }
+                    i += 1;
+                }
+            }
+
             // Draw the selection on this line, if any.
             // FYI: `cursor_beg.visual_pos.y == visual_line` is necessary as the `visual_line`
             // may be past the end of the document, and so it may not receive a highlight.
@@ -1737,47 +2473,98 @@ impl TextBuffer {
             }
         }
 
-        if focused {
-            let mut x = self.cursor.visual_pos.x;
-            let mut y = self.cursor.visual_pos.y;
+        self.render_cursor(origin, destination, focused, fb);
 
-            if self.word_wrap_column > 0 && x >= self.word_wrap_column {
-                // The line the cursor is on wraps exactly on the word wrap column which
-                // means the cursor is invisible. We need to move it to the next line.
-                x = 0;
-                y += 1;
-            }
+        Some(RenderResult { visual_pos_x_max })
+    }
 
-            // Move the cursor into screen space.
-            x += destination.left - origin.x + self.margin_width;
-            y += destination.top - origin.y;
+    /// Places the cursor in the framebuffer, the same way [`TextBuffer::render`] does.
+    ///
+    /// Use this instead of `render` if the framebuffer contents of the `destination`
+    /// are known to be unchanged, but the cursor still needs to be shown.
+    pub fn render_cursor(
+        &self,
+        origin: Point,
+        destination: Rect,
+        focused: bool,
+        fb: &mut Framebuffer,
+    ) {
+        if !focused || destination.is_empty() {
+            return;
+        }
 
-            let cursor = Point { x, y };
-            let text = Rect {
-                left: destination.left + self.margin_width,
-                top: destination.top,
-                right: destination.right,
-                bottom: destination.bottom,
-            };
+        let [selection_beg, selection_end] = match self.selection {
+            None => [Point::MIN, Point::MIN],
+            Some(TextBufferSelection { beg, end }) => minmax(beg, end),
+        };
 
-            if text.contains(cursor) {
-                fb.set_cursor(cursor, self.overtype);
+        let mut x = self.cursor.visual_pos.x;
+        let mut y = self.cursor.visual_pos.y;
 
-                if self.line_highlight_enabled && selection_beg >= selection_end {
-                    fb.blend_bg(
-                        Rect {
-                            left: destination.left,
-                            top: cursor.y,
-                            right: destination.right,
-                            bottom: cursor.y + 1,
-                        },
-                        0x50282828,
-                    );
-                }
+        if self.word_wrap_column > 0 && x >= self.word_wrap_column {
+            // The line the cursor is on wraps exactly on the word wrap column which
+            // means the cursor is invisible. We need to move it to the next line.
+            x = 0;
+            y += 1;
+        }
+
+        // Move the cursor into screen space.
+        x += destination.left - origin.x + self.margin_width;
+        y += destination.top - origin.y;
+
+        let cursor = Point { x, y };
+        let text = Rect {
+            left: destination.left + self.margin_width,
+            top: destination.top,
+            right: destination.right,
+            bottom: destination.bottom,
+        };
+
+        if text.contains(cursor) {
+            fb.set_cursor(cursor, self.overtype);
+
+            if self.line_highlight_enabled && selection_beg >= selection_end {
+                fb.blend_bg(
+                    Rect {
+                        left: destination.left,
+                        top: cursor.y,
+                        right: destination.right,
+                        bottom: cursor.y + 1,
+                    },
+                    0x50282828,
+                );
             }
         }
+    }
 
-        Some(RenderResult { visual_pos_x_max })
+    /// Returns a hash of the state that [`TextBuffer::render`] depends on,
+    /// apart from its parameters and the cursor. If it's unchanged between
+    /// two frames, then so is the rendered text, except for the cursor.
+    pub fn render_fingerprint(&self) -> u64 {
+        let (sel_beg, sel_end) = match self.selection {
+            None => (Point::MIN, Point::MIN),
+            Some(TextBufferSelection { beg, end }) => (beg, end),
+        };
+        // The line highlight follows the cursor.
+        let highlight =
+            if self.line_highlight_enabled { self.cursor.visual_pos } else { Point::MIN };
+        let state = [
+            self.buffer.revision() as i64,
+            self.stats.logical_lines as i64,
+            self.stats.visual_lines as i64,
+            sel_beg.x as i64,
+            sel_beg.y as i64,
+            sel_end.x as i64,
+            sel_end.y as i64,
+            self.margin_width as i64,
+            self.word_wrap_column as i64,
+            self.tab_size as i64,
+            self.ruler as i64,
+            highlight.x as i64,
+            highlight.y as i64,
+            self.matches.as_ref().map_or(0, |m| m.version()) as i64,
+        ];
+        state.iter().fold(0, |h, v| hash::hash(h, &v.to_ne_bytes()))
     }
 
     /// Inserts `text` at the current cursor position.
@@ -1798,6 +2585,15 @@ impl TextBuffer {
             self.edit_begin(HistoryType::Write, self.cursor);
         }
 
+        if raw {
+            // Pastes can be huge and are taken literally, apart from their newlines.
+            // Writing them line by line would add another edit per line.
+            self.edit_write_normalized(text);
+            self.edit_write_final_newline();
+            self.edit_end();
+            return;
+        }
+
         let mut offset = 0;
         let scratch = scratch_arena(None);
         let mut newline_buffer = ArenaString::new_in(&scratch);
@@ -1910,12 +2706,17 @@ impl TextBuffer {
             }
         }
 
-        // POSIX mandates that all valid lines end in a newline.
-        // This isn't all that common on Windows and so we have
-        // `self.final_newline` to control this.
-        //
-        // In order to not annoy people with this, we only add a
-        // newline if you just edited the very end of the buffer.
+        self.edit_write_final_newline();
+        self.edit_end();
+    }
+
+    /// POSIX mandates that all valid lines end in a newline.
+    /// This isn't all that common on Windows and so we have
+    /// `self.final_newline` to control this.
+    ///
+    /// In order to not annoy people with this, we only add a
+    /// newline if you just edited the very end of the buffer.
+    fn edit_write_final_newline(&mut self) {
         if self.insert_final_newline
             && self.cursor.offset > 0
             && self.cursor.offset == self.text_length()
@@ -1925,8 +2726,6 @@ impl TextBuffer {
             self.edit_write(if self.newlines_are_crlf { b"\r\n" } else { b"\n" });
             self.set_cursor_internal(cursor);
         }
-
-        self.edit_end();
     }
 
     /// Deletes 1 grapheme cluster from the buffer.
@@ -2145,26 +2944,28 @@ impl TextBuffer {
 
         let cursor_before = self.cursor;
         self.set_cursor_internal(cursor);
+        self.line_index.borrow_mut().edit_begin(
+            cursor.offset,
+            self.text_length(),
+            self.stats.logical_lines,
+            self.stats.visual_lines,
+        );
+        if let Some(m) = &mut self.matches {
+            m.edit_begin(cursor.offset, self.buffer.len());
+        }
 
         // If both the last and this are a Write/Delete operation, we skip allocating a new undo history item.
         if history_type != self.last_history_type
             || !matches!(history_type, HistoryType::Write | HistoryType::Delete)
         {
-            self.redo_stack.clear();
-            while self.undo_stack.len() > 1000 {
-                self.undo_stack.pop_front();
-            }
-
             self.last_history_type = history_type;
-            self.undo_stack.push_back(SemiRefCell::new(HistoryEntry {
-                cursor_before: cursor_before.logical_pos,
-                selection_before: self.selection,
-                stats_before: self.stats,
-                generation_before: self.buffer.generation(),
-                cursor: cursor.logical_pos,
-                deleted: Vec::new(),
-                added: Vec::new(),
-            }));
+            self.history.push(HistoryEntry::new(
+                cursor_before.logical_pos,
+                self.selection,
+                self.stats,
+                self.buffer.generation(),
+                cursor.logical_pos,
+            ));
         }
 
         self.active_edit_off = cursor.offset;
@@ -2182,7 +2983,7 @@ impl TextBuffer {
             self.active_edit_line_info = Some(ActiveEditLineInfo {
                 safe_start,
                 line_height_in_rows: next_line.visual_pos.y - safe_start.visual_pos.y,
-                distance_next_line_start: next_line.offset - cursor.offset,
+                next_line_start: next_line.offset,
             });
         }
     }
@@ -2190,20 +2991,36 @@ impl TextBuffer {
     /// Writes `text` into the buffer at the current cursor position.
     /// It records the change in the undo stack.
     fn edit_write(&mut self, text: &[u8]) {
-        let logical_y_before = self.cursor.logical_pos.y;
-
         // Copy the written portion into the undo entry.
-        {
-            let mut undo = self.undo_stack.back_mut().unwrap().borrow_mut();
-            undo.added.extend_from_slice(text);
-        }
+        self.history.push_added(text);
 
         // Write!
         self.buffer.replace(self.active_edit_off..self.active_edit_off, text);
+        self.edit_write_advance(text.len());
+    }
+
+    /// Like [`TextBuffer::edit_write`], but translates CR, LF and CRLF into the buffer's newlines.
+    /// The text is translated straight into the undo entry, and copied from there into the buffer.
+    fn edit_write_normalized(&mut self, text: &[u8]) {
+        let newline: &[u8] = if self.newlines_are_crlf { b"\r\n" } else { b"\n" };
+        let added =
+            self.history.push_added_with(|out| push_normalized_newlines(out, text, newline));
+        let len = added.len();
+        self.buffer.replace(self.active_edit_off..self.active_edit_off, added);
+        self.edit_write_advance(len);
+    }
+
+    /// Moves the cursor past the `len` bytes that were just written at it.
+    fn edit_write_advance(&mut self, len: usize) {
+        let logical_y_before = self.cursor.logical_pos.y;
+
+        if let Some(info) = &mut self.active_edit_line_info {
+            info.next_line_start += len;
+        }
 
         // Move self.cursor to the end of the newly written text. Can't use `self.set_cursor_internal`,
         // because we're still in the progress of recalculating the line stats.
-        self.active_edit_off += text.len();
+        self.active_edit_off += len;
         self.cursor = self.cursor_move_to_offset_internal(self.cursor, self.active_edit_off);
         self.stats.logical_lines += self.cursor.logical_pos.y - logical_y_before;
     }
@@ -2215,21 +3032,46 @@ impl TextBuffer {
 
         let logical_y_before = self.cursor.logical_pos.y;
         let off = self.active_edit_off;
-        let mut out_off = usize::MAX;
 
-        let mut undo = self.undo_stack.back_mut().unwrap().borrow_mut();
-        if self.cursor.logical_pos < undo.cursor {
-            out_off = 0; // Prepend the deleted portion.
+        let undo = self.history.last_mut();
+        let prepend = self.cursor.logical_pos < undo.cursor;
+        if prepend {
             undo.cursor = self.cursor.logical_pos; // Note the start of the deleted portion.
         }
 
         // Copy the deleted portion into the undo entry.
-        let deleted = &mut undo.deleted;
-        self.buffer.extract_raw(off, to.offset, deleted, out_off);
+        let buffer = &self.buffer;
+        self.history.push_deleted(prepend, |out, out_off| {
+            buffer.extract_raw(off, to.offset, out, out_off);
+        });
+
+        // If the deletion reaches into the lines after the edited one, they get joined with it.
+        // Their height needs to be measured now, while they're still intact.
+        if let Some(next_line_start) =
+            self.active_edit_line_info.as_ref().map(|i| i.next_line_start)
+            && to.offset >= next_line_start
+        {
+            let mut config = self
+                .measurement_config()
+                .with_cursor(Cursor { offset: next_line_start, ..Default::default() });
+            let y = config.goto_offset(to.offset).logical_pos.y;
+            let next_line = config.goto_logical(Point { x: 0, y: y + 1 });
+
+            let info = self.active_edit_line_info.as_mut().unwrap();
+            info.line_height_in_rows += next_line.visual_pos.y;
+            info.next_line_start = next_line.offset;
+        }
 
         // Delete the portion from the buffer by enlarging the gap.
         let count = to.offset - off;
         self.buffer.allocate_gap(off, 0, count);
+        self.line_index.borrow_mut().edit_delete(count);
+        if let Some(m) = &mut self.matches {
+            m.edit_delete(count);
+        }
+        if let Some(info) = &mut self.active_edit_line_info {
+            info.next_line_start -= count;
+        }
 
         self.stats.logical_lines += logical_y_before - to.logical_pos.y;
     }
@@ -2245,41 +3087,45 @@ impl TextBuffer {
 
         #[cfg(debug_assertions)]
         {
-            let entry = self.undo_stack.back_mut().unwrap().borrow_mut();
-            debug_assert!(!entry.deleted.is_empty() || !entry.added.is_empty());
+            let entry = self.history.last_mut();
+            debug_assert!(entry.deleted_len() != 0 || entry.added_len() != 0);
         }
 
         if let Some(info) = self.active_edit_line_info.take() {
-            let deleted_count = self.undo_stack.back_mut().unwrap().borrow_mut().deleted.len();
             let target = self.cursor.logical_pos;
 
             // From our safe position we can measure the actual visual position of the cursor.
             self.set_cursor_internal(self.cursor_move_to_logical_internal(info.safe_start, target));
 
-            // If content is added at the insertion position, that's not a problem:
-            // We can just remeasure the height of this one line and calculate the delta.
-            // `deleted_count` is 0 in this case.
-            //
-            // The problem is when content is deleted, because it may affect lines
-            // beyond the end of the `next_line`. In that case we have to measure
-            // the entire buffer contents until the end to compute `self.stats.visual_lines`.
-            if deleted_count < info.distance_next_line_start {
-                // Now we can measure how many more visual rows this logical line spans.
-                let next_line = self
-                    .cursor_move_to_logical_internal(self.cursor, Point { x: 0, y: target.y + 1 });
-                let lines_before = info.line_height_in_rows;
-                let lines_after = next_line.visual_pos.y - info.safe_start.visual_pos.y;
-                self.stats.visual_lines += lines_after - lines_before;
-            } else {
-                let end = self.cursor_move_to_logical_internal(self.cursor, Point::MAX);
-                self.stats.visual_lines = end.visual_pos.y + 1;
-            }
+            // Now we can measure how many more visual rows the edited lines span. Everything
+            // past them keeps its layout, because word wrap doesn't cross logical lines.
+            let next_line =
+                self.cursor_move_to_logical_internal(self.cursor, Point { x: 0, y: target.y + 1 });
+            debug_assert_eq!(next_line.offset, info.next_line_start);
+            let lines_before = info.line_height_in_rows;
+            let lines_after = next_line.visual_pos.y - info.safe_start.visual_pos.y;
+            self.stats.visual_lines += lines_after - lines_before;
         } else {
             // If word-wrap is disabled the visual line count always matches the logical one.
             self.stats.visual_lines = self.stats.logical_lines;
         }
 
-        self.search = None;
+        self.line_index.borrow_mut().edit_end(
+            self.text_length(),
+            self.stats.logical_lines,
+            Some(self.stats.visual_lines),
+        );
+        if let Some(m) = &mut self.matches {
+            m.edit_end(&self.buffer, self.buffer.len());
+        }
+        // Keep the compiled search, but forget where it was, as if it was just constructed.
+        // The ICU regex gets pointed at the new contents via `buffer_revision`.
+        if let Some(search) = &mut self.search {
+            let search = search.get_mut();
+            search.selection_generation = 0;
+            search.next_search_offset = 0;
+            search.no_matches = false;
+        }
 
         // Also takes care of clearing `cursor_for_rendering`.
         self.reflow(false);
@@ -2296,28 +3142,13 @@ impl TextBuffer {
     }
 
     fn undo_redo(&mut self, undo: bool) {
-        // Transfer the last entry from the undo stack to the redo stack or vice versa.
-        {
-            let (from, to) = if undo {
-                (&mut self.undo_stack, &mut self.redo_stack)
-            } else {
-                (&mut self.redo_stack, &mut self.undo_stack)
-            };
-
-            let Some(list) = from.cursor_back_mut().remove_current_as_list() else {
-                return;
-            };
-
-            to.cursor_back_mut().splice_after(list);
-        }
-
-        let change = {
-            let to = if undo { &self.redo_stack } else { &self.undo_stack };
-            to.back().unwrap()
+        let Some(index) = self.history.step(undo) else {
+            return;
         };
+        let mut change = *self.history.entry_mut(index);
 
         // Move to the point where the modification took place.
-        let cursor = self.cursor_move_to_logical_internal(self.cursor, change.borrow().cursor);
+        let cursor = self.cursor_move_to_logical_internal(self.cursor, change.cursor);
 
         let safe_cursor = if self.word_wrap_column > 0 {
             // If word-wrap is enabled, we need to move the cursor to the beginning of the line.
@@ -2329,18 +3160,29 @@ impl TextBuffer {
 
         {
             let buffer_generation = self.buffer.generation();
-            let mut change = change.borrow_mut();
-            let change = &mut *change;
 
-            // Undo: Whatever was deleted is now added and vice versa.
-            mem::swap(&mut change.deleted, &mut change.added);
+            // Undo: Whatever was added is removed and whatever was deleted is reinserted.
+            // Redo: The other way around.
+            let (removed_len, added) = self.history.payload(index, undo);
 
             // Delete the inserted portion.
-            self.buffer.allocate_gap(cursor.offset, 0, change.deleted.len());
+            self.line_index.borrow_mut().edit_begin(
+                cursor.offset,
+                self.text_length(),
+                self.stats.logical_lines,
+                self.stats.visual_lines,
+            );
+            if let Some(m) = &mut self.matches {
+                m.edit_begin(cursor.offset, self.buffer.len());
+            }
+            self.buffer.allocate_gap(cursor.offset, 0, removed_len);
+            self.line_index.borrow_mut().edit_delete(removed_len);
+            if let Some(m) = &mut self.matches {
+                m.edit_delete(removed_len);
+            }
 
             // Reinsert the deleted portion.
             {
-                let added = &change.added[..];
                 let mut beg = 0;
                 let mut offset = cursor.offset;
 
@@ -2377,6 +3219,17 @@ impl TextBuffer {
             // Restore the previous line statistics.
             mem::swap(&mut self.stats, &mut change.stats_before);
 
+            // The restored visual line count is only accurate if the layout didn't change
+            // since the entry was recorded. Let the index re-measure the checkpoints instead.
+            self.line_index.borrow_mut().edit_end(
+                self.text_length(),
+                self.stats.logical_lines,
+                (self.word_wrap_column <= 0).then_some(self.stats.visual_lines),
+            );
+            if let Some(m) = &mut self.matches {
+                m.edit_end(&self.buffer, self.buffer.len());
+            }
+
             // Restore the previous selection.
             mem::swap(&mut self.selection, &mut change.selection_before);
 
@@ -2391,9 +3244,11 @@ impl TextBuffer {
             // Can't use `set_cursor_internal` here, because we haven't updated the line stats yet.
             self.cursor = cursor_before;
 
-            if self.undo_stack.is_empty() {
-                self.last_history_type = HistoryType::Other;
-            }
+            *self.history.entry_mut(index) = change;
+
+            // New edits must not be merged into the entry before this one,
+            // because only the most recent entry can be extended.
+            self.last_history_type = HistoryType::Other;
         }
 
         // Also takes care of clearing `cursor_for_rendering`.
@@ -2448,3 +3303,71 @@ fn detect_bom(bytes: &[u8]) -> Option<&'static str> {
     }
     None
 }
+
+/// Appends `text` to `out`, with each CR, LF and CRLF replaced by `newline`.
+fn push_normalized_newlines(out: &mut Vec<u8>, text: &[u8], newline: &[u8]) {
+    out.reserve(text.len());
+
+    let mut off = 0;
+    while off < text.len() {
+        let nl = memchr2(b'\r', b'\n', text, off);
+        out.extend_from_slice(&text[off..nl]);
+        if nl >= text.len() {
+            break;
+        }
+
+        out.extend_from_slice(newline);
+        off = nl + 1;
+        if text[nl] == b'\r' && text.get(off) == Some(&b'\n') {
+            off += 1;
+        }
+    }
+}
+
+/// Writes `pieces` to `file` in as few system calls as possible,
+/// after reserving the disk space for all of them.
+fn write_pieces(file: &mut File, pieces: &[&[u8]]) -> apperr::Result<()> {
+    let len: usize = pieces.iter().map(|p| p.len()).sum();
+    sys::file_preallocate(file, len as u64)?;
+
+    let mut slices: Vec<IoSlice> = pieces.iter().map(|p| IoSlice::new(p)).collect();
+    file.write_all_vectored(&mut slices)?;
+    Ok(())
+}
+
+#[cfg(test)]
+mod test {
+    use super::*;
+
+    #[test]
+    fn test_push_normalized_newlines() {
+        let mut out = Vec::new();
+        push_normalized_newlines(&mut out, b"a\rb\nc\r\n\r\rd\n\r", b"\r\n");
+        assert_eq!(out, b"a\r\nb\r\nc\r\n\r\n\r\nd\r\n\r\n");
+
+        out.clear();
+        push_normalized_newlines(&mut out, b"\r\na\r\r\nb", b"\n");
+        assert_eq!(out, b"\na\n\nb");
+    }
+
+    #[test]
+    fn test_undo_long_line_in_rope() {
+        // Undo reinserts the deleted text one line at a time, and this line is far larger
+        // than the rope's chunks. All of it must come back.
+        let mut tb = TextBuffer::new(false).unwrap();
+        tb.buffer.reset_to(StorageKind::Rope).unwrap();
+        let text = format!("{}\n", "abc".repeat(MEBI));
+        tb.write(text.as_bytes(), true);
+
+        tb.select_all();
+        tb.delete(CursorMovement::Grapheme, 1);
+        assert_eq!(tb.text_length(), 0);
+
+        tb.undo();
+        let mut restored = Vec::new();
+        while restored.len() < tb.text_length() {
+            restored.extend_from_slice(tb.read_forward(restored.len()));
+        }
+        assert_eq!(restored, text.as_bytes());
+    }
+}
@@ -0,0 +1,213 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+//! Recycles the memory of dropped [`GapBuffer`]s for new ones.
+//!
+//! Large buffers reserve gigabytes of address space each, and small ones are created
+//! and dropped all the time by the UI (e.g. for editlines). Instead of returning their
+//! memory to the OS right away, a few of them are kept around with the first pages
+//! still committed, and handed out again most recently used first.
+//!
+//! Buffers can't be sent to other threads, so the pools are thread-local.
+//!
+//! [`GapBuffer`]: super::gap_buffer::GapBuffer
+
+use std::cell::RefCell;
+use std::ptr::NonNull;
+
+use crate::helpers::*;
+use crate::sys;
+
+/// The number of large buffers kept around. Each of them holds
+/// on to [`LARGE_RETAIN_COMMIT`] bytes and its address space reservation.
+#[cfg(target_pointer_width = "32")]
+const LARGE_POOL_LEN: usize = 1;
+#[cfg(target_pointer_width = "64")]
+const LARGE_POOL_LEN: usize = 8;
+/// Large buffers keep this much memory committed while they're pooled.
+const LARGE_RETAIN_COMMIT: usize = MEBI;
+
+/// The number of small buffers kept around.
+const SMALL_POOL_LEN: usize = 32;
+/// Small buffers keep at most this much of their capacity while they're pooled.
+const SMALL_RETAIN_COMMIT: usize = 16 * KIBI;
+
+/// The statistics of one of the pools. See [`pool_stats`].
+#[derive(Clone, Copy, Default, Debug, PartialEq, Eq)]
+pub struct PoolStats {
+    /// The number of buffers that were taken from the pool.
+    pub hits: usize,
+    /// The number of buffers that had to be allocated, because the pool was empty.
+    pub misses: usize,
+    /// The number of buffers released to the OS, because the pool was full.
+    pub evictions: usize,
+    /// The number of buffers currently in the pool.
+    pub len: usize,
+    /// The memory they have committed.
+    pub committed: usize,
+}
+
+/// See [`pool_stats`].
+#[derive(Clone, Copy, Default, Debug)]
+pub struct BufferPoolStats {
+    /// Buffers backed by virtual memory.
+    pub large: PoolStats,
+    /// Buffers backed by a `Vec`.
+    pub small: PoolStats,
+}
+
+/// A reserved virtual memory region.
+struct Region {
+    ptr: NonNull<u8>,
+    reserve: usize,
+}
+
+impl Drop for Region {
+    fn drop(&mut self) {
+        unsafe { sys::virtual_release(self.ptr, self.reserve) };
+    }
+}
+
+/// A most-recently-used list of items and the amount of memory they have committed.
+struct Pool<T> {
+    items: Vec<(T, usize)>,
+    cap: usize,
+    stats: PoolStats,
+}
+
+impl<T> Pool<T> {
+    const fn new(cap: usize) -> Self {
+        Self {
+            items: Vec::new(),
+            cap,
+            stats: PoolStats { hits: 0, misses: 0, evictions: 0, len: 0, committed: 0 },
+        }
+    }
+
+    /// Takes the most recently returned item, along with its committed size.
+    fn take(&mut self) -> Option<(T, usize)> {
+        let item = self.items.pop();
+        match &item {
+            Some((_, committed)) => {
+                self.stats.hits += 1;
+                self.stats.committed -= committed;
+            }
+            None => self.stats.misses += 1,
+        }
+        self.stats.len = self.items.len();
+        item
+    }
+
+    /// Returns an item to the pool. If it's full, the least recently used one is returned.
+    fn put(&mut self, item: T, committed: usize) -> Option<T> {
+        let evicted = if self.items.len() >= self.cap {
+            let (evicted, evicted_committed) = self.items.remove(0);
+            self.stats.evictions += 1;
+            self.stats.committed -= evicted_committed;
+            Some(evicted)
+        } else {
+            None
+        };
+
+        self.items.push((item, committed));
+        self.stats.committed += committed;
+        self.stats.len = self.items.len();
+        evicted
+    }
+}
+
+thread_local! {
+    static LARGE: RefCell<Pool<Region>> = const { RefCell::new(Pool::new(LARGE_POOL_LEN)) };
+    static SMALL: RefCell<Pool<Vec<u8>>> = const { RefCell::new(Pool::new(SMALL_POOL_LEN)) };
+}
+
+/// Takes a previously used region with the given reservation size.
+/// Returns its base address and the number of bytes that are committed, starting at the base.
+/// The contents of the committed memory are unspecified.
+pub(super) fn take_region(reserve: usize) -> Option<(NonNull<u8>, usize)> {
+    let (region, committed) = LARGE.with_borrow_mut(|p| p.take())?;
+    if region.reserve != reserve {
+        // All large buffers have the same size, so this is unreachable in practice.
+        return None;
+    }
+    let ptr = region.ptr;
+    std::mem::forget(region);
+    Some((ptr, committed))
+}
+
+/// Returns a region obtained from [`sys::virtual_reserve`] or [`take_region`] to the pool.
+/// `commit` is the number of committed bytes and `mapped_len` the number of leading bytes
+/// mapped from a file via [`sys::virtual_map_file`].
+///
+/// # Safety
+///
+/// The region must not be accessed afterwards.
+pub(super) unsafe fn recycle_region(
+    ptr: NonNull<u8>,
+    reserve: usize,
+    commit: usize,
+    mapped_len: usize,
+) {
+    let region = Region { ptr, reserve };
+
+    // The file may be overwritten once the buffer is gone, which makes its mapping unusable.
+    let retain = if mapped_len > 0 { 0 } else { commit.min(LARGE_RETAIN_COMMIT) };
+    if commit > retain
+        && unsafe { sys::virtual_decommit(ptr.add(retain), commit - retain) }.is_err()
+    {
+        // Dropping the region releases it.
+        return;
+    }
+
+    // During thread exit the pool may already be gone, in which case dropping the region releases it.
+    _ = LARGE.try_with(|p| p.borrow_mut().put(region, retain));
+}
+
+/// Takes a previously used `Vec`. Its length is the committed size.
+/// The contents are unspecified.
+pub(super) fn take_vec() -> Option<Vec<u8>> {
+    SMALL.with_borrow_mut(|p| p.take()).map(|(v, _)| v)
+}
+
+/// Returns the `Vec` of a small buffer to the pool.
+pub(super) fn recycle_vec(mut v: Vec<u8>) {
+    if v.capacity() == 0 {
+        return;
+    }
+
+    v.truncate(SMALL_RETAIN_COMMIT);
+    v.shrink_to(SMALL_RETAIN_COMMIT);
+    let committed = v.len();
+    _ = SMALL.try_with(|p| p.borrow_mut().put(v, committed));
+}
+
+/// Returns the statistics of the calling thread's pools
+/// that recycle the memory of dropped text buffers.
+pub fn pool_stats() -> BufferPoolStats {
+    BufferPoolStats { large: LARGE.with_borrow(|p| p.stats), small: SMALL.with_borrow(|p| p.stats) }
+}
+
+#[cfg(test)]
+mod test {
+    use super::*;
+
+    #[test]
+    fn test_pool() {
+        let mut pool = Pool::new(2);
+
+        assert_eq!(pool.take(), None);
+        assert_eq!(pool.put("a", 1), None);
+        assert_eq!(pool.put("b", 2), None);
+        // Full: The least recently used one is evicted.
+        assert_eq!(pool.put("c", 4), Some("a"));
+        assert_eq!(pool.stats.committed, 6);
+        // The most recently used one is handed out first.
+        assert_eq!(pool.take(), Some(("c", 4)));
+        assert_eq!(pool.take(), Some(("b", 2)));
+        assert_eq!(pool.take(), None);
+        assert_eq!(
+            pool.stats,
+            PoolStats { hits: 2, misses: 2, evictions: 1, len: 0, committed: 0 }
+        );
+    }
+}
@@ -0,0 +1,446 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+//! A chunked rope, the alternative to [`GapBuffer`] for very large documents.
+//!
+//! The text is split into chunks of at most [`CHUNK_MAX`] bytes. An edit only ever touches
+//! the chunks it overlaps, so unlike with a gap buffer there's no need to move everything
+//! between two far-apart edits. The chunks are located via a Fenwick tree (binary indexed tree)
+//! over their lengths, which makes lookups and the bookkeeping of most edits O(log n).
+//! Only when chunks are split or merged is the tree rebuilt, which is O(n) in the number
+//! of chunks (not bytes) and amortizes over at least [`CHUNK_MAX`] / 2 bytes of edits.
+//!
+//! Chunks are reference counted and copied on write. Taking a snapshot of the contents is
+//! therefore only a matter of cloning the chunk list. See [`Rope::shared_chunks`].
+//!
+//! [`GapBuffer`]: super::GapBuffer
+
+use std::ops::Range;
+use std::sync::Arc;
+
+use crate::document::ReadableDocument;
+use crate::helpers::*;
+use crate::unicode;
+
+/// Chunks never exceed this size.
+const CHUNK_MAX: usize = 64 * KIBI;
+/// Chunks that overflow are split into chunks of about this size.
+const CHUNK_TARGET: usize = CHUNK_MAX / 2;
+/// Chunks smaller than this are merged with a neighbor, if they fit.
+const CHUNK_MIN: usize = CHUNK_MAX / 8;
+
+#[derive(Clone)]
+struct Chunk {
+    text: Arc<Vec<u8>>,
+    newlines: usize,
+}
+
+impl Chunk {
+    fn new(text: Vec<u8>) -> Self {
+        let newlines = count_newlines(&text);
+        Self { text: Arc::new(text), newlines }
+    }
+}
+
+fn count_newlines(text: &[u8]) -> usize {
+    unicode::newlines_forward(text, 0, 0, CoordType::MAX).1 as usize
+}
+
+/// Splits the concatenation of `parts` into chunks of about [`CHUNK_TARGET`] bytes.
+fn chunkify(parts: &[&[u8]]) -> Vec<Chunk> {
+    let total: usize = parts.iter().map(|p| p.len()).sum();
+    if total == 0 {
+        return Vec::new();
+    }
+
+    // Distribute the text evenly, instead of leaving a tiny chunk at the end.
+    let count = total.div_ceil(CHUNK_TARGET);
+    let size = total.div_ceil(count);
+    let mut chunks = Vec::with_capacity(count);
+    let mut text = Vec::with_capacity(size);
+
+    for &part in parts {
+        let mut part = part;
+        while !part.is_empty() {
+            let n = part.len().min(size - text.len());
+            text.extend_from_slice(&part[..n]);
+            part = &part[n..];
+            if text.len() == size {
+                chunks.push(Chunk::new(text));
+                text = Vec::with_capacity(size);
+            }
+        }
+    }
+
+    if !text.is_empty() {
+        chunks.push(Chunk::new(text));
+    }
+    chunks
+}
+
+/// A Fenwick tree over the chunk lengths.
+#[derive(Default)]
+struct Fenwick {
+    /// 1-based: `tree[i]` holds the sum of the `i & -i` values ending at index `i - 1`.
+    tree: Vec<usize>,
+}
+
+impl Fenwick {
+    fn build(values: impl ExactSizeIterator<Item = usize>) -> Self {
+        let mut tree = Vec::with_capacity(values.len() + 1);
+        tree.push(0);
+        tree.extend(values);
+
+        let n = tree.len();
+        for i in 1..n {
+            let parent = i + (i & i.wrapping_neg());
+            if parent < n {
+                tree[parent] += tree[i];
+            }
+        }
+
+        Self { tree }
+    }
+
+    /// Adds `delta` to the value at `index`.
+    fn add(&mut self, index: usize, delta: isize) {
+        let mut i = index + 1;
+        while i < self.tree.len() {
+            self.tree[i] = self.tree[i].wrapping_add_signed(delta);
+            i += i & i.wrapping_neg();
+        }
+    }
+
+    /// Returns the index of the value that covers `off`, if values were laid out
+    /// back to back, along with the sum of all values before it.
+    /// The index is equal to the number of values if `off` is past the end.
+    fn find(&self, off: usize) -> (usize, usize) {
+        let n = self.tree.len() - 1;
+        let mut pos = 0;
+        let mut rem = off;
+        let mut step = if n == 0 { 0 } else { 1 << n.ilog2() };
+
+        while step > 0 {
+            let next = pos + step;
+            if next <= n && self.tree[next] <= rem {
+                pos = next;
+                rem -= self.tree[next];
+            }
+            step >>= 1;
+        }
+
+        (pos, off - rem)
+    }
+}
+
+pub struct Rope {
+    chunks: Vec<Chunk>,
+    lens: Fenwick,
+    text_length: usize,
+    newlines: usize,
+    /// See [`GapBuffer::generation`](super::GapBuffer::generation).
+    generation: u32,
+    /// See [`GapBuffer::revision`](super::GapBuffer::revision).
+    revision: u64,
+    /// [`Rope::allocate_gap`] hands out this buffer, and [`Rope::commit_gap`]
+    /// inserts what was written to it at `staging_off`.
+    staging: Vec<u8>,
+    staging_off: usize,
+}
+
+impl Rope {
+    pub fn new() -> Self {
+        Self {
+            chunks: Vec::new(),
+            lens: Fenwick::build([].into_iter()),
+            text_length: 0,
+            newlines: 0,
+            generation: 0,
+            revision: 0,
+            staging: Vec::new(),
+            staging_off: 0,
+        }
+    }
+
+    #[allow(clippy::len_without_is_empty)]
+    pub fn len(&self) -> usize {
+        self.text_length
+    }
+
+    /// The number of newlines in the text. This is kept up to date, unlike
+    /// for a [`GapBuffer`](super::GapBuffer), which has to count them.
+    pub fn newlines(&self) -> usize {
+        self.newlines
+    }
+
+    pub fn generation(&self) -> u32 {
+        self.generation
+    }
+
+    pub fn set_generation(&mut self, generation: u32) {
+        self.generation = generation;
+    }
+
+    pub fn revision(&self) -> u64 {
+        self.revision
+    }
+
+    pub(super) fn set_revision(&mut self, revision: u64) {
+        self.revision = revision;
+    }
+
+    /// The counterpart to [`GapBuffer::allocate_gap`](super::GapBuffer::allocate_gap).
+    /// The returned buffer isn't part of the rope. Whatever is written to its
+    /// beginning is inserted at `off` once [`Rope::commit_gap`] is called.
+    pub fn allocate_gap(&mut self, off: usize, len: usize, delete: usize) -> &mut [u8] {
+        let off = off.min(self.text_length);
+        let delete = delete.min(self.text_length - off);
+
+        if delete > 0 {
+            self.remove(off, delete);
+        }
+
+        self.staging_off = off;
+        self.staging.clear();
+        self.staging.resize(len, 0);
+        self.generation = self.generation.wrapping_add(1);
+        self.revision += 1;
+        &mut self.staging
+    }
+
+    pub fn commit_gap(&mut self, len: usize) {
+        assert!(len <= self.staging.len());
+        let staging = std::mem::take(&mut self.staging);
+        self.insert(self.staging_off, &staging[..len]);
+        self.staging_off += len;
+
+        // Don't hold on to the memory of large insertions, such as when reading a file.
+        if staging.capacity() <= CHUNK_MAX {
+            self.staging = staging;
+        }
+    }
+
+    pub fn replace(&mut self, range: Range<usize>, src: &[u8]) {
+        let off = range.start.min(self.text_length);
+        let delete = range.end.saturating_sub(range.start).min(self.text_length - off);
+
+        if delete > 0 {
+            self.remove(off, delete);
+        }
+        self.insert(off, src);
+        self.generation = self.generation.wrapping_add(1);
+        self.revision += 1;
+    }
+
+    pub fn clear(&mut self) {
+        self.splice_chunks(0..self.chunks.len(), Vec::new());
+        self.text_length = 0;
+        self.newlines = 0;
+        self.generation = self.generation.wrapping_add(1);
+        self.revision += 1;
+    }
+
+    /// Returns the chunks that make up the text, shared with the rope. Their contents
+    /// stay the same, even if the rope is modified afterwards, because it copies
+    /// chunks on write. This makes it cheap to take a snapshot, for instance to save
+    /// the contents in the background.
+    pub fn shared_chunks(&self) -> Vec<Arc<Vec<u8>>> {
+        self.chunks.iter().map(|c| c.text.clone()).collect()
+    }
+
+    /// Returns the index of the chunk that contains `off` and the offset at which it starts.
+    /// For `off == len()` it returns the last chunk. The rope must not be empty.
+    fn locate(&self, off: usize) -> (usize, usize) {
+        debug_assert!(!self.chunks.is_empty());
+        let (index, start) = self.lens.find(off);
+        if index < self.chunks.len() {
+            (index, start)
+        } else {
+            let last = self.chunks.len() - 1;
+            (last, self.text_length - self.chunks[last].text.len())
+        }
+    }
+
+    fn insert(&mut self, off: usize, src: &[u8]) {
+        if src.is_empty() {
+            return;
+        }
+
+        let newlines = count_newlines(src);
+        self.newlines += newlines;
+
+        if self.chunks.is_empty() {
+            self.text_length = src.len();
+            self.splice_chunks(0..0, chunkify(&[src]));
+            return;
+        }
+
+        // `locate()` depends on the old length.
+        let (index, start) = self.locate(off);
+        self.text_length += src.len();
+        let rel = off - start;
+        let chunk = &mut self.chunks[index];
+
+        if chunk.text.len() + src.len() <= CHUNK_MAX {
+            let text = Arc::make_mut(&mut chunk.text);
+            text.splice(rel..rel, src.iter().copied());
+            chunk.newlines += newlines;
+            self.lens.add(index, src.len() as isize);
+        } else {
+            let text = &chunk.text;
+            let chunks = chunkify(&[&text[..rel], src, &text[rel..]]);
+            self.splice_chunks(index..index + 1, chunks);
+        }
+    }
+
+    fn remove(&mut self, off: usize, len: usize) {
+        let end = off + len;
+        let (first, first_start) = self.locate(off);
+        let (last, last_start) = self.locate(end - 1);
+
+        self.text_length -= len;
+
+        if first == last {
+            let chunk = &mut self.chunks[first];
+            let range = off - first_start..end - first_start;
+            let newlines = count_newlines(&chunk.text[range.clone()]);
+            Arc::make_mut(&mut chunk.text).drain(range);
+            chunk.newlines -= newlines;
+            self.newlines -= newlines;
+            self.lens.add(first, -(len as isize));
+
+            if chunk.text.len() < CHUNK_MIN {
+                self.merge_small(first);
+            }
+        } else {
+            // Keep the head of the first and the tail of the last chunk. Everything in between goes.
+            let head = &self.chunks[first].text[..off - first_start];
+            let tail = &self.chunks[last].text[end - last_start..];
+            let removed: usize = self.chunks[first..=last].iter().map(|c| c.newlines).sum();
+            let chunks = chunkify(&[head, tail]);
+            let kept: usize = chunks.iter().map(|c| c.newlines).sum();
+            self.newlines -= removed - kept;
+            self.splice_chunks(first..last + 1, chunks);
+        }
+    }
+
+    /// Merges the chunk at `index` with one of its neighbors, or removes it if it's empty.
+    fn merge_small(&mut self, index: usize) {
+        let len = self.chunks[index].text.len();
+        if len == 0 {
+            self.splice_chunks(index..index + 1, Vec::new());
+            return;
+        }
+
+        let fits = |i: usize| self.chunks[i].text.len() + len <= CHUNK_MAX;
+        let range = if index > 0 && fits(index - 1) {
+            index - 1..index + 1
+        } else if index + 1 < self.chunks.len() && fits(index + 1) {
+            index..index + 2
+        } else {
+            return;
+        };
+
+        let mut text = Vec::with_capacity(CHUNK_MAX);
+        for chunk in &self.chunks[range.clone()] {
+            text.extend_from_slice(&chunk.text);
+        }
+        self.splice_chunks(range, vec![Chunk::new(text)]);
+    }
+
+    fn splice_chunks(&mut self, range: Range<usize>, chunks: Vec<Chunk>) {
+        self.chunks.splice(range, chunks);
+        self.lens = Fenwick::build(self.chunks.iter().map(|c| c.text.len()));
+    }
+}
+
+impl ReadableDocument for Rope {
+    fn read_forward(&self, off: usize) -> &[u8] {
+        if off >= self.text_length {
+            return &[];
+        }
+        let (index, start) = self.lens.find(off);
+        &self.chunks[index].text[off - start..]
+    }
+
+    fn read_backward(&self, off: usize) -> &[u8] {
+        let off = off.min(self.text_length);
+        if off == 0 {
+            return &[];
+        }
+        let (index, start) = self.lens.find(off - 1);
+        &self.chunks[index].text[..off - start]
+    }
+}
+
+#[cfg(test)]
+mod test {
+    use super::*;
+
+    fn contents(rope: &Rope) -> Vec<u8> {
+        let mut v = Vec::new();
+        loop {
+            let chunk = rope.read_forward(v.len());
+            if chunk.is_empty() {
+                break;
+            }
+            v.extend_from_slice(chunk);
+        }
+        v
+    }
+
+    #[test]
+    fn test_random_edits() {
+        let mut rope = Rope::new();
+        let mut reference = Vec::new();
+        let mut rng = TestRng::default();
+        let mut next = |n: usize| rng.below(n + 1);
+
+        for i in 0..3000 {
+            let off = next(reference.len());
+            // Mostly small edits, with the occasional large one to force splits and merges.
+            let (delete, insert) = if i % 100 == 0 {
+                (next((reference.len() - off).min(200 * KIBI)), next(100 * KIBI))
+            } else {
+                (next((reference.len() - off).min(64)), next(256))
+            };
+            let text: Vec<u8> =
+                (0..insert).map(|j| if j % 61 == 0 { b'\n' } else { b'a' }).collect();
+            rope.replace(off..off + delete, &text);
+            reference.splice(off..off + delete, text);
+
+            // Appending, like when reading a file, hits the end of the last chunk.
+            if i % 10 == 0 {
+                let off = reference.len();
+                rope.replace(off..off, b"end\n");
+                reference.extend_from_slice(b"end\n");
+            }
+        }
+
+        assert_eq!(rope.len(), reference.len());
+        assert_eq!(contents(&rope), reference);
+        assert_eq!(rope.newlines(), reference.iter().filter(|&&c| c == b'\n').count());
+        assert!(rope.chunks.iter().all(|c| !c.text.is_empty() && c.text.len() <= CHUNK_MAX));
+
+        // Reading backwards yields the same contents.
+        let mut off = rope.len();
+        let mut backwards = Vec::new();
+        while off > 0 {
+            let chunk = rope.read_backward(off);
+            backwards.splice(0..0, chunk.iter().copied());
+            off -= chunk.len();
+        }
+        assert_eq!(backwards, reference);
+    }
+
+    #[test]
+    fn test_shared_chunks_are_immutable() {
+        let mut rope = Rope::new();
+        rope.replace(0..0, b"hello world");
+        let snapshot = rope.shared_chunks();
+        rope.replace(0..5, b"goodbye");
+        let snapshot: Vec<u8> = snapshot.iter().flat_map(|c| c.iter().copied()).collect();
+        assert_eq!(snapshot, b"hello world");
+        assert_eq!(contents(&rope), b"goodbye world");
+    }
+}
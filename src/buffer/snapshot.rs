@@ -0,0 +1,147 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+//! Immutable copies of the contents of a [`TextBuffer`] for other threads.
+//!
+//! [`TextBuffer`]: super::TextBuffer
+
+use std::sync::{Arc, Weak};
+
+use crate::document::ReadableDocument;
+
+struct Contents {
+    pieces: Vec<Arc<Vec<u8>>>,
+    /// The offset at which each of `pieces` starts.
+    starts: Vec<usize>,
+    len: usize,
+    generation: u32,
+    /// Unlike the generation, this identifies the contents uniquely. See [`SnapshotCache`].
+    revision: u64,
+}
+
+/// The contents of a [`TextBuffer`] at a point in time.
+/// See [`TextBuffer::snapshot`].
+///
+/// Snapshots are cheap to clone and can be sent to other threads, which can
+/// read them while the buffer keeps changing. They share their memory with
+/// the buffer if it's a [rope](super::Rope), and with other snapshots.
+///
+/// [`TextBuffer`]: super::TextBuffer
+/// [`TextBuffer::snapshot`]: super::TextBuffer::snapshot
+#[derive(Clone)]
+pub struct TextSnapshot {
+    contents: Arc<Contents>,
+}
+
+impl TextSnapshot {
+    pub(super) fn new(pieces: Vec<Arc<Vec<u8>>>, generation: u32, revision: u64) -> Self {
+        let pieces: Vec<_> = pieces.into_iter().filter(|p| !p.is_empty()).collect();
+        let mut starts = Vec::with_capacity(pieces.len());
+        let mut len = 0;
+        for p in &pieces {
+            starts.push(len);
+            len += p.len();
+        }
+        Self { contents: Arc::new(Contents { pieces, starts, len, generation, revision }) }
+    }
+
+    /// The size of the contents in bytes.
+    pub fn len(&self) -> usize {
+        self.contents.len
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.contents.len == 0
+    }
+
+    /// The [`TextBuffer::generation`](super::TextBuffer::generation) the snapshot was taken at.
+    pub fn generation(&self) -> u32 {
+        self.contents.generation
+    }
+
+    /// The contiguous pieces the contents consist of.
+    pub fn pieces(&self) -> &[Arc<Vec<u8>>] {
+        &self.contents.pieces
+    }
+
+    /// Returns the index of the piece that contains `off`.
+    fn find(&self, off: usize) -> usize {
+        self.contents.starts.partition_point(|&s| s <= off) - 1
+    }
+}
+
+/// Remembers the last snapshot for as long as anyone holds on to it, so that
+/// taking another one of unchanged contents is free. It doesn't keep it alive,
+/// since its memory is only needed while it's being read.
+#[derive(Default)]
+pub(super) struct SnapshotCache {
+    last: Weak<Contents>,
+}
+
+impl SnapshotCache {
+    /// Returns the last snapshot, if it's still around and was taken at the given revision.
+    pub fn get(&self, revision: u64) -> Option<TextSnapshot> {
+        let contents = self.last.upgrade()?;
+        (contents.revision == revision).then_some(TextSnapshot { contents })
+    }
+
+    pub fn set(&mut self, snapshot: &TextSnapshot) {
+        self.last = Arc::downgrade(&snapshot.contents);
+    }
+}
+
+impl ReadableDocument for TextSnapshot {
+    fn read_forward(&self, off: usize) -> &[u8] {
+        if off >= self.contents.len {
+            return &[];
+        }
+        let i = self.find(off);
+        &self.contents.pieces[i][off - self.contents.starts[i]..]
+    }
+
+    fn read_backward(&self, off: usize) -> &[u8] {
+        let off = off.min(self.contents.len);
+        if off == 0 {
+            return &[];
+        }
+        let i = self.find(off - 1);
+        &self.contents.pieces[i][..off - self.contents.starts[i]]
+    }
+}
+
+#[cfg(test)]
+mod test {
+    use super::*;
+
+    #[test]
+    fn test_read() {
+        let pieces = ["hello", "", " ", "world"].map(|p| Arc::new(p.as_bytes().to_vec()));
+        let s = TextSnapshot::new(pieces.to_vec(), 0, 0);
+
+        assert_eq!(s.len(), 11);
+        assert_eq!(s.read_forward(0), b"hello");
+        assert_eq!(s.read_forward(5), b" ");
+        assert_eq!(s.read_forward(7), b"orld");
+        assert_eq!(s.read_forward(11), b"");
+        assert_eq!(s.read_backward(11), b"world");
+        assert_eq!(s.read_backward(6), b" ");
+        assert_eq!(s.read_backward(3), b"hel");
+        assert_eq!(s.read_backward(0), b"");
+
+        let mut cache = SnapshotCache::default();
+        cache.set(&s);
+        assert!(cache.get(0).is_some());
+        assert!(cache.get(1).is_none());
+
+        // Snapshots can be read on other threads.
+        let t = s.clone();
+        assert_eq!(
+            std::thread::spawn(move || t.read_backward(usize::MAX).to_vec()).join().unwrap(),
+            b"world"
+        );
+
+        // The cache doesn't keep snapshots alive.
+        drop(s);
+        assert!(cache.get(0).is_none());
+    }
+}
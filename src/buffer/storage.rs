@@ -0,0 +1,260 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+//! Selects between the two ways a [`TextBuffer`](super::TextBuffer) can store its contents.
+
+use std::fs::File;
+use std::ops::Range;
+use std::sync::Arc;
+
+use super::gap_buffer::GapBuffer;
+use super::rope::Rope;
+use crate::apperr;
+use crate::document::{ReadableDocument, WriteableDocument};
+use crate::helpers::*;
+
+/// See [`TextBuffer::set_storage_kind`](super::TextBuffer::set_storage_kind).
+#[derive(Clone, Copy, Default, Debug, PartialEq, Eq)]
+pub enum StorageKind {
+    /// A gap buffer, unless a file larger than `ROPE_THRESHOLD` is loaded.
+    #[default]
+    Auto,
+    /// A single contiguous allocation with a gap at the cursor.
+    /// It's the fastest for reading and for edits that are close together.
+    GapBuffer,
+    /// Chunks of text in a balanced index. Edits far away from each other don't need
+    /// to move the text in between, and snapshots of the contents are cheap.
+    Rope,
+}
+
+pub enum Storage {
+    GapBuffer(GapBuffer),
+    Rope(Rope),
+}
+
+macro_rules! dispatch {
+    ($self:expr, $b:ident => $e:expr) => {
+        match $self {
+            Storage::GapBuffer($b) => $e,
+            Storage::Rope($b) => $e,
+        }
+    };
+}
+
+impl Storage {
+    pub fn new(small: bool) -> apperr::Result<Self> {
+        Ok(Self::GapBuffer(GapBuffer::new(small)?))
+    }
+
+    pub fn kind(&self) -> StorageKind {
+        match self {
+            Self::GapBuffer(_) => StorageKind::GapBuffer,
+            Self::Rope(_) => StorageKind::Rope,
+        }
+    }
+
+    /// Replaces the storage with an empty one of the given kind.
+    /// The generation and revision carry over, as if the contents were cleared.
+    pub fn reset_to(&mut self, kind: StorageKind) -> apperr::Result<()> {
+        let generation = self.generation();
+        let revision = self.revision();
+
+        *self = match kind {
+            StorageKind::Auto | StorageKind::GapBuffer => Self::GapBuffer(GapBuffer::new(false)?),
+            StorageKind::Rope => Self::Rope(Rope::new()),
+        };
+
+        dispatch!(self, b => {
+            b.set_generation(generation);
+            b.set_revision(revision);
+            b.clear();
+        });
+        Ok(())
+    }
+
+    #[allow(clippy::len_without_is_empty)]
+    pub fn len(&self) -> usize {
+        dispatch!(self, b => b.len())
+    }
+
+    pub fn generation(&self) -> u32 {
+        dispatch!(self, b => b.generation())
+    }
+
+    pub fn set_generation(&mut self, generation: u32) {
+        dispatch!(self, b => b.set_generation(generation))
+    }
+
+    pub fn revision(&self) -> u64 {
+        dispatch!(self, b => b.revision())
+    }
+
+    /// See [`GapBuffer::allocate_gap`].
+    pub fn allocate_gap(&mut self, off: usize, len: usize, delete: usize) -> &mut [u8] {
+        dispatch!(self, b => b.allocate_gap(off, len, delete))
+    }
+
+    pub fn commit_gap(&mut self, len: usize) {
+        dispatch!(self, b => b.commit_gap(len))
+    }
+
+    pub fn replace(&mut self, range: Range<usize>, src: &[u8]) {
+        dispatch!(self, b => b.replace(range, src))
+    }
+
+    pub fn clear(&mut self) {
+        dispatch!(self, b => b.clear())
+    }
+
+    /// The number of newlines in the contents, if it's known without counting them.
+    pub fn newlines(&self) -> Option<usize> {
+        match self {
+            Self::GapBuffer(_) => None,
+            Self::Rope(r) => Some(r.newlines()),
+        }
+    }
+
+    /// See [`GapBuffer::map_file`]. Ropes can't map files and return false.
+    pub fn map_file(&mut self, file: &File, len: usize) -> bool {
+        match self {
+            Self::GapBuffer(b) => b.map_file(file, len),
+            Self::Rope(_) => false,
+        }
+    }
+
+    pub fn detach_file(&mut self) -> apperr::Result<()> {
+        match self {
+            Self::GapBuffer(b) => b.detach_file(),
+            Self::Rope(_) => Ok(()),
+        }
+    }
+
+    /// Returns the contents as a list of contiguous pieces.
+    pub fn pieces(&self) -> Vec<&[u8]> {
+        let mut pieces = Vec::new();
+        let mut off = 0;
+        loop {
+            let chunk = self.read_forward(off);
+            if chunk.is_empty() {
+                return pieces;
+            }
+            pieces.push(chunk);
+            off += chunk.len();
+        }
+    }
+
+    /// Returns the contents as a list of pieces that stay unchanged, even if the storage changes.
+    /// For ropes this only copies the list of their chunks, not the text.
+    pub fn shared_pieces(&self) -> Vec<Arc<Vec<u8>>> {
+        match self {
+            Self::GapBuffer(_) => {
+                let mut text = Vec::with_capacity(self.len());
+                self.extract_raw(0, self.len(), &mut text, 0);
+                vec![Arc::new(text)]
+            }
+            Self::Rope(r) => r.shared_chunks(),
+        }
+    }
+
+    pub fn extract_raw(
+        &self,
+        mut beg: usize,
+        mut end: usize,
+        out: &mut Vec<u8>,
+        mut out_off: usize,
+    ) {
+        let len = self.len();
+        debug_assert!(beg <= end && end <= len);
+
+        end = end.min(len);
+        beg = beg.min(end);
+        out_off = out_off.min(out.len());
+
+        if beg >= end {
+            return;
+        }
+
+        out.reserve(end - beg);
+
+        while beg < end {
+            let chunk = self.read_forward(beg);
+            let chunk = &chunk[..chunk.len().min(end - beg)];
+            out.replace_range(out_off..out_off, chunk);
+            beg += chunk.len();
+            out_off += chunk.len();
+        }
+    }
+
+    /// Replaces the entire buffer contents with the given `text`.
+    /// The method is optimized for the case where the given `text` already matches
+    /// the existing contents. Returns `true` if the buffer contents were changed.
+    pub fn copy_from(&mut self, src: &dyn ReadableDocument) -> bool {
+        let mut off = 0;
+
+        // Find the position at which the contents change.
+        loop {
+            let dst_chunk = self.read_forward(off);
+            let src_chunk = src.read_forward(off);
+
+            let dst_len = dst_chunk.len();
+            let src_len = src_chunk.len();
+            let len = dst_len.min(src_len);
+            let mismatch = dst_chunk[..len] != src_chunk[..len];
+
+            if mismatch {
+                break; // The contents differ.
+            }
+            if len == 0 {
+                if dst_len == src_len {
+                    return false; // Both done simultaneously. -> Done.
+                }
+                break; // One of the two is shorter.
+            }
+
+            off += len;
+        }
+
+        // Update the buffer starting at `off`.
+        loop {
+            let chunk = src.read_forward(off);
+            self.replace(off..usize::MAX, chunk);
+            off += chunk.len();
+
+            // No more data to copy -> Done. By checking this _after_ the replace()
+            // call, we ensure that the initial `off..usize::MAX` range is deleted.
+            // This fixes going from some buffer contents to being empty.
+            if chunk.is_empty() {
+                return true;
+            }
+        }
+    }
+
+    /// Copies the contents of the buffer into a string.
+    pub fn copy_into(&self, dst: &mut dyn WriteableDocument) {
+        let mut beg = 0;
+        let mut off = 0;
+        let len = self.len();
+
+        while {
+            let chunk = self.read_forward(off);
+
+            // The first write will be 0..usize::MAX and effectively clear() the destination.
+            // Every subsequent write will be usize::MAX..usize::MAX and thus effectively append().
+            dst.replace(beg..usize::MAX, chunk);
+            beg = usize::MAX;
+
+            off += chunk.len();
+            off < len
+        } {}
+    }
+}
+
+impl ReadableDocument for Storage {
+    fn read_forward(&self, off: usize) -> &[u8] {
+        dispatch!(self, b => b.read_forward(off))
+    }
+
+    fn read_backward(&self, off: usize) -> &[u8] {
+        dispatch!(self, b => b.read_backward(off))
+    }
+}
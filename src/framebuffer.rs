@@ -5,14 +5,15 @@
 
 use std::cell::Cell;
 use std::fmt::Write;
-use std::ops::{BitOr, BitXor};
-use std::ptr;
-use std::slice::ChunksExact;
+use std::ops::{BitOr, BitXor, Range};
+use std::{mem, ptr, slice};
 
 use crate::arena::{Arena, ArenaString};
+use crate::hash::hash;
 use crate::helpers::{CoordType, Point, Rect, Size};
-use crate::oklab::{oklab_blend, srgb_to_oklab};
-use crate::simd::{MemsetSafe, memset};
+use crate::oklab::{Blender, oklab_blend, srgb_to_oklab};
+use crate::simd::{MemsetSafe, memset, skip_run};
+use crate::trace;
 use crate::unicode::MeasurementConfig;
 
 // Same constants as used in the PCG family of RNGs.
@@ -53,6 +54,9 @@ pub enum IndexedColor {
     Foreground,
 }
 
+/// A scroll needs to save at least this many rows from being written.
+const MIN_SCROLL_SAVINGS: CoordType = 2;
+
 /// Number of indices used by [`IndexedColor`].
 pub const INDEXED_COLORS_COUNT: usize = 18;
 
@@ -73,6 +77,10 @@ pub const DEFAULT_THEME: [u32; INDEXED_COLORS_COUNT] = [
 /// as they fail to accurately track what changed. If you watch the output
 /// of `vim` for instance, you'll notice that it redraws unrelated parts of
 /// the screen all the time.
+///
+/// On top of that, a frame doesn't need to be drawn from scratch.
+/// [`Framebuffer::flip_damaged`] carries over the rows that didn't change
+/// and only those that did are drawn and diffed against the previous frame.
 pub struct Framebuffer {
     /// Store the color palette.
     indexed_colors: [u32; INDEXED_COLORS_COUNT],
@@ -80,6 +88,14 @@ pub struct Framebuffer {
     buffers: [Buffer; 2],
     /// The current frame counter. Increments on every `flip` call.
     frame_counter: usize,
+    /// A bitmap of the rows that are drawn in the current frame. One bit per row.
+    /// Drawing outside of them is ignored and `render()` skips diffing the others,
+    /// as their contents were carried over from the previous frame by `flip_damaged()`.
+    dirty_rows: RowBitmap,
+    /// The rows that `render()` found to be unchanged since the previous frame.
+    unchanged_rows: RowBitmap,
+    /// Set if the next frame needs to be drawn in its entirety (e.g. palette changes).
+    redraw_all: bool,
     /// The colors used for `contrast()`. It stores the default colors
     /// of the palette as [dark, light], unless the palette is recognized
     /// as a light them, in which case it swaps them.
@@ -89,6 +105,26 @@ pub struct Framebuffer {
     contrast_colors: [Cell<(u32, u32)>; CACHE_TABLE_SIZE],
     background_fill: u32,
     foreground_fill: u32,
+    stats: RenderStats,
+}
+
+/// Statistics about a call to [`Framebuffer::render`].
+#[derive(Default, Clone, Copy)]
+pub struct RenderStats {
+    /// The number of bytes of VT output.
+    pub bytes: usize,
+    /// The number of rows that were written.
+    pub rows_written: CoordType,
+    /// The number of rows that were shifted with a scroll instead of being written.
+    pub rows_scrolled: CoordType,
+}
+
+/// A scroll operation of the rows `top..bottom` by `delta` rows.
+/// Just like SU, positive values scroll the contents up.
+struct Scroll {
+    top: CoordType,
+    bottom: CoordType,
+    delta: CoordType,
 }
 
 impl Framebuffer {
@@ -98,6 +134,9 @@ impl Framebuffer {
             indexed_colors: DEFAULT_THEME,
             buffers: Default::default(),
             frame_counter: 0,
+            dirty_rows: Default::default(),
+            unchanged_rows: Default::default(),
+            redraw_all: true,
             auto_colors: [
                 DEFAULT_THEME[IndexedColor::Black as usize],
                 DEFAULT_THEME[IndexedColor::White as usize],
@@ -105,6 +144,7 @@ impl Framebuffer {
             contrast_colors: [const { Cell::new((0, 0)) }; CACHE_TABLE_SIZE],
             background_fill: DEFAULT_THEME[IndexedColor::Background as usize],
             foreground_fill: DEFAULT_THEME[IndexedColor::Foreground as usize],
+            stats: Default::default(),
         }
     }
 
@@ -116,6 +156,7 @@ impl Framebuffer {
         self.indexed_colors = colors;
         self.background_fill = 0;
         self.foreground_fill = 0;
+        self.redraw_all = true;
 
         self.auto_colors = [
             self.indexed_colors[IndexedColor::Black as usize],
@@ -128,7 +169,21 @@ impl Framebuffer {
 
     /// Begins a new frame with the given `size`.
     pub fn flip(&mut self, size: Size) {
+        self.flip_damaged(size, |_| true);
+    }
+
+    /// Begins a new frame with the given `size`, but only clears the rows for which
+    /// `damaged(y)` returns true. All other rows keep the contents of the previous frame
+    /// and drawing into them is ignored. Use [`Framebuffer::is_dirty`] to check if
+    /// there's anything to draw in a given area.
+    ///
+    /// If the size or palette changed, all rows are considered damaged.
+    pub fn flip_damaged(&mut self, size: Size, damaged: impl Fn(CoordType) -> bool) {
+        let mut redraw_all = mem::take(&mut self.redraw_all);
+
         if size != self.buffers[0].bg_bitmap.size {
+            redraw_all = true;
+
             for buffer in &mut self.buffers {
                 buffer.text = LineBuffer::new(size);
                 buffer.bg_bitmap = Bitmap::new(size);
@@ -145,15 +200,46 @@ impl Framebuffer {
 
         self.frame_counter = self.frame_counter.wrapping_add(1);
 
-        let back = &mut self.buffers[self.frame_counter & 1];
+        let [a, b] = &mut self.buffers;
+        let (back, front) = if self.frame_counter & 1 == 0 { (a, b) } else { (b, a) };
+        let height = size.height.max(0);
+
+        self.dirty_rows.reset(height);
+
+        if redraw_all {
+            back.text.fill_whitespace();
+            back.bg_bitmap.fill(self.background_fill);
+            back.fg_bitmap.fill(self.foreground_fill);
+            back.attributes.reset();
+        }
+
+        for y in 0..height {
+            if redraw_all || damaged(y) {
+                if !redraw_all {
+                    back.text.fill_whitespace_row(y);
+                    memset(back.bg_bitmap.row_mut(y), self.background_fill);
+                    memset(back.fg_bitmap.row_mut(y), self.foreground_fill);
+                    memset(back.attributes.row_mut(y), Attributes::None);
+                }
+                self.dirty_rows.set(y);
+            } else {
+                // The back buffer holds the frame before the previous one.
+                // Bring the row up to date, so that it can be left alone.
+                back.text.lines[y as usize].clone_from(&front.text.lines[y as usize]);
+                back.bg_bitmap.row_mut(y).copy_from_slice(front.bg_bitmap.row(y));
+                back.fg_bitmap.row_mut(y).copy_from_slice(front.fg_bitmap.row(y));
+                back.attributes.row_mut(y).copy_from_slice(front.attributes.row(y));
+            }
+        }
 
-        back.text.fill_whitespace();
-        back.bg_bitmap.fill(self.background_fill);
-        back.fg_bitmap.fill(self.foreground_fill);
-        back.attributes.reset();
         back.cursor = Cursor::new_disabled();
     }
 
+    /// Returns true if any of the rows spanned by `target` are drawn in the current frame.
+    pub fn is_dirty(&self, target: Rect) -> bool {
+        self.dirty_rows.any(target.top, target.bottom)
+    }
+
     /// Replaces text contents in a single line of the framebuffer.
     /// All coordinates are in viewport coordinates.
     /// Assumes that control characters have been replaced or escaped.
@@ -164,6 +250,9 @@ impl Framebuffer {
         clip_right: CoordType,
         text: &str,
     ) {
+        if !self.dirty_rows.get(y) {
+            return;
+        }
         let back = &mut self.buffers[self.frame_counter & 1];
         back.text.replace_text(y, origin_x, clip_right, text)
     }
@@ -335,7 +424,7 @@ impl Framebuffer {
     /// but ideally `blend_bg` with semi-transparent dark should also darken text below it.
     pub fn blend_bg(&mut self, target: Rect, bg: u32) {
         let back = &mut self.buffers[self.frame_counter & 1];
-        back.bg_bitmap.blend(target, bg);
+        self.dirty_rows.for_each_span(target, |rect| back.bg_bitmap.blend(rect, bg));
     }
 
     /// Blends the given sRGB color onto the foreground bitmap.
@@ -344,7 +433,7 @@ impl Framebuffer {
     /// but ideally `blend_fg` should blend with the background color below it.
     pub fn blend_fg(&mut self, target: Rect, fg: u32) {
         let back = &mut self.buffers[self.frame_counter & 1];
-        back.fg_bitmap.blend(target, fg);
+        self.dirty_rows.for_each_span(target, |rect| back.fg_bitmap.blend(rect, fg));
     }
 
     /// Reverses the foreground and background colors in the given rectangle.
@@ -363,6 +452,9 @@ impl Framebuffer {
         let stride = back.bg_bitmap.size.width as usize;
 
         for y in top..bottom {
+            if !self.dirty_rows.get(y as CoordType) {
+                continue;
+            }
             let beg = y * stride + left;
             let end = y * stride + right;
             let bg = &mut back.bg_bitmap.data[beg..end];
@@ -374,7 +466,7 @@ impl Framebuffer {
     /// Replaces VT attributes in the given rectangle.
     pub fn replace_attr(&mut self, target: Rect, mask: Attributes, attr: Attributes) {
         let back = &mut self.buffers[self.frame_counter & 1];
-        back.attributes.replace(target, mask, attr);
+        self.dirty_rows.for_each_span(target, |rect| back.attributes.replace(rect, mask, attr));
     }
 
     /// Sets the current visible cursor position and type.
@@ -389,6 +481,7 @@ impl Framebuffer {
     /// Renders the framebuffer contents accumulated since the
     /// last call to `flip()` and returns them serialized as VT.
     pub fn render<'a>(&mut self, arena: &'a Arena) -> ArenaString<'a> {
+        let _span = trace::span("Framebuffer::render");
         let idx = self.frame_counter & 1;
         // Borrows the front/back buffers without letting Rust know that we have a reference to self.
         // SAFETY: Well this is certainly correct, but whether Rust and its strict rules likes it is another question.
@@ -399,44 +492,65 @@ impl Framebuffer {
             (back, front)
         };
 
-        let mut front_lines = front.text.lines.iter(); // hahaha
-        let mut front_bgs = front.bg_bitmap.iter();
-        let mut front_fgs = front.fg_bitmap.iter();
-        let mut front_attrs = front.attributes.iter();
-
-        let mut back_lines = back.text.lines.iter();
-        let mut back_bgs = back.bg_bitmap.iter();
-        let mut back_fgs = back.fg_bitmap.iter();
-        let mut back_attrs = back.attributes.iter();
-
         let mut result = ArenaString::new_in(arena);
         let mut last_bg = u64::MAX;
         let mut last_fg = u64::MAX;
         let mut last_attr = Attributes::None;
+        let mut stats = RenderStats::default();
+
+        // Compare each drawn row with the previous frame just once,
+        // for both the scroll detection and the output below.
+        let height = front.text.size.height;
+        self.unchanged_rows.reset(height);
+        for y in 0..height {
+            if !self.dirty_rows.get(y) || Self::rows_equal(back, y, front, y) {
+                self.unchanged_rows.set(y);
+            }
+        }
 
-        for y in 0..front.text.size.height {
-            // SAFETY: The only thing that changes the size of these containers,
-            // is the reset() method and it always resets front/back to the same size.
-            let front_line = unsafe { front_lines.next().unwrap_unchecked() };
-            let front_bg = unsafe { front_bgs.next().unwrap_unchecked() };
-            let front_fg = unsafe { front_fgs.next().unwrap_unchecked() };
-            let front_attr = unsafe { front_attrs.next().unwrap_unchecked() };
+        // If the contents moved up or down, e.g. because a textarea scrolled,
+        // let the terminal shift the rows instead of sending them all again.
+        let scroll = Self::find_scroll(arena, back, front, &self.unchanged_rows);
+        if let Some(scroll) = &scroll {
+            // Reset the attributes, so that the rows scrolled in are blank.
+            // DECSTBM to set the scroll region. SU/SD to scroll. DECSTBM to reset the region.
+            _ = write!(
+                result,
+                "\x1b[m\x1b[{};{}r\x1b[{}{}\x1b[r",
+                scroll.top + 1,
+                scroll.bottom,
+                scroll.delta.abs(),
+                if scroll.delta > 0 { 'S' } else { 'T' },
+            );
+            stats.rows_scrolled = scroll.bottom - scroll.top - scroll.delta.abs();
+        }
 
-            let back_line = unsafe { back_lines.next().unwrap_unchecked() };
-            let back_bg = unsafe { back_bgs.next().unwrap_unchecked() };
-            let back_fg = unsafe { back_fgs.next().unwrap_unchecked() };
-            let back_attr = unsafe { back_attrs.next().unwrap_unchecked() };
+        for y in 0..height {
+            // The row that the terminal currently shows at `y`, if any.
+            let src = match &scroll {
+                Some(s) if (s.top..s.bottom).contains(&y) => {
+                    Some(y + s.delta).filter(|y| (s.top..s.bottom).contains(y))
+                }
+                _ => Some(y),
+            };
 
             // TODO: Ideally, we should properly diff the contents and so if
             // only parts of a line change, we should only update those parts.
-            if front_line == back_line
-                && front_bg == back_bg
-                && front_fg == back_fg
-                && front_attr == back_attr
-            {
+            let unchanged = match src {
+                Some(src) if src == y => self.unchanged_rows.get(y),
+                Some(src) => Self::rows_equal(back, y, front, src),
+                None => false,
+            };
+            if unchanged {
                 continue;
             }
 
+            let back_line = &back.text.lines[y as usize];
+            let back_bg = back.bg_bitmap.row(y);
+            let back_fg = back.fg_bitmap.row(y);
+            let back_attr = back.attributes.row(y);
+            stats.rows_written += 1;
+
             let line_bytes = back_line.as_bytes();
             let mut cfg = MeasurementConfig::new(&line_bytes);
             let mut chunk_end = 0;
@@ -452,13 +566,10 @@ impl Framebuffer {
                 let attr = back_attr[chunk_end];
 
                 // Chunk into runs of the same color.
-                while {
-                    chunk_end += 1;
-                    chunk_end < back_bg.len()
-                        && back_bg[chunk_end] == bg
-                        && back_fg[chunk_end] == fg
-                        && back_attr[chunk_end] == attr
-                } {}
+                let chunk_beg = chunk_end;
+                let color_end = skip_run(back_bg, chunk_beg).min(skip_run(back_fg, chunk_beg));
+                chunk_end =
+                    (chunk_beg + 1..color_end).find(|&x| back_attr[x] != attr).unwrap_or(color_end);
 
                 if last_bg != bg as u64 {
                     last_bg = bg as u64;
@@ -518,9 +629,108 @@ impl Framebuffer {
             }
         }
 
+        stats.bytes = result.len();
+        self.stats = stats;
         result
     }
 
+    /// Returns statistics about the last call to [`Framebuffer::render`].
+    pub fn stats(&self) -> RenderStats {
+        self.stats
+    }
+
+    fn rows_equal(a: &Buffer, ay: CoordType, b: &Buffer, by: CoordType) -> bool {
+        a.text.lines[ay as usize] == b.text.lines[by as usize]
+            && a.bg_bitmap.row(ay) == b.bg_bitmap.row(by)
+            && a.fg_bitmap.row(ay) == b.fg_bitmap.row(by)
+            && a.attributes.row(ay) == b.attributes.row(by)
+    }
+
+    fn row_hash(buffer: &Buffer, y: CoordType) -> u64 {
+        let line = &buffer.text.lines[y as usize];
+        let bg = buffer.bg_bitmap.row(y);
+        let fg = buffer.fg_bitmap.row(y);
+        let attr = buffer.attributes.row(y);
+        // SAFETY: The colors and attributes are plain integers.
+        unsafe {
+            let mut h = hash(0, line.as_bytes());
+            h = hash(h, slice::from_raw_parts(bg.as_ptr() as *const u8, mem::size_of_val(bg)));
+            h = hash(h, slice::from_raw_parts(fg.as_ptr() as *const u8, mem::size_of_val(fg)));
+            hash(h, slice::from_raw_parts(attr.as_ptr() as *const u8, mem::size_of_val(attr)))
+        }
+    }
+
+    /// Finds the scroll operation that saves the most rows from being written.
+    ///
+    /// Scrolling a region up by `delta` rows means that each row `y` in the back buffer
+    /// is found at `y + delta` in the front buffer, for a run of consecutive `y`.
+    /// The rows scrolled in at the other end of the region need to be written,
+    /// even if they were unchanged, and so they count against the savings.
+    fn find_scroll(
+        arena: &Arena,
+        back: &Buffer,
+        front: &Buffer,
+        unchanged_rows: &RowBitmap,
+    ) -> Option<Scroll> {
+        let height = front.text.size.height;
+
+        // Scrolling only pays off if a couple of rows need to be written anyway.
+        let changed = (0..height).filter(|&y| !unchanged_rows.get(y)).count();
+        if changed < MIN_SCROLL_SAVINGS as usize {
+            return None;
+        }
+
+        // `render()` calls this before writing any output into the arena,
+        // so that the output can still grow in place afterwards.
+        let mut back_hashes = Vec::with_capacity_in(height as usize, arena);
+        let mut front_hashes = Vec::with_capacity_in(height as usize, arena);
+        back_hashes.extend((0..height).map(|y| Self::row_hash(back, y)));
+        front_hashes.extend((0..height).map(|y| Self::row_hash(front, y)));
+
+        let hb = |y: CoordType| back_hashes[y as usize];
+        let hf = |y: CoordType| front_hashes[y as usize];
+        let unchanged = |range: Range<CoordType>| range.filter(|&y| hb(y) == hf(y)).count();
+        let mut best = None;
+        let mut best_savings = MIN_SCROLL_SAVINGS - 1;
+
+        for delta in 1 - height..height {
+            if delta == 0 {
+                continue;
+            }
+
+            let end = height.min(height - delta);
+            let mut y = (-delta).max(0);
+
+            while y < end {
+                if hb(y) != hf(y + delta) {
+                    y += 1;
+                    continue;
+                }
+
+                let run_beg = y;
+                while y < end && hb(y) == hf(y + delta) {
+                    y += 1;
+                }
+                let run_end = y;
+
+                let (top, bottom, scrolled_in) = if delta > 0 {
+                    (run_beg, run_end + delta, run_end..run_end + delta)
+                } else {
+                    (run_beg + delta, run_end, run_beg + delta..run_beg)
+                };
+                let saved = (run_end - run_beg) as usize - unchanged(run_beg..run_end);
+                let savings = saved as CoordType - unchanged(scrolled_in) as CoordType;
+
+                if savings > best_savings {
+                    best_savings = savings;
+                    best = Some(Scroll { top, bottom, delta });
+                }
+            }
+        }
+
+        best
+    }
+
     fn format_color(&self, dst: &mut ArenaString, fg: bool, mut color: u32) {
         let typ = if fg { '3' } else { '4' };
 
@@ -579,15 +789,24 @@ impl LineBuffer {
     fn fill_whitespace(&mut self) {
         let width = self.size.width as usize;
         for l in &mut self.lines {
-            l.clear();
-            l.reserve(width + width / 2);
-
-            let buf = unsafe { l.as_mut_vec() };
-            // Compiles down to `memset()`.
-            buf.extend(std::iter::repeat_n(b' ', width));
+            Self::fill_whitespace_line(l, width);
         }
     }
 
+    fn fill_whitespace_row(&mut self, y: CoordType) {
+        let width = self.size.width as usize;
+        Self::fill_whitespace_line(&mut self.lines[y as usize], width);
+    }
+
+    fn fill_whitespace_line(l: &mut String, width: usize) {
+        l.clear();
+        l.reserve(width + width / 2);
+
+        let buf = unsafe { l.as_mut_vec() };
+        // Compiles down to `memset()`.
+        buf.extend(std::iter::repeat_n(b' ', width));
+    }
+
     /// Replaces text contents in a single line of the framebuffer.
     /// All coordinates are in viewport coordinates.
     /// Assumes that control characters have been replaced or escaped.
@@ -746,41 +965,83 @@ impl Bitmap {
         let left = target.left as usize;
         let right = target.right as usize;
         let stride = self.size.width as usize;
+        let opaque = (color & 0xff000000) == 0xff000000;
+        let mut blender = (!opaque).then(|| Blender::new(color));
 
         for y in top..bottom {
             let beg = y * stride + left;
             let end = y * stride + right;
             let data = &mut self.data[beg..end];
 
-            if (color & 0xff000000) == 0xff000000 {
-                memset(data, color);
-            } else {
-                let end = data.len();
-                let mut off = 0;
+            match &mut blender {
+                None => memset(data, color),
+                Some(b) => b.blend_row(data),
+            }
+        }
+    }
+
+    fn row(&self, y: CoordType) -> &[u32] {
+        let stride = self.size.width as usize;
+        let y = y as usize;
+        &self.data[y * stride..(y + 1) * stride]
+    }
+
+    fn row_mut(&mut self, y: CoordType) -> &mut [u32] {
+        let stride = self.size.width as usize;
+        let y = y as usize;
+        &mut self.data[y * stride..(y + 1) * stride]
+    }
+}
 
-                while {
-                    let c = data[off];
+/// One bit per row of the framebuffer.
+#[derive(Default)]
+struct RowBitmap {
+    words: Vec<u64>,
+}
 
-                    // Chunk into runs of the same color, so that we only call alpha_blend once per run.
-                    let chunk_beg = off;
-                    while {
-                        off += 1;
-                        off < end && data[off] == c
-                    } {}
-                    let chunk_end = off;
+impl RowBitmap {
+    /// Clears the bitmap and resizes it to `height` rows.
+    fn reset(&mut self, height: CoordType) {
+        self.words.clear();
+        self.words.resize((height.max(0) as usize).div_ceil(64), 0);
+    }
 
-                    let c = oklab_blend(c, color);
-                    memset(&mut data[chunk_beg..chunk_end], c);
+    fn set(&mut self, y: CoordType) {
+        let y = y as usize;
+        self.words[y / 64] |= 1 << (y % 64);
+    }
+
+    fn get(&self, y: CoordType) -> bool {
+        let y = y as usize;
+        self.words.get(y / 64).is_some_and(|&w| w & (1 << (y % 64)) != 0)
+    }
 
-                    off < end
-                } {}
+    /// Returns true if any row in `top..bottom` is set.
+    fn any(&self, top: CoordType, bottom: CoordType) -> bool {
+        (top.max(0)..bottom.min(self.len())).any(|y| self.get(y))
+    }
+
+    /// Calls `f` for each part of `target` that spans consecutive set rows.
+    fn for_each_span(&self, target: Rect, mut f: impl FnMut(Rect)) {
+        let bottom = target.bottom.min(self.len());
+        let mut y = target.top.max(0);
+
+        while y < bottom {
+            if !self.get(y) {
+                y += 1;
+                continue;
             }
+
+            let top = y;
+            while y < bottom && self.get(y) {
+                y += 1;
+            }
+            f(Rect { left: target.left, top, right: target.right, bottom: y });
         }
     }
 
-    /// Iterates over each row in the bitmap.
-    fn iter(&self) -> ChunksExact<u32> {
-        self.data.chunks_exact(self.size.width as usize)
+    fn len(&self) -> CoordType {
+        (self.words.len() * 64) as CoordType
     }
 }
 
@@ -864,9 +1125,16 @@ impl AttributeBuffer {
         }
     }
 
-    /// Iterates over each row in the bitmap.
-    fn iter(&self) -> ChunksExact<Attributes> {
-        self.data.chunks_exact(self.size.width as usize)
+    fn row(&self, y: CoordType) -> &[Attributes] {
+        let stride = self.size.width as usize;
+        let y = y as usize;
+        &self.data[y * stride..(y + 1) * stride]
+    }
+
+    fn row_mut(&mut self, y: CoordType) -> &mut [Attributes] {
+        let stride = self.size.width as usize;
+        let y = y as usize;
+        &mut self.data[y * stride..(y + 1) * stride]
     }
 }
 
@@ -886,3 +1154,93 @@ impl Cursor {
         Self { pos: Point { x: -1, y: -1 }, overtype: false }
     }
 }
+
+#[cfg(test)]
+mod test {
+    use super::*;
+
+    fn draw(fb: &mut Framebuffer, frame: CoordType) {
+        let size = fb.buffers[0].text.size;
+        for y in 0..size.height {
+            let text = if y == frame % size.height { "changed" } else { "hello" };
+            fb.replace_text(y, 1, size.width, text);
+        }
+        // Translucent colors catch rows that would be blended twice.
+        fb.blend_bg(size.as_rect(), 0x80ff0000);
+        fb.blend_fg(Rect { left: 0, top: 1, right: 4, bottom: 3 }, 0x800000ff);
+        fb.replace_attr(
+            Rect { left: 2, top: 0, right: 3, bottom: 4 },
+            Attributes::All,
+            Attributes::Italic,
+        );
+        fb.reverse(Rect {
+            left: 0,
+            top: frame % size.height,
+            right: 2,
+            bottom: frame % size.height + 1,
+        });
+    }
+
+    #[test]
+    fn test_flip_damaged() {
+        let size = Size { width: 8, height: 4 };
+        let mut full = Framebuffer::new();
+        let mut partial = Framebuffer::new();
+        let arena = Arena::new(64 * 1024).unwrap();
+
+        for frame in 0..6 {
+            full.flip(size);
+            draw(&mut full, frame);
+
+            // Only the rows that show "changed" in this or the last frame differ.
+            partial.flip_damaged(size, |y| y == frame % 4 || y == (frame + 3) % 4);
+            draw(&mut partial, frame);
+
+            let a = &full.buffers[full.frame_counter & 1];
+            let b = &partial.buffers[partial.frame_counter & 1];
+            assert_eq!(a.text.lines, b.text.lines);
+            assert_eq!(a.bg_bitmap.data, b.bg_bitmap.data);
+            assert_eq!(a.fg_bitmap.data, b.fg_bitmap.data);
+            assert!(a.attributes.data == b.attributes.data);
+
+            // Rows that weren't damaged aren't diffed.
+            let output = partial.render(&arena);
+            if frame > 0 {
+                assert!(!output.contains(&format!("\x1b[{};1H", (frame + 2) % 4 + 1)));
+            }
+        }
+    }
+
+    #[test]
+    fn test_scroll() {
+        let size = Size { width: 10, height: 8 };
+        let mut fb = Framebuffer::new();
+        let arena = Arena::new(64 * 1024).unwrap();
+
+        for offset in [0, 2, 1] {
+            fb.flip(size);
+            for y in 0..size.height {
+                fb.replace_text(y, 0, size.width, &format!("line {}", y + offset));
+            }
+            let output = fb.render(&arena);
+
+            match offset {
+                // Scrolling down by 2 rows writes the 2 new ones at the bottom.
+                2 => {
+                    assert!(output.contains("\x1b[1;8r\x1b[2S\x1b[r"));
+                    assert!(output.contains("\x1b[7;1H") && output.contains("\x1b[8;1H"));
+                    assert_eq!(fb.stats().rows_written, 2);
+                    assert_eq!(fb.stats().rows_scrolled, 6);
+                }
+                // Scrolling back up by 1 row writes the new one at the top.
+                1 => {
+                    assert!(output.contains("\x1b[1;8r\x1b[1T\x1b[r"));
+                    assert_eq!(fb.stats().rows_written, 1);
+                    assert_eq!(fb.stats().rows_scrolled, 7);
+                }
+                _ => {}
+            }
+            assert_eq!(fb.stats().bytes, output.len());
+        }
+    }
+}
@@ -5,41 +5,289 @@
 //! Other algorithms exist, such as Sublime Text's, or the one used in `fzf`,
 //! but I figured that this one is what lots of people may be familiar with.
 
-use std::vec;
+use std::alloc::Allocator;
+use std::{mem, thread};
 
 use crate::arena::{Arena, scratch_arena};
 use crate::icu;
 
 const NO_MATCH: i32 = 0;
 
+/// The minimum number of candidates per thread when scoring in parallel.
+/// Below that, spawning the threads takes longer than the scoring.
+const PARALLEL_MIN_CANDIDATES: usize = 1024;
+
+/// A string and its case-folded version, mapped to chars.
+/// Both have the same length, so that indices into one apply to the other. See [`fold_chars`].
+#[derive(Clone, Copy)]
+struct Chars<'a> {
+    chars: &'a [char],
+    lower: &'a [char],
+}
+
+/// A string prepared for being scored repeatedly.
+/// The char mapping and case folding are done once up front.
+pub struct FuzzyString {
+    chars: Vec<char>,
+    lower: Vec<char>,
+}
+
+impl FuzzyString {
+    pub fn new(s: &str) -> Self {
+        let scratch = scratch_arena(None);
+        let mut lower = Vec::new();
+        fold_chars(&scratch, s, &mut lower);
+        Self { chars: s.chars().collect(), lower }
+    }
+
+    fn as_chars(&self) -> Chars<'_> {
+        Chars { chars: &self.chars, lower: &self.lower }
+    }
+}
+
+/// Filters and ranks a list of candidates by how well they match a query that
+/// changes over time, like the name typed into the file picker.
+///
+/// If the query only grew since the last call, only the previous matches are scored again,
+/// since a candidate that doesn't match a query can't match a longer one either.
+/// Candidates that are added later, like a directory listing coming in, are scored on their own.
+/// Large candidate lists are scored on multiple threads.
+pub struct FuzzyFilter {
+    candidates: Vec<FuzzyString>,
+    allow_non_contiguous_matches: bool,
+    query: String,
+    /// Indices into `candidates` that match `query`, best match first.
+    matches: Vec<usize>,
+    /// The score of each of `matches`. Empty if `query` is.
+    scores: Vec<i32>,
+}
+
+impl FuzzyFilter {
+    pub fn new<'a>(
+        candidates: impl IntoIterator<Item = &'a str>,
+        allow_non_contiguous_matches: bool,
+    ) -> Self {
+        let candidates: Vec<_> = candidates.into_iter().map(FuzzyString::new).collect();
+        let matches = (0..candidates.len()).collect();
+        Self {
+            candidates,
+            allow_non_contiguous_matches,
+            query: String::new(),
+            matches,
+            scores: Vec::new(),
+        }
+    }
+
+    /// Adds candidates, each with the index it has in the updated list of candidates.
+    /// The indices must be ascending. Only the new candidates are scored against the query.
+    pub fn insert<'a>(&mut self, added: impl IntoIterator<Item = (usize, &'a str)>) {
+        let old = mem::take(&mut self.candidates);
+        let mut old = old.into_iter();
+        // The index each of the old candidates moves to.
+        let mut remap = Vec::with_capacity(old.len());
+        let mut inserted = Vec::new();
+
+        for (index, candidate) in added {
+            while self.candidates.len() < index {
+                remap.push(self.candidates.len());
+                self.candidates.push(old.next().unwrap());
+            }
+            inserted.push(index);
+            self.candidates.push(FuzzyString::new(candidate));
+        }
+        for candidate in old {
+            remap.push(self.candidates.len());
+            self.candidates.push(candidate);
+        }
+
+        if self.query.is_empty() {
+            self.matches.clear();
+            self.matches.extend(0..self.candidates.len());
+            return;
+        }
+
+        let query = FuzzyString::new(&self.query);
+        let mut scored = score_candidates(
+            &self.candidates,
+            &inserted,
+            query.as_chars(),
+            self.allow_non_contiguous_matches,
+        );
+        scored.extend(self.scores.iter().zip(&self.matches).map(|(&s, &i)| (s, remap[i])));
+        self.set_scored(scored);
+    }
+
+    /// Scores the candidates against `query`.
+    /// An empty query matches all candidates, in their original order.
+    pub fn set_query(&mut self, query: &str) {
+        if query == self.query {
+            return;
+        }
+
+        let narrowing = !self.query.is_empty() && query.starts_with(self.query.as_str());
+        self.query.clear();
+        self.query.push_str(query);
+
+        if !narrowing {
+            self.matches.clear();
+            self.matches.extend(0..self.candidates.len());
+        }
+        self.scores.clear();
+        if query.is_empty() {
+            return;
+        }
+
+        let query = FuzzyString::new(query);
+        let scored = score_candidates(
+            &self.candidates,
+            &self.matches,
+            query.as_chars(),
+            self.allow_non_contiguous_matches,
+        );
+        self.set_scored(scored);
+    }
+
+    fn set_scored(&mut self, mut scored: Vec<(i32, usize)>) {
+        // Ties are broken by the original order, so that it doesn't matter whether we narrowed.
+        scored.sort_unstable_by(|a, b| b.0.cmp(&a.0).then(a.1.cmp(&b.1)));
+
+        self.matches.clear();
+        self.matches.extend(scored.iter().map(|&(_, i)| i));
+        self.scores.clear();
+        self.scores.extend(scored.iter().map(|&(s, _)| s));
+    }
+
+    /// Returns the indices of the candidates that match the query, best match first.
+    pub fn matches(&self) -> &[usize] {
+        &self.matches
+    }
+}
+
+/// Scores `candidates[indices]` against `query` and returns the matching (score, index) pairs.
+fn score_candidates(
+    candidates: &[FuzzyString],
+    indices: &[usize],
+    query: Chars,
+    allow_non_contiguous_matches: bool,
+) -> Vec<(i32, usize)> {
+    let score_range = |indices: &[usize]| {
+        let mut scores = Vec::new();
+        let mut matches = Vec::new();
+        let mut result = Vec::new();
+        for &i in indices {
+            let target = candidates[i].as_chars();
+            if let Some(score) =
+                score_chars(target, query, allow_non_contiguous_matches, &mut scores, &mut matches)
+                && score != NO_MATCH
+            {
+                result.push((score, i));
+            }
+        }
+        result
+    };
+
+    let threads = thread::available_parallelism()
+        .map_or(1, |n| n.get())
+        .min(indices.len() / PARALLEL_MIN_CANDIDATES)
+        .max(1);
+    if threads == 1 {
+        return score_range(indices);
+    }
+
+    thread::scope(|s| {
+        let workers: Vec<_> = indices
+            .chunks(indices.len().div_ceil(threads))
+            .map(|chunk| s.spawn(move || score_range(chunk)))
+            .collect();
+        workers.into_iter().flat_map(|w| w.join().unwrap()).collect()
+    })
+}
+
 pub fn score_fuzzy<'a>(
     arena: &'a Arena,
     haystack: &str,
     needle: &str,
     allow_non_contiguous_matches: bool,
 ) -> (i32, Vec<usize, &'a Arena>) {
-    if haystack.is_empty() || needle.is_empty() {
-        // return early if target or query are empty
-        return (NO_MATCH, Vec::new_in(arena));
-    }
-
     let scratch = scratch_arena(Some(arena));
     let target = map_chars(&scratch, haystack);
     let query = map_chars(&scratch, needle);
+    let mut target_lower = Vec::new_in(&*scratch);
+    let mut query_lower = Vec::new_in(&*scratch);
+    fold_chars(&scratch, haystack, &mut target_lower);
+    fold_chars(&scratch, needle, &mut query_lower);
+    let target = Chars { chars: &target, lower: &target_lower };
+    let query = Chars { chars: &query, lower: &query_lower };
 
-    if target.len() < query.len() {
-        // impossible for query to be contained in target
+    let mut scores = Vec::new_in(&*scratch);
+    let mut matches = Vec::new_in(&*scratch);
+    let Some(score) =
+        score_chars(target, query, allow_non_contiguous_matches, &mut scores, &mut matches)
+    else {
         return (NO_MATCH, Vec::new_in(arena));
+    };
+
+    // Restore Positions (starting from bottom right of matrix)
+    let mut positions = Vec::new_in(arena);
+    let target = target.chars;
+    let query = query.chars;
+
+    if !query.is_empty() && !target.is_empty() {
+        let mut query_index = query.len() - 1;
+        let mut target_index = target.len() - 1;
+
+        loop {
+            let current_index = query_index * target.len() + target_index;
+            if matches[current_index] == NO_MATCH {
+                if target_index == 0 {
+                    break;
+                }
+                target_index -= 1; // go left
+            } else {
+                positions.push(target_index);
+
+                // go up and left
+                if query_index == 0 || target_index == 0 {
+                    break;
+                }
+                query_index -= 1;
+                target_index -= 1;
+            }
+        }
+
+        positions.reverse();
     }
 
-    let target_lower = icu::fold_case(&scratch, haystack);
-    let query_lower = icu::fold_case(&scratch, needle);
-    let target_lower = map_chars(&scratch, &target_lower);
-    let query_lower = map_chars(&scratch, &query_lower);
+    (score, positions)
+}
 
+/// Fills the scorer matrix in `scores` and `matches` and returns the score.
+/// Returns `None` without touching the matrix if `query` can't possibly match.
+fn score_chars<A: Allocator>(
+    target: Chars,
+    query: Chars,
+    allow_non_contiguous_matches: bool,
+    scores: &mut Vec<i32, A>,
+    matches: &mut Vec<i32, A>,
+) -> Option<i32> {
+    if target.chars.is_empty() || query.chars.is_empty() {
+        // return early if target or query are empty
+        return None;
+    }
+    if target.chars.len() < query.chars.len() {
+        // impossible for query to be contained in target
+        return None;
+    }
+
+    let Chars { chars: target, lower: target_lower } = target;
+    let Chars { chars: query, lower: query_lower } = query;
+
+    // Every cell is written before it's read, so it's fine to keep the old contents around.
     let area = query.len() * target.len();
-    let mut scores = vec::from_elem_in(0, area, &*scratch);
-    let mut matches = vec::from_elem_in(0, area, &*scratch);
+    if scores.len() < area {
+        scores.resize(area, 0);
+        matches.resize(area, 0);
+    }
 
     //
     // Build Scorer Matrix:
@@ -105,7 +353,7 @@ pub fn score_fuzzy<'a>(
                         // found out this is contiguous otherwise there wouldn't have been a score
                         query_index > 0 ||
                         // lastly check if the query is completely contiguous at this index in the target
-                        target_lower[target_index..].starts_with(&query_lower)
+                        target_lower[target_index..].starts_with(query_lower)
                 )
             {
                 matches[current_index] = matches_sequence_len + 1;
@@ -120,36 +368,7 @@ pub fn score_fuzzy<'a>(
         }
     }
 
-    // Restore Positions (starting from bottom right of matrix)
-    let mut positions = Vec::new_in(arena);
-
-    if !query.is_empty() && !target.is_empty() {
-        let mut query_index = query.len() - 1;
-        let mut target_index = target.len() - 1;
-
-        loop {
-            let current_index = query_index * target.len() + target_index;
-            if matches[current_index] == NO_MATCH {
-                if target_index == 0 {
-                    break;
-                }
-                target_index -= 1; // go left
-            } else {
-                positions.push(target_index);
-
-                // go up and left
-                if query_index == 0 || target_index == 0 {
-                    break;
-                }
-                query_index -= 1;
-                target_index -= 1;
-            }
-        }
-
-        positions.reverse();
-    }
-
-    (scores[area - 1], positions)
+    Some(scores[area - 1])
 }
 
 fn compute_char_score(
@@ -213,6 +432,27 @@ fn score_separator_at_pos(ch: char) -> i32 {
     }
 }
 
+/// Appends the case-folded chars of `s` to `out`, one for each char in `s`.
+/// Chars that fold into several, like "ß" into "ss", are kept as they are,
+/// because the scorer relies on the two lining up.
+fn fold_chars<A: Allocator>(arena: &Arena, s: &str, out: &mut Vec<char, A>) {
+    // Case folding maps each char on its own, so if the number of chars didn't change, they line up.
+    let folded = icu::fold_case(arena, s);
+    if folded.chars().count() == s.chars().count() {
+        out.extend(folded.chars());
+        return;
+    }
+
+    for ch in s.chars() {
+        let folded = icu::fold_case(arena, ch.encode_utf8(&mut [0; 4]));
+        let mut it = folded.chars();
+        out.push(match (it.next(), it.next()) {
+            (Some(lower), None) => lower,
+            _ => ch,
+        });
+    }
+}
+
 fn map_chars<'a>(arena: &'a Arena, s: &str) -> Vec<char, &'a Arena> {
     let mut chars = Vec::with_capacity_in(s.len(), arena);
     chars.extend(s.chars());
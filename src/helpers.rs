@@ -291,3 +291,30 @@ impl AsciiStringHelpers for str {
         p.len() <= s.len() && s[..p.len()].eq_ignore_ascii_case(p)
     }
 }
+
+/// A xorshift64 PRNG for randomized tests.
+/// It always starts from the same seed, so that failures are reproducible.
+#[cfg(test)]
+pub struct TestRng(u64);
+
+#[cfg(test)]
+impl Default for TestRng {
+    fn default() -> Self {
+        Self(0x2545f4914f6cdd1d)
+    }
+}
+
+#[cfg(test)]
+impl TestRng {
+    pub fn next_u64(&mut self) -> u64 {
+        self.0 ^= self.0 << 13;
+        self.0 ^= self.0 >> 7;
+        self.0 ^= self.0 << 17;
+        self.0
+    }
+
+    /// Returns a random number in `0..n`.
+    pub fn below(&mut self, n: usize) -> usize {
+        (self.next_u64() % n as u64) as usize
+    }
+}
@@ -3,15 +3,17 @@
 
 //! Bindings to the ICU library.
 
+use std::cell::RefCell;
 use std::cmp::Ordering;
 use std::ffi::CStr;
-use std::mem;
 use std::mem::MaybeUninit;
 use std::ops::Range;
 use std::ptr::{null, null_mut};
+use std::{mem, thread};
 
 use crate::arena::{Arena, ArenaString, scratch_arena};
 use crate::buffer::TextBuffer;
+use crate::helpers::*;
 use crate::unicode::Utf8Chars;
 use crate::{apperr, arena_format, sys};
 
@@ -199,8 +201,203 @@ impl<'pivot> Converter<'pivot> {
     }
 }
 
+// SAFETY: An ICU converter may be used from any thread, just not from multiple at once.
+// The pivot buffer is exclusively borrowed, which makes it just as safe to send.
+unsafe impl Send for Converter<'_> {}
+
+impl Converter<'_> {
+    /// Returns where the input may be split so that each piece converts
+    /// to the same output on its own as it does as part of the whole.
+    /// Returns `None` if either encoding carries state across characters.
+    fn split_rule(&self) -> Option<SplitRule> {
+        use icu_ffi::*;
+
+        let f = assume_loaded();
+        let source = unsafe { (f.ucnv_getType)(self.source) };
+        let target = unsafe { (f.ucnv_getType)(self.target) };
+
+        let stateless = |t| {
+            matches!(
+                t,
+                UCNV_SBCS
+                    | UCNV_MBCS
+                    | UCNV_LATIN_1
+                    | UCNV_UTF8
+                    | UCNV_UTF16_BIG_ENDIAN
+                    | UCNV_UTF16_LITTLE_ENDIAN
+                    | UCNV_UTF32_BIG_ENDIAN
+                    | UCNV_UTF32_LITTLE_ENDIAN
+                    | UCNV_US_ASCII
+                    | UCNV_CESU8
+            )
+        };
+        if !stateless(source) || !stateless(target) {
+            return None;
+        }
+
+        Some(match source {
+            UCNV_SBCS | UCNV_LATIN_1 | UCNV_US_ASCII => SplitRule::Anywhere,
+            // The ASCII-based multibyte encodings (Shift-JIS, GBK, GB18030, EUC, Big5, ...)
+            // only use bytes >= 0x30 after the first byte of a character, so a line feed
+            // is always a character of its own.
+            UCNV_MBCS => SplitRule::AfterNewline,
+            UCNV_UTF8 | UCNV_CESU8 => SplitRule::Utf8,
+            UCNV_UTF16_BIG_ENDIAN => SplitRule::Utf16 { big_endian: true },
+            UCNV_UTF16_LITTLE_ENDIAN => SplitRule::Utf16 { big_endian: false },
+            _ => SplitRule::Units(4),
+        })
+    }
+
+    /// Converts `range` of the concatenated `input` parts in one go.
+    fn convert_range(&mut self, input: &[&[u8]], range: Range<usize>) -> apperr::Result<Vec<u8>> {
+        let mut output = Vec::with_capacity(range.len() + range.len() / 2);
+        let mut off = 0;
+
+        let mut step = |output: &mut Vec<u8>, chunk: &[u8]| {
+            output.reserve(PARALLEL_OUTPUT_CHUNK);
+            let (input_advance, output_advance) =
+                self.convert(chunk, output.spare_capacity_mut())?;
+            unsafe { output.set_len(output.len() + output_advance) };
+            apperr::Result::Ok((input_advance, output_advance))
+        };
+
+        for part in input {
+            let beg = range.start.clamp(off, off + part.len()) - off;
+            let end = range.end.clamp(off, off + part.len()) - off;
+            let mut chunk = &part[beg..end];
+            off += part.len();
+
+            while !chunk.is_empty() {
+                let (input_advance, _) = step(&mut output, chunk)?;
+                chunk = &chunk[input_advance..];
+            }
+        }
+
+        // Flush the state of the converter.
+        while step(&mut output, &[])?.1 != 0 {}
+
+        Ok(output)
+    }
+}
+
+/// Pieces of the input are at least this large. Smaller inputs aren't worth the threads.
+const PARALLEL_MIN_PIECE: usize = 256 * KIBI;
+/// The size of the pivot buffer of each converter in [`convert_parallel`].
+const PARALLEL_PIVOT_LEN: usize = 16 * KIBI;
+/// The output of [`convert_parallel`] grows by at least this much per conversion step.
+const PARALLEL_OUTPUT_CHUNK: usize = 64 * KIBI;
+/// How far [`SplitRule::AfterNewline`] looks for a newline before giving up on a split.
+const SPLIT_SCAN_LIMIT: usize = 64 * KIBI;
+
+#[derive(Clone, Copy)]
+enum SplitRule {
+    /// Every byte is a character.
+    Anywhere,
+    /// Every character is this many bytes long.
+    Units(usize),
+    /// UTF-16: Split between code units but not within surrogate pairs.
+    Utf16 { big_endian: bool },
+    /// Split after a line feed.
+    AfterNewline,
+    /// UTF-8: Split before a lead byte.
+    Utf8,
+}
+
+impl SplitRule {
+    /// Returns the first offset at or near `target` where `input` may be split, if any.
+    fn find(self, input: &[&[u8]], total: usize, target: usize) -> Option<usize> {
+        let byte_at = |mut off: usize| {
+            for part in input {
+                if off < part.len() {
+                    return Some(part[off]);
+                }
+                off -= part.len();
+            }
+            None
+        };
+
+        match self {
+            SplitRule::Anywhere => Some(target),
+            SplitRule::Units(n) => Some(target - target % n),
+            SplitRule::Utf16 { big_endian } => {
+                let off = target & !1;
+                let hi = byte_at(off - 2 + !big_endian as usize)?;
+                // Don't separate a high surrogate from the low surrogate after it.
+                Some(if (0xD8..=0xDB).contains(&hi) { off + 2 } else { off })
+            }
+            SplitRule::AfterNewline => (target..total.min(target + SPLIT_SCAN_LIMIT))
+                .find(|&off| byte_at(off) == Some(b'\n'))
+                .map(|off| off + 1),
+            SplitRule::Utf8 => (target..total.min(target + 4))
+                .find(|&off| byte_at(off).is_some_and(|b| (b & 0xC0) != 0x80)),
+        }
+    }
+}
+
+/// Returns whether [`convert_parallel`] can split a conversion between the two encodings
+/// into pieces. That's not the case if either of them is stateful (e.g. ISO-2022-JP).
+pub fn can_convert_parallel(source_encoding: &str, target_encoding: &str) -> bool {
+    let mut pivot = [MaybeUninit::uninit(); 1];
+    Converter::new(&mut pivot, source_encoding, target_encoding)
+        .is_ok_and(|c| c.split_rule().is_some())
+}
+
+/// Converts `input` from `source_encoding` to `target_encoding`, using multiple threads.
+///
+/// `input` is given in parts which are treated as if they were concatenated, for instance
+/// the text before and after the gap of a gap buffer. The input is split into one piece per
+/// thread, and the converted pieces are returned in order. Concatenated they're identical
+/// to what a single [`Converter`] would have produced.
+///
+/// If the input can't be split (see [`can_convert_parallel`]), it's converted as a single piece.
+pub fn convert_parallel(
+    input: &[&[u8]],
+    source_encoding: &str,
+    target_encoding: &str,
+) -> apperr::Result<Vec<Vec<u8>>> {
+    let total: usize = input.iter().map(|p| p.len()).sum();
+    let pieces = thread::available_parallelism()
+        .map_or(1, |n| n.get())
+        .min(total / PARALLEL_MIN_PIECE)
+        .max(1);
+
+    // The converters must be created on this thread, because `Converter::new` uses the scratch arenas.
+    let mut pivots: Vec<_> =
+        (0..pieces).map(|_| Box::<[u16]>::new_uninit_slice(PARALLEL_PIVOT_LEN)).collect();
+    let mut converters = Vec::with_capacity(pieces);
+    for pivot in &mut pivots {
+        converters.push(Converter::new(&mut pivot[..], source_encoding, target_encoding)?);
+    }
+
+    let rule = converters[0].split_rule();
+    let mut bounds = Vec::with_capacity(pieces + 1);
+    bounds.push(0);
+    for i in 1..pieces {
+        if let Some(rule) = rule
+            && let Some(off) = rule.find(input, total, total / pieces * i)
+            && off > *bounds.last().unwrap()
+            && off < total
+        {
+            bounds.push(off);
+        }
+    }
+    bounds.push(total);
+
+    let results: Vec<_> = thread::scope(|s| {
+        let workers: Vec<_> = converters
+            .into_iter()
+            .zip(bounds.windows(2))
+            .map(|(mut c, b)| s.spawn(move || c.convert_range(input, b[0]..b[1])))
+            .collect();
+        workers.into_iter().map(|w| w.join().unwrap()).collect()
+    });
+
+    results.into_iter().collect()
+}
+
 // In benchmarking, I found that the performance does not really change much by changing this value.
-// I picked 64 because it seemed like a reasonable lower bound.
+// I picked 64 because it seemed like a reasonable lower bound. Use the "search" benchmarks to tune it:
+// Larger chunks make searches with many hits slower, since ICU refills its chunk around each of them.
 const CACHE_SIZE: usize = 64;
 
 /// Caches a chunk of TextBuffer contents (UTF-8) in UTF-16 format.
@@ -289,7 +486,7 @@ impl Text {
         let ut = unsafe { &mut *ptr };
         ut.p_funcs = &FUNCS;
         ut.context = tb as *const TextBuffer as *mut _;
-        ut.a = tb.generation() as i64;
+        ut.a = tb.revision() as i64;
 
         // ICU unfortunately expects a `UText` instance to have valid contents after construction.
         utext_access(ut, 0, true);
@@ -390,7 +587,7 @@ fn utext_access_impl<'a>(
     let index_contained = index_contained as usize;
     let native_index = native_index as usize;
     let double_cache = double_cache_from_utext(ut);
-    let dirty = ut.a != tb.generation() as i64;
+    let dirty = ut.a != tb.revision() as i64;
 
     if dirty {
         // The text buffer contents have changed.
@@ -400,7 +597,7 @@ fn utext_access_impl<'a>(
         double_cache.cache[1].utf16_len = 0;
         double_cache.cache[0].utf8_range = 0..0;
         double_cache.cache[1].utf8_range = 0..0;
-        ut.a = tb.generation() as i64;
+        ut.a = tb.revision() as i64;
     } else {
         // Check if one of the caches already contains the requested range.
         for (i, cache) in double_cache.cache.iter_mut().enumerate() {
@@ -562,6 +759,24 @@ extern "C" fn utext_map_native_index_to_utf16(ut: &icu_ffi::UText, native_index:
     off_rel as i32
 }
 
+/// The number of compiled regexes that [`Regex::new`] keeps around. Typing into the
+/// search bar and deleting from it, toggling its options, and counting the hits
+/// in addition to searching them, all construct the same few regexes over and over.
+const REGEX_CACHE_LEN: usize = 16;
+
+/// A compiled regex that isn't attached to any text. [`Regex::new`] hands out clones of it,
+/// which share the compiled pattern and are a lot cheaper to make than compiling it again.
+struct CompiledRegex {
+    pattern: String,
+    flags: i32,
+    regex: Regex,
+}
+
+thread_local! {
+    /// Most recently used last.
+    static REGEX_CACHE: RefCell<Vec<CompiledRegex>> = const { RefCell::new(Vec::new()) };
+}
+
 /// A wrapper around ICU's `URegularExpression` struct.
 ///
 /// # Safety
@@ -588,12 +803,55 @@ impl Regex {
     pub const LITERAL: i32 = icu_ffi::UREGEX_LITERAL;
 
     /// Constructs a regex, plain and simple. Read `uregex_open` docs.
+    /// The last few compiled patterns are cached, so doing this repeatedly is cheap.
     ///
     /// # Safety
     ///
     /// The caller must ensure that the given `Text` outlives the returned `Regex` instance.
     pub unsafe fn new(pattern: &str, flags: i32, text: &Text) -> apperr::Result<Self> {
         let f = init_if_needed()?;
+        let flags = icu_ffi::UREGEX_MULTILINE | icu_ffi::UREGEX_ERROR_ON_UNKNOWN_ESCAPES | flags;
+
+        let regex = REGEX_CACHE.with_borrow_mut(|cache| {
+            let i = match cache.iter().position(|c| c.flags == flags && c.pattern == pattern) {
+                Some(i) => i,
+                None => {
+                    let regex = Self::compile(f, pattern, flags)?;
+                    if cache.len() >= REGEX_CACHE_LEN {
+                        cache.remove(0);
+                    }
+                    cache.push(CompiledRegex { pattern: pattern.to_string(), flags, regex });
+                    cache.len() - 1
+                }
+            };
+
+            let compiled = cache.remove(i);
+            let mut status = icu_ffi::U_ZERO_ERROR;
+            let ptr = unsafe { (f.uregex_clone)(compiled.regex.0, &mut status) };
+            cache.push(compiled);
+            if status.is_failure() {
+                return Err(status.as_error());
+            }
+            Ok(Self(unsafe { &mut *ptr }))
+        })?;
+
+        unsafe {
+            let mut status = icu_ffi::U_ZERO_ERROR;
+            // ICU describes the time unit as being dependent on CPU performance
+            // and "typically [in] the order of milliseconds", but this claim seems
+            // highly outdated. On my CPU from 2021, a limit of 4096 equals roughly 600ms.
+            // Clones don't inherit it, since it's a property of the matcher, not the pattern.
+            (f.uregex_setTimeLimit)(regex.0, 4096, &mut status);
+            (f.uregex_setUText)(regex.0, text.0 as *const _ as *mut _, &mut status);
+            if status.is_failure() {
+                return Err(status.as_error());
+            }
+        }
+
+        Ok(regex)
+    }
+
+    fn compile(f: &LibraryFunctions, pattern: &str, flags: i32) -> apperr::Result<Self> {
         unsafe {
             let scratch = scratch_arena(None);
             let mut utf16 = Vec::new_in(&*scratch);
@@ -601,18 +859,7 @@ impl Regex {
 
             utf16.extend(pattern.encode_utf16());
 
-            let ptr = (f.uregex_open)(
-                utf16.as_ptr(),
-                utf16.len() as i32,
-                icu_ffi::UREGEX_MULTILINE | icu_ffi::UREGEX_ERROR_ON_UNKNOWN_ESCAPES | flags,
-                None,
-                &mut status,
-            );
-            // ICU describes the time unit as being dependent on CPU performance
-            // and "typically [in] the order of milliseconds", but this claim seems
-            // highly outdated. On my CPU from 2021, a limit of 4096 equals roughly 600ms.
-            (f.uregex_setTimeLimit)(ptr, 4096, &mut status);
-            (f.uregex_setUText)(ptr, text.0 as *const _ as *mut _, &mut status);
+            let ptr = (f.uregex_open)(utf16.as_ptr(), utf16.len() as i32, flags, None, &mut status);
             if status.is_failure() {
                 return Err(status.as_error());
             }
@@ -629,7 +876,7 @@ impl Regex {
     ///
     /// The caller must ensure that the given `Text` outlives the `Regex` instance.
     pub unsafe fn set_text(&mut self, text: &mut Text, offset: usize) {
-        // Get `utext_access_impl` to detect the `TextBuffer::generation` change,
+        // Get `utext_access_impl` to detect the `TextBuffer::revision` change,
         // and refresh its contents. This ensures that ICU doesn't reuse
         // stale `UText::chunk_contents`, as it has no way tell that it's stale.
         utext_access(text.0, offset as i64, true);
@@ -676,11 +923,10 @@ impl Iterator for Regex {
 
 static mut ROOT_COLLATOR: Option<*mut icu_ffi::UCollator> = None;
 
-/// Compares two UTF-8 strings for sorting using ICU's collation algorithm.
-pub fn compare_strings(a: &[u8], b: &[u8]) -> Ordering {
+fn root_collator() -> *mut icu_ffi::UCollator {
     // OnceCell for people that want to put it into a static.
     #[allow(static_mut_refs)]
-    let coll = unsafe {
+    unsafe {
         if ROOT_COLLATOR.is_none() {
             ROOT_COLLATOR = Some(if let Ok(f) = init_if_needed() {
                 let mut status = icu_ffi::U_ZERO_ERROR;
@@ -690,7 +936,14 @@ pub fn compare_strings(a: &[u8], b: &[u8]) -> Ordering {
             });
         }
         ROOT_COLLATOR.unwrap_unchecked()
-    };
+    }
+}
+
+/// Compares two UTF-8 strings for sorting using ICU's collation algorithm.
+///
+/// When sorting many strings, consider [`sort_key`] instead.
+pub fn compare_strings(a: &[u8], b: &[u8]) -> Ordering {
+    let coll = root_collator();
 
     if coll.is_null() {
         compare_strings_ascii(a, b)
@@ -752,6 +1005,59 @@ fn compare_strings_ascii(a: &[u8], b: &[u8]) -> Ordering {
     a.len().cmp(&b.len())
 }
 
+/// Returns the collation sort key of the UTF-8 string `s`.
+///
+/// Comparing two keys byte-wise orders their strings like [`compare_strings`] does.
+/// Sorting with keys only calls into ICU once per string instead of once per comparison.
+/// Without ICU, the keys order ASCII case-insensitively, and by case after that.
+pub fn sort_key<'a>(arena: &'a Arena, s: &[u8]) -> Vec<u8, &'a Arena> {
+    let coll = root_collator();
+    let mut key = Vec::new_in(arena);
+
+    if coll.is_null() {
+        sort_key_ascii(&mut key, s);
+        return key;
+    }
+
+    let f = assume_loaded();
+    let scratch = scratch_arena(Some(arena));
+    let mut utf16 = Vec::with_capacity_in(s.len(), &*scratch);
+    for ch in Utf8Chars::new(s, 0) {
+        utf16.extend_from_slice(ch.encode_utf16(&mut [0; 2]));
+    }
+
+    // First, guess the output length. Keys of the root collator
+    // are usually less than 3 bytes per character.
+    let mut capacity = utf16.len() * 3 + 16;
+    loop {
+        key.reserve_exact(capacity);
+        let len = unsafe {
+            (f.ucol_getSortKey)(
+                coll,
+                utf16.as_ptr(),
+                utf16.len() as i32,
+                key.as_mut_ptr(),
+                key.capacity() as i32,
+            )
+        };
+        let len = len.max(0) as usize;
+        if len <= key.capacity() {
+            // The key is NUL-terminated. Leave that out, so that the keys can be compared as slices.
+            unsafe { key.set_len(len.saturating_sub(1)) };
+            return key;
+        }
+        capacity = len;
+    }
+}
+
+/// The fallback for [`sort_key`], modeled after [`compare_strings_ascii`].
+fn sort_key_ascii(key: &mut Vec<u8, &Arena>, s: &[u8]) {
+    key.reserve_exact(2 * s.len() + 1);
+    key.extend(s.iter().map(|c| c.to_ascii_lowercase()));
+    key.push(0);
+    key.extend_from_slice(s);
+}
+
 static mut ROOT_CASEMAP: Option<*mut icu_ffi::UCaseMap> = None;
 
 /// Converts the given UTF-8 string to lower case.
@@ -837,6 +1143,7 @@ struct LibraryFunctions {
     ucnv_getAvailableName: icu_ffi::ucnv_getAvailableName,
     ucnv_open: icu_ffi::ucnv_open,
     ucnv_close: icu_ffi::ucnv_close,
+    ucnv_getType: icu_ffi::ucnv_getType,
     ucnv_convertEx: icu_ffi::ucnv_convertEx,
     ucasemap_open: icu_ffi::ucasemap_open,
     ucasemap_utf8FoldCase: icu_ffi::ucasemap_utf8FoldCase,
@@ -845,6 +1152,7 @@ struct LibraryFunctions {
 
     // LIBICUI18N_PROC_NAMES
     uregex_open: icu_ffi::uregex_open,
+    uregex_clone: icu_ffi::uregex_clone,
     uregex_close: icu_ffi::uregex_close,
     uregex_setTimeLimit: icu_ffi::uregex_setTimeLimit,
     uregex_setUText: icu_ffi::uregex_setUText,
@@ -854,14 +1162,16 @@ struct LibraryFunctions {
     uregex_end64: icu_ffi::uregex_end64,
     ucol_open: icu_ffi::ucol_open,
     ucol_strcollUTF8: icu_ffi::ucol_strcollUTF8,
+    ucol_getSortKey: icu_ffi::ucol_getSortKey,
 }
 
-const LIBICUUC_PROC_NAMES: [&CStr; 9] = [
+const LIBICUUC_PROC_NAMES: [&CStr; 10] = [
     // Found in libicuuc.so on UNIX, icuuc.dll/icu.dll on Windows.
     c"u_errorName",
     c"ucnv_getAvailableName",
     c"ucnv_open",
     c"ucnv_close",
+    c"ucnv_getType",
     c"ucnv_convertEx",
     c"ucasemap_open",
     c"ucasemap_utf8FoldCase",
@@ -869,9 +1179,10 @@ const LIBICUUC_PROC_NAMES: [&CStr; 9] = [
     c"utext_close",
 ];
 
-const LIBICUI18N_PROC_NAMES: [&CStr; 10] = [
+const LIBICUI18N_PROC_NAMES: [&CStr; 12] = [
     // Found in libicui18n.so on UNIX, icuin.dll/icu.dll on Windows.
     c"uregex_open",
+    c"uregex_clone",
     c"uregex_close",
     c"uregex_setTimeLimit",
     c"uregex_setUText",
@@ -881,6 +1192,7 @@ const LIBICUI18N_PROC_NAMES: [&CStr; 10] = [
     c"uregex_end64",
     c"ucol_open",
     c"ucol_strcollUTF8",
+    c"ucol_getSortKey",
 ];
 
 enum LibraryFunctionsState {
@@ -1027,6 +1339,21 @@ mod icu_ffi {
 
     pub type ucnv_close = unsafe extern "C" fn(converter: *mut UConverter);
 
+    pub type ucnv_getType = unsafe extern "C" fn(converter: *const UConverter) -> UConverterType;
+
+    // The subset of `UConverterType` that we care about.
+    pub type UConverterType = c_int;
+    pub const UCNV_SBCS: UConverterType = 0;
+    pub const UCNV_MBCS: UConverterType = 2;
+    pub const UCNV_LATIN_1: UConverterType = 3;
+    pub const UCNV_UTF8: UConverterType = 4;
+    pub const UCNV_UTF16_BIG_ENDIAN: UConverterType = 5;
+    pub const UCNV_UTF16_LITTLE_ENDIAN: UConverterType = 6;
+    pub const UCNV_UTF32_BIG_ENDIAN: UConverterType = 7;
+    pub const UCNV_UTF32_LITTLE_ENDIAN: UConverterType = 8;
+    pub const UCNV_US_ASCII: UConverterType = 26;
+    pub const UCNV_CESU8: UConverterType = 31;
+
     pub type ucnv_convertEx = unsafe extern "C" fn(
         target_cnv: *mut UConverter,
         source_cnv: *mut UConverter,
@@ -1082,6 +1409,14 @@ mod icu_ffi {
         status: &mut UErrorCode,
     ) -> UCollationResult;
 
+    pub type ucol_getSortKey = unsafe extern "C" fn(
+        coll: *const UCollator,
+        source: *const u16,
+        source_length: i32,
+        result: *mut u8,
+        result_length: i32,
+    ) -> i32;
+
     // UText callback functions
     pub type UTextClone = unsafe extern "C" fn(
         dest: *mut UText,
@@ -1210,6 +1545,10 @@ mod icu_ffi {
         pe: Option<&mut UParseError>,
         status: &mut UErrorCode,
     ) -> *mut URegularExpression;
+    pub type uregex_clone = unsafe extern "C" fn(
+        regexp: *const URegularExpression,
+        status: &mut UErrorCode,
+    ) -> *mut URegularExpression;
     pub type uregex_close = unsafe extern "C" fn(regexp: *mut URegularExpression);
     pub type uregex_setTimeLimit =
         unsafe extern "C" fn(regexp: *mut URegularExpression, limit: i32, status: &mut UErrorCode);
@@ -1253,4 +1592,25 @@ mod tests {
         assert_eq!(compare_strings_ascii(b"hallo", b"Hello"), Ordering::Less);
         assert_eq!(compare_strings_ascii(b"Hello", b"hallo"), Ordering::Greater);
     }
+
+    #[test]
+    fn test_sort_key_ascii() {
+        let arena = Arena::new(64 * KIBI).unwrap();
+        let cmp = |a: &[u8], b: &[u8]| {
+            let mut key_a = Vec::new_in(&arena);
+            let mut key_b = Vec::new_in(&arena);
+            sort_key_ascii(&mut key_a, a);
+            sort_key_ascii(&mut key_b, b);
+            key_a.cmp(&key_b)
+        };
+
+        // The same cases as for `compare_strings_ascii`.
+        assert_eq!(cmp(b"", b""), Ordering::Equal);
+        assert_eq!(cmp(b"hello", b"hello"), Ordering::Equal);
+        assert_eq!(cmp(b"abc", b"abcd"), Ordering::Less);
+        assert_eq!(cmp(b"abcd", b"abc"), Ordering::Greater);
+        assert_eq!(cmp(b"AbC", b"aBc"), Ordering::Less);
+        assert_eq!(cmp(b"hallo", b"Hello"), Ordering::Less);
+        assert_eq!(cmp(b"Hello", b"hallo"), Ordering::Greater);
+    }
 }
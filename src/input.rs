@@ -505,9 +505,14 @@ impl<'input> Stream<'_, '_, 'input> {
     #[cold]
     fn handle_bracketed_paste(&mut self) -> Option<Input<'input>> {
         let beg = self.stream.offset();
-        let mut end = beg;
+        let mut end;
 
-        while let Some(token) = self.stream.next() {
+        loop {
+            // Most of a paste is text. Only escape sequences need a closer look.
+            end = self.stream.skip_to_escape();
+            let Some(token) = self.stream.next() else {
+                break;
+            };
             if let vt::Token::Csi(csi) = token
                 && csi.final_byte == '~'
                 && csi.params[0] == 201
@@ -515,7 +520,6 @@ impl<'input> Stream<'_, '_, 'input> {
                 self.parser.bracketed_paste = false;
                 break;
             }
-            end = self.stream.offset();
         }
 
         if end != beg {
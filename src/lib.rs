@@ -10,7 +10,8 @@
     maybe_uninit_fill,
     maybe_uninit_slice,
     maybe_uninit_uninit_array_transpose,
-    os_string_truncate
+    os_string_truncate,
+    write_all_vectored
 )]
 #![allow(clippy::missing_transmute_annotations, clippy::new_without_default, stable_features)]
 
@@ -23,6 +24,7 @@ pub mod buffer;
 pub mod cell;
 pub mod document;
 pub mod framebuffer;
+pub mod fuzzy;
 pub mod hash;
 pub mod helpers;
 pub mod icu;
@@ -31,6 +33,7 @@ pub mod oklab;
 pub mod path;
 pub mod simd;
 pub mod sys;
+pub mod trace;
 pub mod tui;
 pub mod unicode;
 pub mod vt;
@@ -7,6 +7,8 @@
 
 #![allow(clippy::excessive_precision)]
 
+use crate::simd::{memset, skip_run};
+
 /// An Oklab color with alpha.
 pub struct Lab {
     pub l: f32,
@@ -67,9 +69,54 @@ pub fn oklab_to_srgb(c: Lab) -> u32 {
 
 /// Blends two 32-bit sRGB colors in the Oklab color space.
 pub fn oklab_blend(dst: u32, src: u32) -> u32 {
-    let dst = srgb_to_oklab(dst);
-    let src = srgb_to_oklab(src);
+    blend(&srgb_to_oklab(dst), &srgb_to_oklab(src))
+}
+
+/// The log2 of the number of entries in a [`Blender`]'s cache table.
+const BLENDER_CACHE_LOG2_SIZE: usize = 6;
+
+/// Blends a single color onto many others, like [`oklab_blend`].
+///
+/// UI colors come from a small palette, so this converts the source color only once
+/// and remembers the results for recent destination colors in a small cache table.
+/// See: <https://fgiesen.wordpress.com/2019/02/11/cache-tables/>
+pub struct Blender {
+    src: Lab,
+    cache: [(u32, u32); 1 << BLENDER_CACHE_LOG2_SIZE],
+}
+
+impl Blender {
+    pub fn new(src: u32) -> Self {
+        let src = srgb_to_oklab(src);
+        // Every slot starts out with the correct result for 0, the only key that fits in all of them.
+        let zero = blend(&srgb_to_oklab(0), &src);
+        Self { src, cache: [(0, zero); 1 << BLENDER_CACHE_LOG2_SIZE] }
+    }
+
+    /// Blends the source color onto `dst`.
+    pub fn blend(&mut self, dst: u32) -> u32 {
+        let idx = (dst.wrapping_mul(2654435769) >> (32 - BLENDER_CACHE_LOG2_SIZE)) as usize;
+        let slot = &mut self.cache[idx];
+        if slot.0 != dst {
+            *slot = (dst, blend(&srgb_to_oklab(dst), &self.src));
+        }
+        slot.1
+    }
+
+    /// Blends the source color onto each color in `row`.
+    /// Runs of the same color are only looked at once.
+    pub fn blend_row(&mut self, row: &mut [u32]) {
+        let mut off = 0;
+        while off < row.len() {
+            let end = skip_run(row, off);
+            let c = self.blend(row[off]);
+            memset(&mut row[off..end], c);
+            off = end;
+        }
+    }
+}
 
+fn blend(dst: &Lab, src: &Lab) -> u32 {
     let inv_a = 1.0 - src.alpha;
     let l = src.l + dst.l * inv_a;
     let a = src.a + dst.a * inv_a;
@@ -126,3 +173,21 @@ const SRGB_TO_RGB_LUT: [f32; 256] = [
     0.7454043627, 0.7529423237, 0.7605246305, 0.7681512833, 0.7758223414, 0.7835379243, 0.7912980318, 0.7991028428, 0.8069523573, 0.8148466945, 0.8227858543, 0.8307699561, 0.8387991190, 0.8468732834, 0.8549926877, 0.8631572723,
     0.8713672161, 0.8796223402, 0.8879231811, 0.8962693810, 0.9046613574, 0.9130986929, 0.9215820432, 0.9301108718, 0.9386858940, 0.9473065734, 0.9559735060, 0.9646862745, 0.9734454751, 0.9822505713, 0.9911022186, 1.0000000000,
 ];
+
+#[cfg(test)]
+mod test {
+    use super::*;
+
+    #[test]
+    fn test_blender() {
+        let src = 0x7f3aae3f;
+        let mut row: Vec<u32> =
+            (0..1000u32).map(|i| (i / 3).wrapping_mul(0x01f00ba7) % 5).collect();
+        let expected: Vec<u32> = row.iter().map(|&c| oklab_blend(c, src)).collect();
+
+        let mut blender = Blender::new(src);
+        blender.blend_row(&mut row);
+        assert_eq!(row, expected);
+        assert_eq!(blender.blend(0xff212cbe), oklab_blend(0xff212cbe, src));
+    }
+}
@@ -0,0 +1,340 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+//! Skips over runs of ASCII characters.
+//!
+//! [`skip_ascii`] stops at the first non-ASCII byte, while [`skip_printable_ascii`]
+//! additionally stops at control characters (C0 and DEL), like tabs and newlines.
+
+use std::ptr;
+
+/// Returns the index of the first non-ASCII byte in `haystack`,
+/// starting the search at `offset`. If there's none, `haystack.len()` is returned.
+///
+/// ASCII is always valid UTF-8 and maps 1:1 to `char`s, so this allows
+/// UTF-8 decoders to skip the bulk of typical text without looking at it.
+pub fn skip_ascii(haystack: &[u8], offset: usize) -> usize {
+    unsafe {
+        let beg = haystack.as_ptr();
+        let end = beg.add(haystack.len());
+        let it = beg.add(offset.min(haystack.len()));
+        let it = skip_ascii_raw(it, end);
+        it.offset_from_unsigned(beg)
+    }
+}
+
+/// Returns the index of the first byte in `haystack` that isn't printable ASCII (`0x20..=0x7E`),
+/// starting the search at `offset`. If there's none, `haystack.len()` is returned.
+///
+/// Each printable ASCII character is a grapheme cluster of its own and 1 column wide,
+/// except if it's followed by a combining character.
+pub fn skip_printable_ascii(haystack: &[u8], offset: usize) -> usize {
+    unsafe {
+        let beg = haystack.as_ptr();
+        let end = beg.add(haystack.len());
+        let it = beg.add(offset.min(haystack.len()));
+        let it = skip_printable_ascii_raw(it, end);
+        it.offset_from_unsigned(beg)
+    }
+}
+
+unsafe fn skip_ascii_raw(beg: *const u8, end: *const u8) -> *const u8 {
+    #[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
+    return unsafe { SKIP_ASCII_DISPATCH(beg, end) };
+
+    #[cfg(target_arch = "aarch64")]
+    return unsafe { skip_ascii_neon(beg, end) };
+
+    #[allow(unreachable_code)]
+    return unsafe { skip_ascii_fallback(beg, end) };
+}
+
+unsafe fn skip_ascii_fallback(mut beg: *const u8, end: *const u8) -> *const u8 {
+    unsafe {
+        // A word at a time is still considerably faster than a byte at a time.
+        const HIGH_BITS: usize = usize::from_ne_bytes([0x80; size_of::<usize>()]);
+
+        while end.offset_from_unsigned(beg) >= size_of::<usize>() {
+            let m = (beg as *const usize).read_unaligned() & HIGH_BITS;
+            if m != 0 {
+                let bit = if cfg!(target_endian = "little") {
+                    m.trailing_zeros()
+                } else {
+                    m.leading_zeros()
+                };
+                return beg.add(bit as usize / 8);
+            }
+            beg = beg.add(size_of::<usize>());
+        }
+
+        while !ptr::eq(beg, end) && *beg < 0x80 {
+            beg = beg.add(1);
+        }
+        beg
+    }
+}
+
+unsafe fn skip_printable_ascii_raw(beg: *const u8, end: *const u8) -> *const u8 {
+    #[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
+    return unsafe { SKIP_PRINTABLE_ASCII_DISPATCH(beg, end) };
+
+    #[cfg(target_arch = "aarch64")]
+    return unsafe { skip_printable_ascii_neon(beg, end) };
+
+    #[allow(unreachable_code)]
+    return unsafe { skip_printable_ascii_fallback(beg, end) };
+}
+
+unsafe fn skip_printable_ascii_fallback(mut beg: *const u8, end: *const u8) -> *const u8 {
+    unsafe {
+        while !ptr::eq(beg, end) && (0x20..0x7F).contains(&*beg) {
+            beg = beg.add(1);
+        }
+        beg
+    }
+}
+
+// See `MEMCHR2_DISPATCH` for an explanation.
+#[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
+static mut SKIP_ASCII_DISPATCH: unsafe fn(beg: *const u8, end: *const u8) -> *const u8 =
+    skip_ascii_dispatch;
+
+#[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
+unsafe fn skip_ascii_dispatch(beg: *const u8, end: *const u8) -> *const u8 {
+    let func = if is_x86_feature_detected!("avx2") { skip_ascii_avx2 } else { skip_ascii_sse2 };
+    unsafe { SKIP_ASCII_DISPATCH = func };
+    unsafe { func(beg, end) }
+}
+
+#[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
+static mut SKIP_PRINTABLE_ASCII_DISPATCH: unsafe fn(beg: *const u8, end: *const u8) -> *const u8 =
+    skip_printable_ascii_dispatch;
+
+#[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
+unsafe fn skip_printable_ascii_dispatch(beg: *const u8, end: *const u8) -> *const u8 {
+    let func = if is_x86_feature_detected!("avx2") {
+        skip_printable_ascii_avx2
+    } else {
+        skip_printable_ascii_sse2
+    };
+    unsafe { SKIP_PRINTABLE_ASCII_DISPATCH = func };
+    unsafe { func(beg, end) }
+}
+
+// The SIMD implementations make use of the fact that `movemask` extracts
+// the high bit of each byte, which is exactly the one that marks non-ASCII.
+
+#[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
+#[target_feature(enable = "sse2")]
+unsafe fn skip_ascii_sse2(mut beg: *const u8, end: *const u8) -> *const u8 {
+    unsafe {
+        #[cfg(target_arch = "x86")]
+        use std::arch::x86::*;
+        #[cfg(target_arch = "x86_64")]
+        use std::arch::x86_64::*;
+
+        let mut remaining = end.offset_from_unsigned(beg);
+
+        while remaining >= 16 {
+            let v = _mm_loadu_si128(beg as *const _);
+            let m = _mm_movemask_epi8(v) as u32;
+
+            if m != 0 {
+                return beg.add(m.trailing_zeros() as usize);
+            }
+
+            beg = beg.add(16);
+            remaining -= 16;
+        }
+
+        skip_ascii_fallback(beg, end)
+    }
+}
+
+#[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
+#[target_feature(enable = "avx2")]
+unsafe fn skip_ascii_avx2(mut beg: *const u8, end: *const u8) -> *const u8 {
+    unsafe {
+        #[cfg(target_arch = "x86")]
+        use std::arch::x86::*;
+        #[cfg(target_arch = "x86_64")]
+        use std::arch::x86_64::*;
+
+        let mut remaining = end.offset_from_unsigned(beg);
+
+        while remaining >= 32 {
+            let v = _mm256_loadu_si256(beg as *const _);
+            let m = _mm256_movemask_epi8(v) as u32;
+
+            if m != 0 {
+                return beg.add(m.trailing_zeros() as usize);
+            }
+
+            beg = beg.add(32);
+            remaining -= 32;
+        }
+
+        skip_ascii_fallback(beg, end)
+    }
+}
+
+// x86 only has signed byte comparisons, which conveniently treat all bytes >= 0x80
+// as negative. A single pair of comparisons thus checks for `0x20..=0x7E`.
+
+#[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
+#[target_feature(enable = "sse2")]
+unsafe fn skip_printable_ascii_sse2(mut beg: *const u8, end: *const u8) -> *const u8 {
+    unsafe {
+        #[cfg(target_arch = "x86")]
+        use std::arch::x86::*;
+        #[cfg(target_arch = "x86_64")]
+        use std::arch::x86_64::*;
+
+        let lo = _mm_set1_epi8(0x1F);
+        let hi = _mm_set1_epi8(0x7F);
+        let mut remaining = end.offset_from_unsigned(beg);
+
+        while remaining >= 16 {
+            let v = _mm_loadu_si128(beg as *const _);
+            let printable = _mm_and_si128(_mm_cmpgt_epi8(v, lo), _mm_cmplt_epi8(v, hi));
+            let m = !_mm_movemask_epi8(printable) as u32 & 0xFFFF;
+
+            if m != 0 {
+                return beg.add(m.trailing_zeros() as usize);
+            }
+
+            beg = beg.add(16);
+            remaining -= 16;
+        }
+
+        skip_printable_ascii_fallback(beg, end)
+    }
+}
+
+#[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
+#[target_feature(enable = "avx2")]
+unsafe fn skip_printable_ascii_avx2(mut beg: *const u8, end: *const u8) -> *const u8 {
+    unsafe {
+        #[cfg(target_arch = "x86")]
+        use std::arch::x86::*;
+        #[cfg(target_arch = "x86_64")]
+        use std::arch::x86_64::*;
+
+        let lo = _mm256_set1_epi8(0x1F);
+        let hi = _mm256_set1_epi8(0x7F);
+        let mut remaining = end.offset_from_unsigned(beg);
+
+        while remaining >= 32 {
+            let v = _mm256_loadu_si256(beg as *const _);
+            let printable = _mm256_and_si256(_mm256_cmpgt_epi8(v, lo), _mm256_cmpgt_epi8(hi, v));
+            let m = !(_mm256_movemask_epi8(printable) as u32);
+
+            if m != 0 {
+                return beg.add(m.trailing_zeros() as usize);
+            }
+
+            beg = beg.add(32);
+            remaining -= 32;
+        }
+
+        skip_printable_ascii_fallback(beg, end)
+    }
+}
+
+#[cfg(target_arch = "aarch64")]
+unsafe fn skip_ascii_neon(mut beg: *const u8, end: *const u8) -> *const u8 {
+    unsafe {
+        use std::arch::aarch64::*;
+
+        while end.offset_from_unsigned(beg) >= 16 {
+            let v = vld1q_u8(beg as *const _);
+
+            if vmaxvq_u8(v) >= 0x80 {
+                // See `memchr2_neon`.
+                let c = vcgeq_u8(v, vdupq_n_u8(0x80));
+                let m = vreinterpretq_u16_u8(c);
+                let m = vshrn_n_u16(m, 4);
+                let m = vreinterpret_u64_u8(m);
+                let m = vget_lane_u64(m, 0);
+                return beg.add(m.trailing_zeros() as usize >> 2);
+            }
+
+            beg = beg.add(16);
+        }
+
+        skip_ascii_fallback(beg, end)
+    }
+}
+
+#[cfg(target_arch = "aarch64")]
+unsafe fn skip_printable_ascii_neon(mut beg: *const u8, end: *const u8) -> *const u8 {
+    unsafe {
+        use std::arch::aarch64::*;
+
+        let lo = vdupq_n_u8(0x20);
+        let range = vdupq_n_u8(0x7F - 0x20);
+
+        while end.offset_from_unsigned(beg) >= 16 {
+            let v = vld1q_u8(beg as *const _);
+            // Bytes outside of `0x20..=0x7E` wrap around to >= 0x5F.
+            let c = vcgeq_u8(vsubq_u8(v, lo), range);
+
+            if vmaxvq_u8(c) != 0 {
+                // See `memchr2_neon`.
+                let m = vreinterpretq_u16_u8(c);
+                let m = vshrn_n_u16(m, 4);
+                let m = vreinterpret_u64_u8(m);
+                let m = vget_lane_u64(m, 0);
+                return beg.add(m.trailing_zeros() as usize >> 2);
+            }
+
+            beg = beg.add(16);
+        }
+
+        skip_printable_ascii_fallback(beg, end)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_empty() {
+        assert_eq!(skip_ascii(b"", 0), 0);
+        assert_eq!(skip_ascii(b"abc", 3), 3);
+        assert_eq!(skip_ascii(b"abc", 10), 3);
+    }
+
+    #[test]
+    fn test_positions() {
+        let mut haystack = [b'a'; 100];
+
+        assert_eq!(skip_ascii(&haystack, 0), 100);
+
+        for i in 0..haystack.len() {
+            haystack[i] = 0x80 | i as u8;
+            for offset in [0, 1, 7, 15, 16, 31, 33, 64] {
+                let expected = if offset <= i { i } else { 100 };
+                assert_eq!(skip_ascii(&haystack, offset), expected);
+            }
+            haystack[i] = b'a';
+        }
+    }
+
+    #[test]
+    fn test_printable() {
+        let mut haystack = [b'~'; 100];
+
+        assert_eq!(skip_printable_ascii(&haystack, 0), 100);
+
+        for ch in [0x00, 0x09, 0x0A, 0x0D, 0x1F, 0x7F, 0x80, 0xC3, 0xFF] {
+            for i in [0, 1, 15, 16, 31, 32, 50, 99] {
+                haystack[i] = ch;
+                assert_eq!(skip_printable_ascii(&haystack, 0), i);
+                assert_eq!(skip_printable_ascii(&haystack, i + 1), 100);
+                haystack[i] = b' ';
+            }
+        }
+    }
+}
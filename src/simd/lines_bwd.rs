@@ -0,0 +1,283 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+//! Counts newlines going backward, stopping at a given line.
+
+use std::ptr;
+
+use crate::helpers::CoordType;
+
+/// Starting from the `offset` in `haystack` with a current line index of
+/// `line`, this seeks backwards to the `line_stop`-nth line and returns the
+/// new offset and the line index at that point.
+///
+/// Note that this function differs from `lines_fwd` in that it
+/// seeks backwards even if the `line` is already at `line_stop`.
+/// This allows you to ensure (or test) whether `offset` is at a line start.
+///
+/// It returns an offset *past* the newline and thus at the start of a line.
+/// If the start of the `haystack` is reached, it returns 0.
+pub fn lines_bwd(
+    haystack: &[u8],
+    offset: usize,
+    line: CoordType,
+    line_stop: CoordType,
+) -> (usize, CoordType) {
+    unsafe {
+        let beg = haystack.as_ptr();
+        let it = beg.add(offset.min(haystack.len()));
+        let (it, line) = lines_bwd_raw(beg, it, line, line_stop);
+        (it.offset_from_unsigned(beg), line)
+    }
+}
+
+unsafe fn lines_bwd_raw(
+    beg: *const u8,
+    end: *const u8,
+    line: CoordType,
+    line_stop: CoordType,
+) -> (*const u8, CoordType) {
+    #[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
+    return unsafe { LINES_BWD_DISPATCH(beg, end, line, line_stop) };
+
+    #[cfg(target_arch = "aarch64")]
+    return unsafe { lines_bwd_neon(beg, end, line, line_stop) };
+
+    #[allow(unreachable_code)]
+    return unsafe { lines_bwd_fallback(beg, end, line, line_stop) };
+}
+
+unsafe fn lines_bwd_fallback(
+    beg: *const u8,
+    mut end: *const u8,
+    mut line: CoordType,
+    line_stop: CoordType,
+) -> (*const u8, CoordType) {
+    unsafe {
+        while !ptr::eq(end, beg) {
+            let prev = end.sub(1);
+            if *prev == b'\n' {
+                if line <= line_stop {
+                    break;
+                }
+                line -= 1;
+            }
+            end = prev;
+        }
+        (end, line)
+    }
+}
+
+// See `MEMCHR2_DISPATCH` for an explanation.
+#[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
+static mut LINES_BWD_DISPATCH: unsafe fn(
+    beg: *const u8,
+    end: *const u8,
+    line: CoordType,
+    line_stop: CoordType,
+) -> (*const u8, CoordType) = lines_bwd_dispatch;
+
+#[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
+unsafe fn lines_bwd_dispatch(
+    beg: *const u8,
+    end: *const u8,
+    line: CoordType,
+    line_stop: CoordType,
+) -> (*const u8, CoordType) {
+    let func = if is_x86_feature_detected!("avx2") && is_x86_feature_detected!("popcnt") {
+        lines_bwd_avx2
+    } else {
+        lines_bwd_sse2
+    };
+    unsafe { LINES_BWD_DISPATCH = func };
+    unsafe { func(beg, end, line, line_stop) }
+}
+
+// Just like in `lines_fwd`, the SIMD implementations skip entire 64 byte blocks
+// as long as all of their newlines are above `line_stop`. Every newline passed
+// that way decrements the line, and skipping `count` of them is only permitted
+// if the last one would still be passed by the fallback: `line - count >= line_stop`.
+
+#[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
+#[target_feature(enable = "sse2")]
+unsafe fn lines_bwd_sse2(
+    beg: *const u8,
+    mut end: *const u8,
+    mut line: CoordType,
+    line_stop: CoordType,
+) -> (*const u8, CoordType) {
+    unsafe {
+        #[cfg(target_arch = "x86")]
+        use std::arch::x86::*;
+        #[cfg(target_arch = "x86_64")]
+        use std::arch::x86_64::*;
+
+        let lf = _mm_set1_epi8(b'\n' as i8);
+        let zero = _mm_setzero_si128();
+        let mut remaining = end.offset_from_unsigned(beg);
+
+        while remaining >= 64 {
+            let chunk = end.sub(64);
+            let v1 = _mm_loadu_si128(chunk as *const _);
+            let v2 = _mm_loadu_si128(chunk.add(16) as *const _);
+            let v3 = _mm_loadu_si128(chunk.add(32) as *const _);
+            let v4 = _mm_loadu_si128(chunk.add(48) as *const _);
+
+            // See `lines_fwd_sse2`.
+            let a = _mm_add_epi8(_mm_cmpeq_epi8(v1, lf), _mm_cmpeq_epi8(v2, lf));
+            let b = _mm_add_epi8(_mm_cmpeq_epi8(v3, lf), _mm_cmpeq_epi8(v4, lf));
+            let sum = _mm_sub_epi8(zero, _mm_add_epi8(a, b));
+            let sum = _mm_sad_epu8(sum, zero);
+            let count = _mm_cvtsi128_si32(sum) + _mm_cvtsi128_si32(_mm_unpackhi_epi64(sum, sum));
+
+            let next = line - count as CoordType;
+            if next < line_stop {
+                break;
+            }
+
+            line = next;
+            end = chunk;
+            remaining -= 64;
+        }
+
+        lines_bwd_fallback(beg, end, line, line_stop)
+    }
+}
+
+#[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
+#[target_feature(enable = "avx2,popcnt")]
+unsafe fn lines_bwd_avx2(
+    beg: *const u8,
+    mut end: *const u8,
+    mut line: CoordType,
+    line_stop: CoordType,
+) -> (*const u8, CoordType) {
+    unsafe {
+        #[cfg(target_arch = "x86")]
+        use std::arch::x86::*;
+        #[cfg(target_arch = "x86_64")]
+        use std::arch::x86_64::*;
+
+        let lf = _mm256_set1_epi8(b'\n' as i8);
+        let mut remaining = end.offset_from_unsigned(beg);
+
+        while remaining >= 64 {
+            let chunk = end.sub(64);
+            let v1 = _mm256_loadu_si256(chunk as *const _);
+            let v2 = _mm256_loadu_si256(chunk.add(32) as *const _);
+            let m1 = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v1, lf)) as u32;
+            let m2 = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v2, lf)) as u32;
+            let count = m1.count_ones() + m2.count_ones();
+
+            let next = line - count as CoordType;
+            if next < line_stop {
+                break;
+            }
+
+            line = next;
+            end = chunk;
+            remaining -= 64;
+        }
+
+        lines_bwd_fallback(beg, end, line, line_stop)
+    }
+}
+
+#[cfg(target_arch = "aarch64")]
+unsafe fn lines_bwd_neon(
+    beg: *const u8,
+    mut end: *const u8,
+    mut line: CoordType,
+    line_stop: CoordType,
+) -> (*const u8, CoordType) {
+    unsafe {
+        use std::arch::aarch64::*;
+
+        let lf = vdupq_n_u8(b'\n');
+        let one = vdupq_n_u8(1);
+        let mut remaining = end.offset_from_unsigned(beg);
+
+        while remaining >= 64 {
+            let chunk = end.sub(64);
+            let v1 = vld1q_u8(chunk as *const _);
+            let v2 = vld1q_u8(chunk.add(16) as *const _);
+            let v3 = vld1q_u8(chunk.add(32) as *const _);
+            let v4 = vld1q_u8(chunk.add(48) as *const _);
+
+            let a = vaddq_u8(vandq_u8(vceqq_u8(v1, lf), one), vandq_u8(vceqq_u8(v2, lf), one));
+            let b = vaddq_u8(vandq_u8(vceqq_u8(v3, lf), one), vandq_u8(vceqq_u8(v4, lf), one));
+            let count = vaddvq_u8(vaddq_u8(a, b));
+
+            let next = line - count as CoordType;
+            if next < line_stop {
+                break;
+            }
+
+            line = next;
+            end = chunk;
+            remaining -= 64;
+        }
+
+        lines_bwd_fallback(beg, end, line, line_stop)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::helpers::TestRng;
+
+    fn reference(
+        haystack: &[u8],
+        mut offset: usize,
+        mut line: CoordType,
+        stop: CoordType,
+    ) -> (usize, CoordType) {
+        while offset > 0 {
+            if haystack[offset - 1] == b'\n' {
+                if line <= stop {
+                    break;
+                }
+                line -= 1;
+            }
+            offset -= 1;
+        }
+        (offset, line)
+    }
+
+    #[test]
+    fn test_empty() {
+        assert_eq!(lines_bwd(b"", 0, 0, 0), (0, 0));
+        assert_eq!(lines_bwd(b"abc", 3, 0, 0), (0, 0));
+    }
+
+    #[test]
+    fn test_basic() {
+        let haystack = b"a\nbc\n\ndef\n";
+        assert_eq!(lines_bwd(haystack, 10, 4, 4), (10, 4));
+        assert_eq!(lines_bwd(haystack, 9, 3, 3), (6, 3));
+        assert_eq!(lines_bwd(haystack, 9, 3, 1), (2, 1));
+        assert_eq!(lines_bwd(haystack, 9, 3, 0), (0, 0));
+    }
+
+    #[test]
+    fn test_random() {
+        let mut rng = TestRng::default();
+        let mut haystack = vec![0u8; 4096];
+
+        for density in [1, 4, 16, 64, 256] {
+            for ch in &mut haystack {
+                *ch = if rng.below(density) == 0 { b'\n' } else { b'a' };
+            }
+
+            for offset in [0, 1, 63, 64, 65, 1000, 4096] {
+                for stop in [0, 1, 2, 3, 10, 50, 100, 999, 1000] {
+                    assert_eq!(
+                        lines_bwd(&haystack, offset, 1000, stop),
+                        reference(&haystack, offset, 1000, stop)
+                    );
+                }
+            }
+        }
+    }
+}
@@ -3,10 +3,18 @@
 
 //! Provides various high-throughput utilities.
 
+mod ascii;
+mod lines_bwd;
+mod lines_fwd;
 mod memchr2;
 mod memrchr2;
 mod memset;
+mod run;
 
+pub use ascii::*;
+pub use lines_bwd::*;
+pub use lines_fwd::*;
 pub use memchr2::*;
 pub use memrchr2::*;
 pub use memset::*;
+pub use run::*;
@@ -0,0 +1,166 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+//! Skips over runs of equal 32-bit values, like the colors in a row of a framebuffer.
+
+use std::ptr;
+
+/// Returns the index of the first value in `haystack` after `offset` that differs from
+/// the one at `offset`. If there's none, or `offset` is out of bounds, `haystack.len()`
+/// is returned.
+pub fn skip_run(haystack: &[u32], offset: usize) -> usize {
+    if offset >= haystack.len() {
+        return haystack.len();
+    }
+    unsafe {
+        let beg = haystack.as_ptr();
+        let end = beg.add(haystack.len());
+        let it = beg.add(offset);
+        let it = skip_run_raw(*it, it.add(1), end);
+        it.offset_from_unsigned(beg)
+    }
+}
+
+unsafe fn skip_run_raw(needle: u32, beg: *const u32, end: *const u32) -> *const u32 {
+    #[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
+    return unsafe { SKIP_RUN_DISPATCH(needle, beg, end) };
+
+    #[cfg(target_arch = "aarch64")]
+    return unsafe { skip_run_neon(needle, beg, end) };
+
+    #[allow(unreachable_code)]
+    return unsafe { skip_run_fallback(needle, beg, end) };
+}
+
+unsafe fn skip_run_fallback(needle: u32, mut beg: *const u32, end: *const u32) -> *const u32 {
+    unsafe {
+        while !ptr::eq(beg, end) && *beg == needle {
+            beg = beg.add(1);
+        }
+        beg
+    }
+}
+
+// See `MEMCHR2_DISPATCH` for an explanation.
+#[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
+static mut SKIP_RUN_DISPATCH: unsafe fn(
+    needle: u32,
+    beg: *const u32,
+    end: *const u32,
+) -> *const u32 = skip_run_dispatch;
+
+#[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
+unsafe fn skip_run_dispatch(needle: u32, beg: *const u32, end: *const u32) -> *const u32 {
+    let func = if is_x86_feature_detected!("avx2") { skip_run_avx2 } else { skip_run_sse2 };
+    unsafe { SKIP_RUN_DISPATCH = func };
+    unsafe { func(needle, beg, end) }
+}
+
+// `movemask` yields 4 bits per 32-bit lane, hence the division by 4.
+
+#[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
+#[target_feature(enable = "sse2")]
+unsafe fn skip_run_sse2(needle: u32, mut beg: *const u32, end: *const u32) -> *const u32 {
+    unsafe {
+        #[cfg(target_arch = "x86")]
+        use std::arch::x86::*;
+        #[cfg(target_arch = "x86_64")]
+        use std::arch::x86_64::*;
+
+        let n = _mm_set1_epi32(needle as i32);
+        let mut remaining = end.offset_from_unsigned(beg);
+
+        while remaining >= 4 {
+            let v = _mm_loadu_si128(beg as *const _);
+            let m = !_mm_movemask_epi8(_mm_cmpeq_epi32(v, n)) as u32 & 0xFFFF;
+
+            if m != 0 {
+                return beg.add(m.trailing_zeros() as usize / 4);
+            }
+
+            beg = beg.add(4);
+            remaining -= 4;
+        }
+
+        skip_run_fallback(needle, beg, end)
+    }
+}
+
+#[cfg(any(target_arch = "x86", target_arch = "x86_64"))]
+#[target_feature(enable = "avx2")]
+unsafe fn skip_run_avx2(needle: u32, mut beg: *const u32, end: *const u32) -> *const u32 {
+    unsafe {
+        #[cfg(target_arch = "x86")]
+        use std::arch::x86::*;
+        #[cfg(target_arch = "x86_64")]
+        use std::arch::x86_64::*;
+
+        let n = _mm256_set1_epi32(needle as i32);
+        let mut remaining = end.offset_from_unsigned(beg);
+
+        while remaining >= 8 {
+            let v = _mm256_loadu_si256(beg as *const _);
+            let m = !(_mm256_movemask_epi8(_mm256_cmpeq_epi32(v, n)) as u32);
+
+            if m != 0 {
+                return beg.add(m.trailing_zeros() as usize / 4);
+            }
+
+            beg = beg.add(8);
+            remaining -= 8;
+        }
+
+        skip_run_fallback(needle, beg, end)
+    }
+}
+
+#[cfg(target_arch = "aarch64")]
+unsafe fn skip_run_neon(needle: u32, mut beg: *const u32, end: *const u32) -> *const u32 {
+    unsafe {
+        use std::arch::aarch64::*;
+
+        let n = vdupq_n_u32(needle);
+
+        while end.offset_from_unsigned(beg) >= 4 {
+            let v = vld1q_u32(beg);
+            let c = vceqq_u32(v, n);
+
+            if vminvq_u32(c) == 0 {
+                // See `memchr2_neon`. This yields 16 bits per 32-bit lane.
+                let m = vreinterpretq_u16_u32(c);
+                let m = vshrn_n_u16(m, 4);
+                let m = vreinterpret_u64_u8(m);
+                let m = !vget_lane_u64(m, 0);
+                return beg.add(m.trailing_zeros() as usize / 16);
+            }
+
+            beg = beg.add(4);
+        }
+
+        skip_run_fallback(needle, beg, end)
+    }
+}
+
+#[cfg(test)]
+mod test {
+    use super::*;
+
+    #[test]
+    fn test_skip_run() {
+        let mut haystack = vec![7u32; 100];
+        assert_eq!(skip_run(&haystack, 0), 100);
+        assert_eq!(skip_run(&haystack, 99), 100);
+        assert_eq!(skip_run(&haystack, 100), 100);
+        assert_eq!(skip_run(&[], 0), 0);
+
+        // Check each position within and around the SIMD blocks.
+        for i in 1..100 {
+            haystack[i] = 8;
+            for off in 0..i {
+                assert_eq!(skip_run(&haystack, off), i);
+            }
+            assert_eq!(skip_run(&haystack, i), i + 1);
+            haystack[i] = 7;
+        }
+    }
+}
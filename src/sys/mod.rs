@@ -15,3 +15,16 @@ pub use std::fs::canonicalize;
 pub use unix::*;
 #[cfg(windows)]
 pub use windows::*;
+
+use crate::arena::ArenaString;
+use crate::helpers::Size;
+
+/// The result of [`read_stdin`].
+pub struct StdinInput<'a> {
+    /// The text that was read. Empty if the timeout was reached.
+    pub text: ArenaString<'a>,
+    /// The new window size, if it changed or [`inject_window_size`] was called.
+    /// It's delivered separately instead of as a VT sequence in
+    /// the `text`, so that the input doesn't need to be copied.
+    pub resize: Option<Size>,
+}
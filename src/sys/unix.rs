@@ -14,9 +14,15 @@ use std::path::Path;
 use std::ptr::{self, NonNull, null_mut};
 use std::{thread, time};
 
-use crate::arena::{Arena, ArenaString, scratch_arena};
+use super::StdinInput;
+use crate::apperr;
+use crate::arena::{Arena, ArenaString};
 use crate::helpers::*;
-use crate::{apperr, arena_format};
+
+/// [`read_stdin`] reads this much at once, unless more input is pending.
+const READ_SIZE_MIN: usize = 4 * KIBI;
+/// [`read_stdin`] reads at most this much at once.
+const READ_SIZE_MAX: usize = MEBI;
 
 #[cfg(target_os = "netbsd")]
 const fn desired_mprotect(flags: c_int) -> c_int {
@@ -152,7 +158,8 @@ pub fn switch_modes() -> apperr::Result<()> {
     }
 }
 
-pub fn inject_window_size_into_stdin() {
+/// Makes the next [`read_stdin`] report the window size, even if it didn't change.
+pub fn inject_window_size() {
     unsafe {
         STATE.inject_resize = true;
     }
@@ -183,28 +190,25 @@ fn get_window_size() -> (u16, u16) {
 /// Reads from stdin.
 ///
 /// Returns `None` if there was an error reading from stdin.
-/// Returns `Some("")` if the given timeout was reached.
-/// Otherwise, it returns the read, non-empty string.
-pub fn read_stdin(arena: &Arena, mut timeout: time::Duration) -> Option<ArenaString<'_>> {
+/// Returns an empty text if the given timeout was reached.
+pub fn read_stdin(arena: &Arena, mut timeout: time::Duration) -> Option<StdinInput<'_>> {
     unsafe {
         if STATE.inject_resize {
             timeout = time::Duration::ZERO;
         }
 
-        let read_poll = timeout != time::Duration::MAX;
+        let mut read_poll = timeout != time::Duration::MAX;
         let mut buf = Vec::new_in(arena);
 
         // We don't know if the input is valid UTF8, so we first use a Vec and then
         // later turn it into UTF8 using `from_utf8_lossy_owned`.
         // It is important that we allocate the buffer with an explicit capacity,
         // because we later use `spare_capacity_mut` to access it.
-        buf.reserve(4 * KIBI);
+        buf.reserve(READ_SIZE_MIN);
 
         // We got some leftover broken UTF8 from a previous read? Prepend it.
-        if STATE.utf8_len != 0 {
-            STATE.utf8_len = 0;
-            buf.extend_from_slice(&STATE.utf8_buf[..STATE.utf8_len]);
-        }
+        buf.extend_from_slice(&STATE.utf8_buf[..STATE.utf8_len]);
+        STATE.utf8_len = 0;
 
         loop {
             if timeout != time::Duration::MAX {
@@ -243,6 +247,16 @@ pub fn read_stdin(arena: &Arena, mut timeout: time::Duration) -> Option<ArenaStr
             let ret = libc::read(STATE.stdin, spare.as_mut_ptr() as *mut _, spare.len());
             if ret > 0 {
                 buf.set_len(buf.len() + ret as usize);
+
+                // If the read filled the buffer, there's probably more, for instance
+                // during a paste. Pick it up right away with a larger buffer, so that
+                // it's processed in one go instead of one small chunk per frame.
+                if buf.len() == buf.capacity() && buf.capacity() < READ_SIZE_MAX {
+                    buf.reserve(buf.capacity());
+                    timeout = time::Duration::ZERO;
+                    read_poll = true;
+                    continue;
+                }
                 break;
             }
             if ret == 0 {
@@ -287,22 +301,22 @@ pub fn read_stdin(arena: &Arena, mut timeout: time::Duration) -> Option<ArenaStr
             }
         }
 
-        let mut result = ArenaString::from_utf8_lossy_owned(buf);
+        // Validates the input in place. It's only copied if it contains invalid UTF-8.
+        let mut text = ArenaString::from_utf8_lossy_owned(buf);
+        text.shrink_to_fit();
 
-        // We received a SIGWINCH? Add a fake window size sequence for our input parser.
-        // I prepend it so that on startup, the TUI system gets first initialized with a size.
+        // We received a SIGWINCH? Report the new size, which also
+        // initializes the TUI system with a size on startup.
+        let mut resize = None;
         if STATE.inject_resize {
             STATE.inject_resize = false;
             let (w, h) = get_window_size();
             if w > 0 && h > 0 {
-                let scratch = scratch_arena(Some(arena));
-                let seq = arena_format!(&scratch, "\x1b[8;{h};{w}t");
-                result.replace_range(0..0, &seq);
+                resize = Some(Size { width: w as CoordType, height: h as CoordType });
             }
         }
 
-        result.shrink_to_fit();
-        Some(result)
+        Some(StdinInput { text, resize })
     }
 }
 
@@ -320,7 +334,7 @@ pub fn write_stdout(text: &str) {
 
     while written < buf.len() {
         let w = &buf[written..];
-        let w = &buf[..w.len().min(GIBI)];
+        let w = &w[..w.len().min(GIBI)];
         let n = unsafe { libc::write(STATE.stdout, w.as_ptr() as *const _, w.len()) };
 
         if n >= 0 {
@@ -381,6 +395,43 @@ pub fn file_id(file: Option<&File>, path: &Path) -> apperr::Result<FileId> {
     }
 }
 
+/// Returns true if the given file may be replaced with a new one (via rename),
+/// without that being noticeable other than through its changed file ID.
+///
+/// That's not the case for files with multiple hard links (the other links would keep
+/// the old contents) or for files owned by someone else (the new one would be ours).
+pub fn file_is_replaceable(file: &File) -> bool {
+    use std::os::unix::fs::MetadataExt as _;
+
+    file.metadata()
+        .is_ok_and(|m| m.is_file() && m.nlink() == 1 && m.uid() == unsafe { libc::geteuid() })
+}
+
+/// Reserves disk space for the first `len` bytes of the file, without changing its size.
+/// This reduces fragmentation and lets us fail early if the disk is full.
+/// That's only an error if the disk is in fact full. Lack of support is not.
+pub fn file_preallocate(file: &File, len: u64) -> apperr::Result<()> {
+    #[cfg(target_os = "linux")]
+    if len > 0 {
+        let ret = unsafe {
+            libc::fallocate(file.as_raw_fd(), libc::FALLOC_FL_KEEP_SIZE, 0, len as libc::off_t)
+        };
+        if ret != 0 {
+            let err = errno();
+            if err == libc::ENOSPC || err == libc::EDQUOT {
+                return Err(errno_to_apperr(err));
+            }
+        }
+    }
+
+    #[cfg(not(target_os = "linux"))]
+    {
+        _ = (file, len);
+    }
+
+    Ok(())
+}
+
 /// Reserves a virtual memory region of the given size.
 /// To commit the memory, use `virtual_commit`.
 /// To release the memory, use `virtual_release`.
@@ -433,6 +484,78 @@ pub unsafe fn virtual_commit(base: NonNull<u8>, size: usize) -> apperr::Result<(
     }
 }
 
+/// Decommits a virtual memory region of the given size, returning its pages to the OS.
+/// The region remains reserved and can be committed again with `virtual_commit`.
+///
+/// # Safety
+///
+/// This function is unsafe because it uses raw pointers.
+/// Make sure to only pass pointers acquired from `virtual_reserve`
+/// and to pass a size less than or equal to the size passed to `virtual_reserve`.
+pub unsafe fn virtual_decommit(base: NonNull<u8>, size: usize) -> apperr::Result<()> {
+    unsafe {
+        // Mapping fresh memory over the region drops the old pages,
+        // just like `virtual_reserve` leaves it inaccessible.
+        let ptr = libc::mmap(
+            base.cast().as_ptr(),
+            size,
+            desired_mprotect(libc::PROT_READ | libc::PROT_WRITE),
+            libc::MAP_PRIVATE | libc::MAP_ANONYMOUS | libc::MAP_FIXED,
+            -1,
+            0,
+        );
+        if ptr::eq(ptr, libc::MAP_FAILED) { Err(errno_to_apperr(errno())) } else { Ok(()) }
+    }
+}
+
+/// Maps the first `len` bytes of `file` copy-on-write to `base`,
+/// replacing the memory that was previously there.
+///
+/// Pages are read from the file lazily as they're accessed and writes never
+/// reach the file. The mapping is released along with the rest of the region.
+/// If the file is truncated while it's mapped, accessing it will crash.
+///
+/// # Safety
+///
+/// This function is unsafe because it uses raw pointers.
+/// Make sure to only pass pointers acquired from `virtual_reserve`
+/// and to pass a size less than or equal to the size passed to `virtual_reserve`.
+pub unsafe fn virtual_map_file(base: NonNull<u8>, file: &File, len: usize) -> apperr::Result<()> {
+    unsafe {
+        let ptr = libc::mmap(
+            base.cast().as_ptr(),
+            len,
+            libc::PROT_READ | libc::PROT_WRITE,
+            libc::MAP_PRIVATE | libc::MAP_FIXED,
+            file.as_raw_fd(),
+            0,
+        );
+        if ptr::eq(ptr, libc::MAP_FAILED) { Err(errno_to_apperr(errno())) } else { Ok(()) }
+    }
+}
+
+/// Replaces (a part of) a mapping created by `virtual_map_file`
+/// with zeroed, committed memory that isn't backed by the file anymore.
+///
+/// # Safety
+///
+/// This function is unsafe because it uses raw pointers.
+/// Make sure to only pass pointers acquired from `virtual_reserve`
+/// and to pass a size less than or equal to the size passed to `virtual_reserve`.
+pub unsafe fn virtual_unmap_file(base: NonNull<u8>, size: usize) -> apperr::Result<()> {
+    unsafe {
+        let ptr = libc::mmap(
+            base.cast().as_ptr(),
+            size,
+            libc::PROT_READ | libc::PROT_WRITE,
+            libc::MAP_PRIVATE | libc::MAP_ANONYMOUS | libc::MAP_FIXED,
+            -1,
+            0,
+        );
+        if ptr::eq(ptr, libc::MAP_FAILED) { Err(errno_to_apperr(errno())) } else { Ok(()) }
+    }
+}
+
 unsafe fn load_library(name: &CStr) -> apperr::Result<NonNull<c_void>> {
     unsafe {
         NonNull::new(libc::dlopen(name.as_ptr(), libc::RTLD_LAZY))
@@ -2,7 +2,6 @@
 // Licensed under the MIT License.
 
 use std::ffi::{CStr, OsString, c_void};
-use std::fmt::Write as _;
 use std::fs::{self, File};
 use std::mem::MaybeUninit;
 use std::os::windows::io::{AsRawHandle as _, FromRawHandle};
@@ -16,6 +15,7 @@ use windows_sys::Win32::System::{Console, IO, LibraryLoader, Memory, Threading};
 use windows_sys::Win32::{Foundation, Globalization};
 use windows_sys::w;
 
+use super::StdinInput;
 use crate::apperr;
 use crate::arena::{Arena, ArenaString, scratch_arena};
 use crate::helpers::*;
@@ -186,10 +186,8 @@ pub fn switch_modes() -> apperr::Result<()> {
 }
 
 /// During startup we need to get the window size from the terminal.
-/// Because I didn't want to type a bunch of code, this function tells
-/// [`read_stdin`] to inject a fake sequence, which gets picked up by
-/// the input parser and provided to the TUI code.
-pub fn inject_window_size_into_stdin() {
+/// This function tells [`read_stdin`] to report it, even if it didn't change.
+pub fn inject_window_size() {
     unsafe {
         STATE.inject_resize = true;
     }
@@ -214,13 +212,12 @@ fn get_console_size() -> Option<Size> {
 /// # Returns
 ///
 /// * `None` if there was an error reading from stdin.
-/// * `Some("")` if the given timeout was reached.
-/// * Otherwise, it returns the read, non-empty string.
-pub fn read_stdin(arena: &Arena, mut timeout: time::Duration) -> Option<ArenaString<'_>> {
+/// * An empty text if the given timeout was reached.
+/// * Otherwise, it returns the read, non-empty text or a resize.
+pub fn read_stdin(arena: &Arena, mut timeout: time::Duration) -> Option<StdinInput<'_>> {
     let scratch = scratch_arena(Some(arena));
 
-    // On startup we're asked to inject a window size so that the UI system can layout the elements.
-    // --> Inject a fake sequence for our input parser.
+    // On startup we're asked to report the window size so that the UI system can layout the elements.
     let mut resize_event = None;
     if unsafe { STATE.inject_resize } {
         unsafe { STATE.inject_resize = false };
@@ -309,20 +306,10 @@ pub fn read_stdin(arena: &Arena, mut timeout: time::Duration) -> Option<ArenaStr
         }
     }
 
-    const RESIZE_EVENT_FMT_MAX_LEN: usize = 16; // "\x1b[8;65535;65535t"
-    let resize_event_len = if resize_event.is_some() { RESIZE_EVENT_FMT_MAX_LEN } else { 0 };
     // +1 to account for a potential `STATE.leading_surrogate`.
     let utf8_max_len = (utf16_buf_len + 1) * 3;
     let mut text = ArenaString::new_in(arena);
-    text.reserve(utf8_max_len + resize_event_len);
-
-    // Now prepend our previously extracted resize event.
-    if let Some(resize_event) = resize_event {
-        // If I read xterm's documentation correctly, CSI 18 t reports the window size in characters.
-        // CSI 8 ; height ; width t is the response. Of course, we didn't send the request,
-        // but we can use this fake response to trigger the editor to resize itself.
-        _ = write!(text, "\x1b[8;{};{}t", resize_event.height, resize_event.width);
-    }
+    text.reserve(utf8_max_len);
 
     // If the input ends with a lone lead surrogate, we need to remember it for the next read.
     if utf16_buf_len > 0 {
@@ -359,7 +346,7 @@ pub fn read_stdin(arena: &Arena, mut timeout: time::Duration) -> Option<ArenaStr
     }
 
     text.shrink_to_fit();
-    Some(text)
+    Some(StdinInput { text, resize: resize_event })
 }
 
 /// Writes a string to stdout.
@@ -459,6 +446,46 @@ fn file_id_from_handle(file: &File) -> apperr::Result<FileId> {
     }
 }
 
+/// Returns true if the given file may be replaced with a new one (via rename),
+/// without that being noticeable other than through its changed file ID.
+///
+/// That's not the case for files with multiple hard links,
+/// because the other links would keep the old contents.
+pub fn file_is_replaceable(file: &File) -> bool {
+    unsafe {
+        let mut info = MaybeUninit::<FileSystem::BY_HANDLE_FILE_INFORMATION>::uninit();
+        FileSystem::GetFileInformationByHandle(file.as_raw_handle(), info.as_mut_ptr()) != 0
+            && info.assume_init().nNumberOfLinks == 1
+    }
+}
+
+/// Reserves disk space for the first `len` bytes of the file, without changing its size.
+/// This reduces fragmentation and lets us fail early if the disk is full.
+/// That's only an error if the disk is in fact full. Lack of support is not.
+pub fn file_preallocate(file: &File, len: u64) -> apperr::Result<()> {
+    if len == 0 {
+        return Ok(());
+    }
+
+    unsafe {
+        let info = FileSystem::FILE_ALLOCATION_INFO { AllocationSize: len as i64 };
+        let ok = FileSystem::SetFileInformationByHandle(
+            file.as_raw_handle(),
+            FileSystem::FileAllocationInfo,
+            &info as *const _ as *const c_void,
+            mem::size_of::<FileSystem::FILE_ALLOCATION_INFO>() as u32,
+        );
+        if ok == 0 {
+            let gle = Foundation::GetLastError();
+            if gle == Foundation::ERROR_DISK_FULL {
+                return Err(gle_to_apperr(gle));
+            }
+        }
+    }
+
+    Ok(())
+}
+
 /// Canonicalizes the given path.
 ///
 /// This differs from [`fs::canonicalize`] in that it strips the `\\?\` UNC
@@ -540,6 +567,53 @@ pub unsafe fn virtual_commit(base: NonNull<u8>, size: usize) -> apperr::Result<(
     }
 }
 
+/// Decommits a virtual memory region of the given size, returning its pages to the OS.
+/// The region remains reserved and can be committed again with [`virtual_commit`].
+///
+/// # Safety
+///
+/// This function is unsafe because it uses raw pointers.
+/// Make sure to only pass pointers acquired from [`virtual_reserve`]
+/// and to pass a size less than or equal to the size passed to [`virtual_reserve`].
+pub unsafe fn virtual_decommit(base: NonNull<u8>, size: usize) -> apperr::Result<()> {
+    unsafe {
+        if Memory::VirtualFree(base.as_ptr() as *mut _, size, Memory::MEM_DECOMMIT) == 0 {
+            Err(get_last_error())
+        } else {
+            Ok(())
+        }
+    }
+}
+
+/// Maps the first `len` bytes of `file` copy-on-write to `base`.
+///
+/// Not supported on Windows, because file views can't be placed into a reserved region
+/// without the placeholder APIs. Callers are expected to fall back to reading the file.
+///
+/// # Safety
+///
+/// This function is unsafe because it uses raw pointers.
+/// Make sure to only pass pointers acquired from [`virtual_reserve`].
+pub unsafe fn virtual_map_file(
+    _base: NonNull<u8>,
+    _file: &File,
+    _len: usize,
+) -> apperr::Result<()> {
+    Err(gle_to_apperr(Foundation::ERROR_NOT_SUPPORTED))
+}
+
+/// Replaces a mapping created by [`virtual_map_file`] with regular memory.
+///
+/// Not supported on Windows. See [`virtual_map_file`].
+///
+/// # Safety
+///
+/// This function is unsafe because it uses raw pointers.
+/// Make sure to only pass pointers acquired from [`virtual_reserve`].
+pub unsafe fn virtual_unmap_file(_base: NonNull<u8>, _size: usize) -> apperr::Result<()> {
+    Err(gle_to_apperr(Foundation::ERROR_NOT_SUPPORTED))
+}
+
 unsafe fn get_module(name: *const u16) -> apperr::Result<NonNull<c_void>> {
     unsafe { check_ptr_return(LibraryLoader::GetModuleHandleW(name)) }
 }
@@ -0,0 +1,247 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT License.
+
+//! Lightweight timing instrumentation for the hot paths.
+//!
+//! Recording is off by default and costs a single relaxed load per [`span`]
+//! in that case. Once enabled via [`set_enabled`], every span is recorded
+//! into a bounded event log that can be written out as a Chrome trace
+//! (`chrome://tracing`, Perfetto) via [`write_chrome_trace`]. In addition,
+//! the span durations of the last frame and a histogram of the input latency
+//! are kept around, so that a summary can be shown while editing.
+
+use std::collections::VecDeque;
+use std::io::{self, Write as _};
+use std::sync::Mutex;
+use std::sync::atomic::{AtomicBool, Ordering};
+use std::time::{Duration, Instant};
+
+use crate::{arena, buffer};
+
+/// The maximum number of events kept for the trace. Older ones are dropped.
+/// At 32 bytes per event this caps the log at 2 MiB.
+const MAX_EVENTS: usize = 64 * 1024;
+
+/// The latency histogram has one bucket per power of two microseconds.
+const LATENCY_BUCKETS: usize = 32;
+
+static ENABLED: AtomicBool = AtomicBool::new(false);
+static RECORDER: Mutex<Recorder> = Mutex::new(Recorder::new());
+
+enum EventKind {
+    /// A span with the given duration in nanoseconds.
+    Span(u64),
+    /// A counter with the given value.
+    Counter(u64),
+}
+
+struct Event {
+    name: &'static str,
+    /// Nanoseconds since [`Recorder::epoch`].
+    ts: u64,
+    kind: EventKind,
+}
+
+struct Recorder {
+    epoch: Option<Instant>,
+    events: VecDeque<Event>,
+    /// The accumulated span durations of the frame in progress.
+    frame: Vec<(&'static str, Duration)>,
+    /// The accumulated span durations of the last completed frame.
+    last_frame: Vec<(&'static str, Duration)>,
+    last_frame_bytes: usize,
+    latencies: [u32; LATENCY_BUCKETS],
+}
+
+impl Recorder {
+    const fn new() -> Self {
+        Self {
+            epoch: None,
+            events: VecDeque::new(),
+            frame: Vec::new(),
+            last_frame: Vec::new(),
+            last_frame_bytes: 0,
+            latencies: [0; LATENCY_BUCKETS],
+        }
+    }
+
+    fn push(&mut self, name: &'static str, at: Instant, kind: EventKind) {
+        let epoch = *self.epoch.get_or_insert(at);
+        if self.events.len() >= MAX_EVENTS {
+            self.events.pop_front();
+        }
+        let ts = at.saturating_duration_since(epoch).as_nanos() as u64;
+        self.events.push_back(Event { name, ts, kind });
+    }
+}
+
+fn recorder() -> std::sync::MutexGuard<'static, Recorder> {
+    // A panic while holding the lock leaves nothing inconsistent that matters for statistics.
+    RECORDER.lock().unwrap_or_else(|e| e.into_inner())
+}
+
+/// Enables or disables recording. Disabling keeps what was recorded so far.
+pub fn set_enabled(enabled: bool) {
+    ENABLED.store(enabled, Ordering::Relaxed);
+}
+
+pub fn is_enabled() -> bool {
+    ENABLED.load(Ordering::Relaxed)
+}
+
+/// A timed scope, recorded when it's dropped. See [`span`].
+#[must_use]
+pub struct Span {
+    name: &'static str,
+    beg: Option<Instant>,
+}
+
+/// Starts timing a scope named `name`, until the returned [`Span`] is dropped.
+#[inline]
+pub fn span(name: &'static str) -> Span {
+    Span { name, beg: if is_enabled() { Some(Instant::now()) } else { None } }
+}
+
+impl Drop for Span {
+    fn drop(&mut self) {
+        if let Some(beg) = self.beg {
+            let end = Instant::now();
+            let dur = end - beg;
+            let mut r = recorder();
+
+            r.push(self.name, beg, EventKind::Span(dur.as_nanos() as u64));
+            match r.frame.iter_mut().find(|(name, _)| *name == self.name) {
+                Some((_, d)) => *d += dur,
+                None => r.frame.push((self.name, dur)),
+            }
+        }
+    }
+}
+
+/// Records the value of a counter, for instance a size.
+pub fn counter(name: &'static str, value: u64) {
+    if is_enabled() {
+        recorder().push(name, Instant::now(), EventKind::Counter(value));
+    }
+}
+
+/// Call this once a frame was written to the terminal. `bytes` is the size of
+/// its output and `latency` the time since the input that caused it was read, if any.
+pub fn frame_end(bytes: usize, latency: Option<Duration>) {
+    if !is_enabled() {
+        return;
+    }
+
+    let now = Instant::now();
+    let mut r = recorder();
+    let r = &mut *r;
+
+    r.push("output bytes", now, EventKind::Counter(bytes as u64));
+    r.push("scratch arena", now, EventKind::Counter(arena::scratch_committed() as u64));
+    r.push("scratch arena peak", now, EventKind::Counter(arena::scratch_peak() as u64));
+
+    let pools = buffer::pool_stats();
+    r.push("large buffer pool hits", now, EventKind::Counter(pools.large.hits as u64));
+    r.push("large buffer pool misses", now, EventKind::Counter(pools.large.misses as u64));
+    r.push("small buffer pool hits", now, EventKind::Counter(pools.small.hits as u64));
+    r.push("small buffer pool misses", now, EventKind::Counter(pools.small.misses as u64));
+
+    if let Some(latency) = latency {
+        let us = latency.as_micros().max(1) as u64;
+        let bucket = (us.ilog2() as usize).min(LATENCY_BUCKETS - 1);
+        r.latencies[bucket] += 1;
+    }
+
+    r.last_frame.clear();
+    r.last_frame.append(&mut r.frame);
+    r.last_frame_bytes = bytes;
+}
+
+/// Returns the total time spent in spans named `name` during the last frame.
+pub fn frame_time(name: &str) -> Duration {
+    recorder().last_frame.iter().find(|(n, _)| *n == name).map_or(Duration::ZERO, |(_, d)| *d)
+}
+
+/// Returns the output size of the last frame.
+pub fn frame_bytes() -> usize {
+    recorder().last_frame_bytes
+}
+
+/// Returns an upper bound for the given percentile (0-100) of the input latency.
+/// The histogram is logarithmic, so the result is only accurate to a factor of 2.
+pub fn latency_percentile(percentile: u32) -> Duration {
+    let r = recorder();
+    let total: u64 = r.latencies.iter().map(|&n| n as u64).sum();
+    let target = (total * percentile as u64).div_ceil(100).max(1);
+    let mut seen = 0;
+
+    for (i, &n) in r.latencies.iter().enumerate() {
+        seen += n as u64;
+        if seen >= target {
+            return Duration::from_micros(2 << i);
+        }
+    }
+
+    Duration::ZERO
+}
+
+/// Writes all recorded events in the Chrome trace event format.
+pub fn write_chrome_trace(out: &mut dyn io::Write) -> io::Result<()> {
+    let r = recorder();
+    let mut out = io::BufWriter::new(out);
+
+    out.write_all(b"{\"traceEvents\":[")?;
+
+    for (i, e) in r.events.iter().enumerate() {
+        if i != 0 {
+            out.write_all(b",")?;
+        }
+
+        // Timestamps are in microseconds. Names are string literals and need no escaping.
+        let ts = e.ts as f64 / 1000.0;
+        match e.kind {
+            EventKind::Span(dur) => write!(
+                out,
+                "{{\"name\":\"{}\",\"ph\":\"X\",\"ts\":{:.3},\"dur\":{:.3},\"pid\":1,\"tid\":1}}",
+                e.name,
+                ts,
+                dur as f64 / 1000.0
+            )?,
+            EventKind::Counter(value) => write!(
+                out,
+                "{{\"name\":\"{0}\",\"ph\":\"C\",\"ts\":{1:.3},\"pid\":1,\"args\":{{\"{0}\":{2}}}}}",
+                e.name, ts, value
+            )?,
+        }
+    }
+
+    out.write_all(b"]}\n")?;
+    out.flush()
+}
+
+#[cfg(test)]
+mod test {
+    use super::*;
+
+    #[test]
+    fn test_trace() {
+        set_enabled(true);
+        {
+            let _span = span("test");
+        }
+        frame_end(123, Some(Duration::from_micros(300)));
+        set_enabled(false);
+
+        assert_eq!(frame_bytes(), 123);
+        // 300µs falls into the [256, 512) bucket.
+        assert_eq!(latency_percentile(50), Duration::from_micros(512));
+
+        let mut out = Vec::new();
+        write_chrome_trace(&mut out).unwrap();
+        let out = String::from_utf8(out).unwrap();
+        assert!(out.starts_with("{\"traceEvents\":[{"));
+        assert!(out.contains("{\"name\":\"test\",\"ph\":\"X\","));
+        assert!(out.contains("{\"name\":\"output bytes\",\"ph\":\"C\","));
+        assert!(out.ends_with("}]}\n"));
+    }
+}
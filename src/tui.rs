@@ -153,7 +153,9 @@ use crate::arena::{Arena, ArenaString, scratch_arena};
 use crate::buffer::{CursorMovement, RcTextBuffer, TextBuffer, TextBufferCell};
 use crate::cell::*;
 use crate::document::WriteableDocument;
-use crate::framebuffer::{Attributes, Framebuffer, INDEXED_COLORS_COUNT, IndexedColor};
+use crate::framebuffer::{
+    Attributes, Framebuffer, INDEXED_COLORS_COUNT, IndexedColor, RenderStats,
+};
 use crate::hash::*;
 use crate::helpers::*;
 use crate::input::{InputKeyMod, kbmod, vk};
@@ -313,6 +315,9 @@ pub struct Tui {
     prev_node_map: NodeMap<'static>,
     /// The framebuffer used for rendering.
     framebuffer: Framebuffer,
+    /// For each row of the last rendered frame, a hash of the nodes drawn onto it.
+    /// Used to figure out which rows need to be drawn again.
+    row_fingerprints: Vec<u64>,
 
     modifier_translations: ModifierTranslations,
     floater_default_bg: u32,
@@ -388,6 +393,7 @@ impl Tui {
             prev_tree,
             prev_node_map: Default::default(),
             framebuffer: Framebuffer::new(),
+            row_fingerprints: Vec::new(),
 
             modifier_translations: ModifierTranslations {
                 ctrl: "Ctrl",
@@ -827,94 +833,77 @@ impl Tui {
 
     /// Renders the last frame into the framebuffer and returns the VT output.
     pub fn render<'a>(&mut self, arena: &'a Arena) -> ArenaString<'a> {
-        self.framebuffer.flip(self.size);
+        // Rows onto which the same nodes draw the same way as in the last frame
+        // look the same as well. The framebuffer carries them over as they are.
+        {
+            let scratch = scratch_arena(Some(arena));
+            let mut rows = Vec::new_in(&*scratch);
+            rows.resize(self.size.height.max(0) as usize, 0u64);
+
+            for child in self.prev_tree.iterate_roots() {
+                Self::fingerprint_node(&child.borrow(), &mut rows);
+            }
+
+            self.framebuffer.flip_damaged(self.size, |y| {
+                self.row_fingerprints.get(y as usize) != Some(&rows[y as usize])
+            });
+            self.row_fingerprints.clear();
+            self.row_fingerprints.extend_from_slice(&rows);
+        }
+
         for child in self.prev_tree.iterate_roots() {
             let mut child = child.borrow_mut();
             self.render_node(&mut child);
         }
-        self.framebuffer.render(arena)
-    }
+        let output = self.framebuffer.render(arena);
 
-    /// Recursively renders each node and its children.
-    #[allow(clippy::only_used_in_recursion)]
-    fn render_node(&mut self, node: &mut Node) {
-        let outer_clipped = node.outer_clipped;
-        if outer_clipped.is_empty() {
-            return;
-        }
-
-        let scratch = scratch_arena(None);
-
-        if node.attributes.bordered {
-            // ┌────┐
-            {
-                let mut fill = ArenaString::new_in(&scratch);
-                fill.push('┌');
-                fill.push_repeat('─', (outer_clipped.right - outer_clipped.left - 2) as usize);
-                fill.push('┐');
-                self.framebuffer.replace_text(
-                    outer_clipped.top,
-                    outer_clipped.left,
-                    outer_clipped.right,
-                    &fill,
-                );
-            }
+        // Return the memory to the OS that the trees of past frames needed, but recent ones don't.
+        self.arena_prev.trim();
+        self.arena_next.trim();
 
-            // │    │
-            {
-                let mut fill = ArenaString::new_in(&scratch);
-                fill.push('│');
-                fill.push_repeat(' ', (outer_clipped.right - outer_clipped.left - 2) as usize);
-                fill.push('│');
+        output
+    }
 
-                for y in outer_clipped.top + 1..outer_clipped.bottom - 1 {
-                    self.framebuffer.replace_text(
-                        y,
-                        outer_clipped.left,
-                        outer_clipped.right,
-                        &fill,
-                    );
-                }
-            }
+    /// Returns statistics about the output of the last [`Tui::render`] call.
+    pub fn render_stats(&self) -> RenderStats {
+        self.framebuffer.stats()
+    }
 
-            // └────┘
-            {
-                let mut fill = ArenaString::new_in(&scratch);
-                fill.push('└');
-                fill.push_repeat('─', (outer_clipped.right - outer_clipped.left - 2) as usize);
-                fill.push('┘');
-                self.framebuffer.replace_text(
-                    outer_clipped.bottom - 1,
-                    outer_clipped.left,
-                    outer_clipped.right,
-                    &fill,
-                );
-            }
+    /// Folds the fingerprint of each node into the rows it draws onto.
+    /// This must visit the same nodes in the same order as [`Tui::render_node`].
+    fn fingerprint_node(node: &Node, rows: &mut [u64]) {
+        if node.outer_clipped.is_empty() {
+            return;
         }
 
-        if node.attributes.float.is_some() && node.attributes.bg & 0xff000000 == 0xff000000 {
-            if !node.attributes.bordered {
-                let mut fill = ArenaString::new_in(&scratch);
-                fill.push_repeat(' ', (outer_clipped.right - outer_clipped.left) as usize);
+        let fingerprint = node.render_fingerprint();
+        let top = node.outer.top.clamp(0, rows.len() as CoordType) as usize;
+        let bottom = node.outer.bottom.clamp(0, rows.len() as CoordType) as usize;
+        for row in &mut rows[top..bottom] {
+            *row = hash(*row, &fingerprint.to_ne_bytes());
+        }
 
-                for y in outer_clipped.top..outer_clipped.bottom {
-                    self.framebuffer.replace_text(
-                        y,
-                        outer_clipped.left,
-                        outer_clipped.right,
-                        &fill,
-                    );
-                }
-            }
+        if node.inner_clipped.is_empty() {
+            return;
+        }
 
-            self.framebuffer.replace_attr(outer_clipped, Attributes::All, Attributes::None);
+        for child in Tree::iterate_siblings(node.children.first) {
+            Self::fingerprint_node(&child.borrow(), rows);
         }
+    }
 
-        self.framebuffer.blend_bg(outer_clipped, node.attributes.bg);
-        self.framebuffer.blend_fg(outer_clipped, node.attributes.fg);
+    /// Recursively renders each node and its children.
+    fn render_node(&mut self, node: &mut Node) {
+        let outer_clipped = node.outer_clipped;
+        if outer_clipped.is_empty() {
+            return;
+        }
 
-        if node.attributes.reverse {
-            self.framebuffer.reverse(outer_clipped);
+        // If none of the rows of this node changed, the framebuffer already contains it.
+        // The cursor and scrollbar thumb sizes still need to be computed, however.
+        let damaged = self.framebuffer.is_dirty(node.outer);
+        if damaged {
+            self.render_node_background(node);
         }
 
         let inner = node.inner;
@@ -925,7 +914,7 @@ impl Tui {
 
         match &mut node.content {
             NodeContent::Modal(title) => {
-                if !title.is_empty() {
+                if damaged && !title.is_empty() {
                     self.framebuffer.replace_text(
                         node.outer.top,
                         node.outer.left + 2,
@@ -934,13 +923,17 @@ impl Tui {
                     );
                 }
             }
-            NodeContent::Text(content) => self.render_styled_text(
-                inner,
-                node.intrinsic_size.width,
-                &content.text,
-                &content.chunks,
-                content.overflow,
-            ),
+            NodeContent::Text(content) => {
+                if damaged {
+                    self.render_styled_text(
+                        inner,
+                        node.intrinsic_size.width,
+                        &content.text,
+                        &content.chunks,
+                        content.overflow,
+                    );
+                }
+            }
             NodeContent::Textarea(tc) => {
                 let mut tb = tc.buffer.borrow_mut();
                 let mut destination = Rect {
@@ -955,7 +948,14 @@ impl Tui {
                     destination.right -= 1;
                 }
 
-                if let Some(res) =
+                if !damaged {
+                    tb.render_cursor(
+                        tc.scroll_offset,
+                        destination,
+                        tc.has_focus,
+                        &mut self.framebuffer,
+                    );
+                } else if let Some(res) =
                     tb.render(tc.scroll_offset, destination, tc.has_focus, &mut self.framebuffer)
                 {
                     tc.scroll_offset_x_max = res.visual_pos_x_max;
@@ -1001,6 +1001,84 @@ impl Tui {
         }
     }
 
+    /// Draws the borders and colors of a node.
+    fn render_node_background(&mut self, node: &Node) {
+        let outer_clipped = node.outer_clipped;
+        let scratch = scratch_arena(None);
+
+        if node.attributes.bordered {
+            // ┌────┐
+            {
+                let mut fill = ArenaString::new_in(&scratch);
+                fill.push('┌');
+                fill.push_repeat('─', (outer_clipped.right - outer_clipped.left - 2) as usize);
+                fill.push('┐');
+                self.framebuffer.replace_text(
+                    outer_clipped.top,
+                    outer_clipped.left,
+                    outer_clipped.right,
+                    &fill,
+                );
+            }
+
+            // │    │
+            {
+                let mut fill = ArenaString::new_in(&scratch);
+                fill.push('│');
+                fill.push_repeat(' ', (outer_clipped.right - outer_clipped.left - 2) as usize);
+                fill.push('│');
+
+                for y in outer_clipped.top + 1..outer_clipped.bottom - 1 {
+                    self.framebuffer.replace_text(
+                        y,
+                        outer_clipped.left,
+                        outer_clipped.right,
+                        &fill,
+                    );
+                }
+            }
+
+            // └────┘
+            {
+                let mut fill = ArenaString::new_in(&scratch);
+                fill.push('└');
+                fill.push_repeat('─', (outer_clipped.right - outer_clipped.left - 2) as usize);
+                fill.push('┘');
+                self.framebuffer.replace_text(
+                    outer_clipped.bottom - 1,
+                    outer_clipped.left,
+                    outer_clipped.right,
+                    &fill,
+                );
+            }
+        }
+
+        if node.attributes.float.is_some() && node.attributes.bg & 0xff000000 == 0xff000000 {
+            if !node.attributes.bordered {
+                let mut fill = ArenaString::new_in(&scratch);
+                fill.push_repeat(' ', (outer_clipped.right - outer_clipped.left) as usize);
+
+                for y in outer_clipped.top..outer_clipped.bottom {
+                    self.framebuffer.replace_text(
+                        y,
+                        outer_clipped.left,
+                        outer_clipped.right,
+                        &fill,
+                    );
+                }
+            }
+
+            self.framebuffer.replace_attr(outer_clipped, Attributes::All, Attributes::None);
+        }
+
+        self.framebuffer.blend_bg(outer_clipped, node.attributes.bg);
+        self.framebuffer.blend_fg(outer_clipped, node.attributes.fg);
+
+        if node.attributes.reverse {
+            self.framebuffer.reverse(outer_clipped);
+        }
+    }
+
     fn render_styled_text(
         &mut self,
         target: Rect,
@@ -3730,6 +3808,57 @@ struct Node<'a> {
 }
 
 impl Node<'_> {
+    /// Returns a hash of everything [`Tui::render_node`] and [`Tui::render_node_background`]
+    /// draw this node from. If it's unchanged, then so is the node's appearance (not counting
+    /// its children). The cursor and scrollbars are still rendered for undamaged nodes,
+    /// but the framebuffer clips them to its dirty rows.
+    fn render_fingerprint(&self) -> u64 {
+        let mut h = 0;
+        let mut mix = |v: i64| h = hash(h, &v.to_ne_bytes());
+
+        for r in [self.outer, self.inner, self.outer_clipped, self.inner_clipped] {
+            mix(r.left as i64);
+            mix(r.top as i64);
+            mix(r.right as i64);
+            mix(r.bottom as i64);
+        }
+        mix(self.attributes.bg as i64);
+        mix(self.attributes.fg as i64);
+        mix(self.attributes.reverse as i64
+            | (self.attributes.bordered as i64) << 1
+            | (self.attributes.float.is_some() as i64) << 2);
+
+        match &self.content {
+            NodeContent::Modal(title) => mix(hash_str(0, title) as i64),
+            NodeContent::Text(content) => {
+                mix(hash_str(0, &content.text) as i64);
+                mix(self.intrinsic_size.width as i64);
+                mix(content.overflow as i64);
+                for chunk in &content.chunks {
+                    mix(chunk.offset as i64);
+                    mix(chunk.fg as i64);
+                    mix(chunk.attr.is(Attributes::Italic) as i64
+                        | (chunk.attr.is(Attributes::Underlined) as i64) << 1);
+                }
+            }
+            NodeContent::Textarea(tc) => {
+                let tb = tc.buffer.borrow();
+                mix(tb.render_fingerprint() as i64);
+                mix(tc.scroll_offset.x as i64);
+                mix(tc.scroll_offset.y as i64);
+                mix(tc.single_line as i64 | (tc.has_focus as i64) << 1);
+            }
+            NodeContent::Scrollarea(sc) => {
+                let content = self.children.first.unwrap().borrow();
+                mix(sc.scroll_offset.y as i64);
+                mix(content.intrinsic_size.height as i64);
+            }
+            _ => {}
+        }
+
+        h
+    }
+
     /// Given an outer rectangle (including padding and borders) of this node,
     /// this returns the inner rectangle (excluding padding and borders).
     fn outer_to_inner(&self, mut outer: Rect) -> Rect {
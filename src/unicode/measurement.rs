@@ -7,7 +7,7 @@ use super::Utf8Chars;
 use super::tables::*;
 use crate::document::ReadableDocument;
 use crate::helpers::{CoordType, Point};
-use crate::simd::{memchr2, memrchr2};
+use crate::simd;
 
 /// Stores a position inside a [`ReadableDocument`].
 ///
@@ -196,6 +196,58 @@ impl<'doc> MeasurementConfig<'doc> {
                 break;
             }
 
+            // Fast path: Printable ASCII characters are 1 column wide clusters of their own.
+            // If the current cluster starts with one, we can skip the rest of the run without
+            // consulting the tables. Since the last character of the run may still be joined by
+            // whatever follows it (e.g. a combining mark), it's left for the regular loop below.
+            // The run is also cut short at the targets and the word wrap column, so that none
+            // of the checks further below would've triggered for the skipped clusters.
+            let source = chunk_iter.source();
+            let pos = chunk_iter.offset();
+            if pos > 0
+                && props_next_cluster != ucd_start_of_text_properties()
+                && chunk_range.start + pos - 1 == offset
+                && (0x20..0x7F).contains(&source[pos - 1])
+            {
+                let end = simd::skip_printable_ascii(source, pos);
+                let mut count = (end - pos).min(offset_target - offset) as CoordType;
+                count = count.min(logical_target_x - logical_pos_x);
+                count = count.min(visual_target_x - visual_pos_x);
+                if word_wrap_column > 0 {
+                    count = count.min(word_wrap_column - visual_pos_x);
+                }
+
+                if count > 0 {
+                    let count_usize = count as usize;
+
+                    // Only the last wrap opportunity within the run matters.
+                    if word_wrap_column > 0 {
+                        for i in (1..=count_usize).rev() {
+                            let lead = ucd_grapheme_cluster_lookup(source[pos + i - 2] as char);
+                            let trail = ucd_grapheme_cluster_lookup(source[pos + i - 1] as char);
+                            if !ucd_line_break_joins(lead, trail) {
+                                wrap_opp = true;
+                                wrap_opp_offset = offset + i;
+                                wrap_opp_logical_pos_x = logical_pos_x + i as CoordType;
+                                wrap_opp_visual_pos_x = visual_pos_x + i as CoordType;
+                                wrap_opp_column = column + i as CoordType;
+                                break;
+                            }
+                        }
+                    }
+
+                    offset += count_usize;
+                    logical_pos_x += count;
+                    visual_pos_x += count;
+                    column += count;
+
+                    props_next_cluster =
+                        ucd_grapheme_cluster_lookup(source[pos + count_usize - 1] as char);
+                    chunk_iter.seek(pos + count_usize);
+                    continue;
+                }
+            }
+
             let props_current_cluster = props_next_cluster;
             let mut props_last_char;
             let mut offset_next_cluster;
@@ -515,8 +567,8 @@ impl<'doc> MeasurementConfig<'doc> {
 /// * The line number that was reached.
 pub fn newlines_forward(
     text: &[u8],
-    mut offset: usize,
-    mut line: CoordType,
+    offset: usize,
+    line: CoordType,
     line_stop: CoordType,
 ) -> (usize, CoordType) {
     // Leaving the cursor at the beginning of the current line when the limit
@@ -525,30 +577,7 @@ pub fn newlines_forward(
         return newlines_backward(text, offset, line, line_stop);
     }
 
-    let len = text.len();
-    offset = offset.min(len);
-
-    loop {
-        // TODO: This code could be optimized by replacing memchr with manual line counting.
-        //
-        // If `line_stop` is very far away, we could accumulate newline counts horizontally
-        // in a AVX2 register (= 32 u8 slots). Then, every 256 bytes we compute the horizontal
-        // sum via `_mm256_sad_epu8` yielding us the newline count in the last block.
-        //
-        // We could also just use `_mm256_sad_epu8` on each fetch as-is.
-        offset = memchr2(b'\n', b'\n', text, offset);
-        if offset >= len {
-            break;
-        }
-
-        offset += 1;
-        line += 1;
-        if line >= line_stop {
-            break;
-        }
-    }
-
-    (offset, line)
+    simd::lines_fwd(text, offset, line, line_stop)
 }
 
 /// Seeks backward to the given line start.
@@ -565,23 +594,11 @@ pub fn newlines_forward(
 /// it'll seek backward to the line start.
 pub fn newlines_backward(
     text: &[u8],
-    mut offset: usize,
-    mut line: CoordType,
+    offset: usize,
+    line: CoordType,
     line_stop: CoordType,
 ) -> (usize, CoordType) {
-    offset = offset.min(text.len());
-
-    loop {
-        offset = match memrchr2(b'\n', b'\n', text, offset) {
-            Some(i) => i,
-            None => return (0, line),
-        };
-        if line <= line_stop {
-            // +1: Past the newline, at the start of the current line.
-            return (offset + 1, line);
-        }
-        line -= 1;
-    }
+    simd::lines_bwd(text, offset, line, line_stop)
 }
 
 /// Returns an offset past a newline.
@@ -619,6 +636,7 @@ pub fn strip_newline(mut text: &[u8]) -> &[u8] {
 #[cfg(test)]
 mod test {
     use super::*;
+    use crate::helpers::TestRng;
 
     struct ChunkedDoc<'a>(&'a [&'a [u8]]);
 
@@ -1160,6 +1178,63 @@ mod test {
         );
     }
 
+    // The fast path for printable ASCII must produce the same results as the regular one.
+    // Giving each cluster a chunk of its own disables the fast path, which yields the reference.
+    #[test]
+    fn test_ascii_fast_path() {
+        fn measure(
+            doc: &dyn ReadableDocument,
+            tab_size: CoordType,
+            word_wrap_column: CoordType,
+        ) -> MeasurementConfig<'_> {
+            MeasurementConfig::new(doc)
+                .with_tab_size(tab_size)
+                .with_word_wrap_column(word_wrap_column)
+        }
+
+        let tokens =
+            ["foo", "a", " ", "  ", "\t", "\n", "\r\n", "-", "(", ")", "e\u{301}", "\u{4E00}"];
+        let mut rng = TestRng::default();
+        let mut clusters = Vec::new();
+
+        for _ in 0..400 {
+            let token = tokens[rng.below(tokens.len())];
+            match token {
+                "foo" | "  " => clusters.extend(token.as_bytes().chunks(1)),
+                _ => clusters.push(token.as_bytes()),
+            }
+        }
+
+        let text = clusters.concat();
+        let text = text.as_slice();
+        let chunked = ChunkedDoc(&clusters);
+
+        for tab_size in [1, 4] {
+            for word_wrap_column in [0, 1, 5, 13, 40] {
+                for offset in 0..=text.len() {
+                    assert_eq!(
+                        measure(&text, tab_size, word_wrap_column).goto_offset(offset),
+                        measure(&chunked, tab_size, word_wrap_column).goto_offset(offset)
+                    );
+                }
+
+                for y in 0..20 {
+                    for x in [0, 1, 3, 7, 12, 13, 14, 39, 40, 41, 100] {
+                        let pos = Point { x, y };
+                        assert_eq!(
+                            measure(&text, tab_size, word_wrap_column).goto_logical(pos),
+                            measure(&chunked, tab_size, word_wrap_column).goto_logical(pos)
+                        );
+                        assert_eq!(
+                            measure(&text, tab_size, word_wrap_column).goto_visual(pos),
+                            measure(&chunked, tab_size, word_wrap_column).goto_visual(pos)
+                        );
+                    }
+                }
+            }
+        }
+    }
+
     #[test]
     fn test_newlines_and_strip() {
         // Offset line 0: 0
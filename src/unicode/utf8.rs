@@ -3,6 +3,8 @@
 
 use std::{hint, iter};
 
+use crate::simd;
+
 /// An iterator over UTF-8 encoded characters.
 ///
 /// This differs from [`std::str::Chars`] in that it works on unsanitized
@@ -239,6 +241,42 @@ impl Iterator for Utf8Chars<'_> {
         }
     }
 
+    // Consuming iterators can skip long ASCII runs in bulk. Short runs, like the spaces and
+    // punctuation in between CJK text, are cheaper to handle one by one, which is why
+    // the bulk skip only kicks in once a couple ASCII characters were seen in a row.
+    fn fold<B, F>(mut self, init: B, mut f: F) -> B
+    where
+        F: FnMut(B, Self::Item) -> B,
+    {
+        let mut acc = init;
+        let mut ascii_run = 0;
+
+        while self.offset < self.source.len() {
+            let c = self.source[self.offset];
+            self.offset += 1;
+
+            if (c & 0x80) != 0 {
+                ascii_run = 0;
+                acc = f(acc, self.next_slow(c));
+                continue;
+            }
+
+            acc = f(acc, c as char);
+            ascii_run += 1;
+
+            if ascii_run >= 16 {
+                let end = simd::skip_ascii(self.source, self.offset);
+                for &c in &self.source[self.offset..end] {
+                    acc = f(acc, c as char);
+                }
+                self.offset = end;
+                ascii_run = 0;
+            }
+        }
+
+        acc
+    }
+
     #[inline]
     fn size_hint(&self) -> (usize, Option<usize>) {
         // Lower bound: All remaining bytes are 4-byte sequences.
@@ -254,6 +292,25 @@ impl iter::FusedIterator for Utf8Chars<'_> {}
 mod tests {
     use super::*;
 
+    #[test]
+    fn test_fold() {
+        let source = "abc\u{e4}\u{20ac}\u{1f600}x".repeat(8) + "\u{e4}" + &"y".repeat(40);
+        let mut source = source.into_bytes();
+        source.extend_from_slice(&[0xE2, 0x82, b'z', 0xFF]);
+
+        // `collect` would use `fold` as well.
+        let mut expected = Vec::new();
+        for ch in Utf8Chars::new(&source, 0) {
+            expected.push(ch);
+        }
+
+        let actual = Utf8Chars::new(&source, 0).fold(Vec::new(), |mut v, ch| {
+            v.push(ch);
+            v
+        });
+        assert_eq!(actual, expected);
+    }
+
     #[test]
     fn test_broken_utf8() {
         let source = [b'a', 0xED, 0xA0, 0x80, b'b'];
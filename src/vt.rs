@@ -126,6 +126,16 @@ impl<'input> Stream<'_, 'input> {
         self.off
     }
 
+    /// Skips ahead to the next escape character, unless the parser is in the middle of a sequence.
+    /// Returns the new offset. Everything skipped is text and control characters, which is all
+    /// that's needed if they're taken literally anyway, like in a bracketed paste.
+    pub fn skip_to_escape(&mut self) -> usize {
+        if matches!(self.parser.state, State::Ground) {
+            self.off = memchr2(0x1b, 0x1b, self.input.as_bytes(), self.off);
+        }
+        self.off
+    }
+
     /// Reads and consumes raw bytes from the input.
     pub fn read(&mut self, dst: &mut [u8]) -> usize {
         let bytes = self.input.as_bytes();